@@ -0,0 +1,827 @@
+// Batch.cpp
+//
+// Image saving, contact sheet and atlas generation. Nothing in here touches the UI or the viewer's image list so it may be
+// used by the viewer dialogs as well as by tools that run without a window.
+//
+// Copyright (c) 2019, 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <algorithm>
+#include <condition_variable>
+#include <System/tFile.h>
+#include <System/tMachine.h>
+#include <Math/tFundamentals.h>
+#include <Image/tPicture.h>
+#include "Batch.h"
+#include "Image.h"
+#include "Resample.h"
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+using namespace tStd;
+using namespace tMath;
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Returns a new picture of the image's current part resampled to the frame size, or null if it couldn't be loaded.
+	// Safe to call from a worker thread for anything other than unloaded dds files.
+	tPicture* LoadContactFrame(Image&, int frameWidth, int frameHeight, int filter, bool& opaque);
+
+	// Gets the rectangle of a cell in sheet pixel coordinates. Cells are numbered left-to-right from the top row.
+	void GetContactCell(int& x, int& y, int& w, int& h, int cell, int sheetWidth, int sheetHeight, int numCols, int numRows);
+
+	// A single frame of an atlas. Positions use a top-left origin to match the manifest.
+	struct AtlasFrame
+	{
+		tPicture* Picture	= nullptr;		// Trimmed. Freed once copied into the atlas.
+		tString Name;
+		int Part			= 0;
+		int Width			= 0;			// Trimmed size.
+		int Height			= 0;
+		int SourceWidth		= 0;
+		int SourceHeight	= 0;
+		int TrimX			= 0;			// Where the trimmed rect came from in the source.
+		int TrimY			= 0;
+		float Duration		= 0.0f;
+		int X				= 0;			// Where the trimmed rect is in the atlas.
+		int Y				= 0;
+	};
+
+	// Appends the frames of one image. Safe to call from a worker thread for anything other than unloaded dds files.
+	void LoadAtlasFrames(std::vector<AtlasFrame>& frames, Image&, const AtlasOptions&);
+
+	// Returns a new picture with fully transparent borders removed. The trim offset has a top-left origin.
+	tPicture* TrimPicture(const tPicture&, int& trimX, int& trimY);
+
+	// Sets the position of every frame and the atlas size. Returns false if they don't fit.
+	bool PackAtlasFrames(std::vector<AtlasFrame>& frames, int& width, int& height, const AtlasOptions&);
+	bool WriteAtlasManifest(const tString& manifestFile, const tString& atlasFile, int width, int height, const std::vector<AtlasFrame>& frames);
+	tString EscapeJSON(const tString&);
+}
+
+
+void Viewer::FindImageFiles(tList<tStringItem>& foundFiles, const tString& dir)
+{
+	tSystem::tFindFiles(foundFiles, dir, "jpg");
+	tSystem::tFindFiles(foundFiles, dir, "gif");
+	tSystem::tFindFiles(foundFiles, dir, "webp");
+	tSystem::tFindFiles(foundFiles, dir, "tga");
+	tSystem::tFindFiles(foundFiles, dir, "png");
+	tSystem::tFindFiles(foundFiles, dir, "tif");
+	tSystem::tFindFiles(foundFiles, dir, "tiff");
+	tSystem::tFindFiles(foundFiles, dir, "bmp");
+	tSystem::tFindFiles(foundFiles, dir, "dds");
+	tSystem::tFindFiles(foundFiles, dir, "hdr");
+	tSystem::tFindFiles(foundFiles, dir, "rgbe");
+	tSystem::tFindFiles(foundFiles, dir, "exr");
+	tSystem::tFindFiles(foundFiles, dir, "ico");
+}
+
+
+tString Viewer::GetSaveFileTypeExtension(int saveFileType)
+{
+	tString extension = ".tga";
+	switch (saveFileType)
+	{
+		case 0: extension = ".tga"; break;
+		case 1: extension = ".png"; break;
+		case 2: extension = ".bmp"; break;
+		case 3: extension = ".jpg"; break;
+		case 4: extension = ".gif"; break;
+	}
+	return extension;
+}
+
+
+Viewer::SaveOptions::SaveOptions() :
+	FileType(Config.SaveFileType),
+	TargaRLE(Config.SaveFileTargaRLE),
+	JpegQuality(Config.SaveFileJpegQuality),
+	ResampleFilter(Config.ResampleFilter)
+{
+}
+
+
+void Viewer::GetSaveSize(int& outW, int& outH, int srcW, int srcH, int width, int height, float scale, Settings::SizeMode sizeMode)
+{
+	outW = srcW;
+	outH = srcH;
+	float aspect = float(srcW) / float(srcH);
+
+	switch (sizeMode)
+	{
+		case Settings::SizeMode::Percent:
+			if (tMath::tApproxEqual(scale, 1.0f, 0.01f))
+				break;
+			outW = int( tRound(float(outW)*scale) );
+			outH = int( tRound(float(outH)*scale) );
+			break;
+
+		case Settings::SizeMode::SetWidthAndHeight:
+			outW = width;
+			outH = height;
+			break;
+
+		case Settings::SizeMode::SetWidthRetainAspect:
+			outW = width;
+			outH = int( tRound(float(width) / aspect) );
+			break;
+
+		case Settings::SizeMode::SetHeightRetainAspect:
+			outH = height;
+			outW = int( tRound(float(height) * aspect) );
+			break;
+	};
+	tMath::tiClampMin(outW, 4);
+	tMath::tiClampMin(outH, 4);
+}
+
+
+bool Viewer::SavePicture(tPicture& picture, const tString& outFile, const SaveOptions& options, bool opaque)
+{
+	bool success = false;
+	tImage::tPicture::tColourFormat colourFmt = opaque ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
+	if (options.FileType == 0)
+		success = picture.SaveTGA(outFile, tImage::tImageTGA::tFormat::Auto, options.TargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
+	else
+		success = picture.Save(outFile, colourFmt, options.JpegQuality);
+
+	if (success)
+		tPrintf("Saved image as %s\n", outFile.Chars());
+	else
+		tPrintf("Failed to save image %s\n", outFile.Chars());
+
+	return success;
+}
+
+
+bool Viewer::SaveImageAs(Image& img, const tString& outFile, int width, int height, float scale, Settings::SizeMode sizeMode)
+{
+	// We make sure to maintain the loaded/unloaded state. This function may be called many times in succession
+	// so we don't want them all in memory at once by indiscriminantly loading them all.
+	img.UpdateEdits(true);
+	bool imageLoaded = img.IsLoaded();
+	if (!imageLoaded)
+		img.Load();
+
+	tPicture* currPic = img.GetCurrentPic();
+	if (!currPic)
+		return false;
+
+	// Make a temp copy we can safely resize. Resampling never makes an opaque picture transparent.
+	tImage::tPicture outPic;
+	outPic.Set(*currPic);
+	bool opaque = img.IsOpaque();
+
+	// Restore loadedness.
+	if (!imageLoaded)
+		img.Unload();
+
+	SaveOptions options;
+	int outW, outH;
+	GetSaveSize(outW, outH, outPic.GetWidth(), outPic.GetHeight(), width, height, scale, sizeMode);
+	if ((outPic.GetWidth() != outW) || (outPic.GetHeight() != outH))
+		ResamplePicture(outPic, outW, outH, tImage::tPicture::tFilter(options.ResampleFilter));
+
+	return SavePicture(outPic, outFile, options, opaque);
+}
+
+
+tPicture* Viewer::LoadContactFrame(Image& img, int frameWidth, int frameHeight, int filter, bool& opaque)
+{
+	// Images already loaded by the viewer are only read from. Anything else is loaded into a private Image so it is
+	// released as soon as we're done with it.
+	tPicture* frame = nullptr;
+	if (img.IsLoaded())
+	{
+		tPicture* currPic = img.GetCurrentPic();
+		if (currPic)
+			frame = new tPicture(*currPic);
+		opaque = img.IsOpaque();
+	}
+	else
+	{
+		Image loader(img.Filename);
+		loader.PartNum = img.PartNum;
+		loader.CopyEdits(img);
+		tPicture* currPic = loader.Load() ? loader.GetCurrentPic() : nullptr;
+		if (currPic)
+			frame = new tPicture(*currPic);
+		opaque = loader.IsOpaque();
+	}
+
+	if (!frame)
+		return nullptr;
+
+	if ((frame->GetWidth() != frameWidth) || (frame->GetHeight() != frameHeight))
+		ResamplePicture(*frame, frameWidth, frameHeight, tImage::tPicture::tFilter(filter));
+
+	return frame;
+}
+
+
+void Viewer::GetContactCell(int& x, int& y, int& w, int& h, int cell, int sheetWidth, int sheetHeight, int numCols, int numRows)
+{
+	int ix = cell % numCols;
+	int iy = cell / numCols;
+	x = (ix*sheetWidth) / numCols;
+	w = ((ix+1)*sheetWidth) / numCols - x;
+
+	// Cell rows are counted from the top but picture row 0 is the bottom.
+	int top = (iy*sheetHeight) / numRows;
+	int bottom = ((iy+1)*sheetHeight) / numRows;
+	y = sheetHeight - bottom;
+	h = bottom - top;
+}
+
+
+bool Viewer::SaveContactSheetTo
+(
+	tList<Image>& images, const tString& outFile,
+	int contactWidth, int contactHeight,
+	int numCols, int numRows,
+	int finalWidth, int finalHeight,
+	bool resampleSheet
+)
+{
+	// Normally the layout is done directly in final sheet coordinates so each frame is resampled exactly once, straight
+	// to the size of its cell. Cells may differ by a pixel when the final size isn't a multiple of the grid. If
+	// requested, the full contact-size sheet is built instead and resampled as a whole at the end.
+	int sheetWidth = resampleSheet ? contactWidth : finalWidth;
+	int sheetHeight = resampleSheet ? contactHeight : finalHeight;
+	tImage::tPicture outPic(sheetWidth, sheetHeight);
+	outPic.SetAll(tColouri(0, 0, 0, 0));
+	int numCells = numCols * numRows;
+	SaveOptions options;
+
+	// Frames are loaded and resampled on the pool, but placed in order here so a frame that fails to load doesn't
+	// leave a gap. Only a window of frames is in flight at once which keeps memory bounded no matter how many images
+	// there are. Each frame is freed as soon as it has been copied into the sheet.
+	struct ContactFrame
+	{
+		tPicture* Picture	= nullptr;
+		bool Opaque			= true;
+		bool Ready			= false;
+	};
+	std::vector<Image*> sources;
+	for (Image* img = images.First(); img; img = img->Next())
+		sources.push_back(img);
+	std::vector<ContactFrame> frames(sources.size());
+
+	std::mutex frameMutex;
+	std::condition_variable frameReady;
+	std::atomic<bool> sheetFull(false);
+	int numThreads = tMax(tSystem::tGetNumCores(), 1);
+	int window = 2*numThreads;
+	ThreadPool pool(numThreads);
+
+	// Frames are resampled to the cell they will land in if no earlier frame fails. If one does the placement below
+	// copes with the odd pixel of difference.
+	auto loadFrame = [&](int index)
+	{
+		int cellX, cellY, cellW, cellH;
+		GetContactCell(cellX, cellY, cellW, cellH, tMin(index, numCells-1), sheetWidth, sheetHeight, numCols, numRows);
+		bool opaque = true;
+		tPicture* picture = sheetFull ? nullptr : LoadContactFrame(*sources[index], tMax(cellW, 1), tMax(cellH, 1), options.ResampleFilter, opaque);
+		std::lock_guard<std::mutex> lock(frameMutex);
+		frames[index].Picture = picture;
+		frames[index].Opaque = opaque;
+		frames[index].Ready = true;
+		frameReady.notify_all();
+	};
+
+	bool allOpaque = true;
+	int numPlaced = 0;
+	int nextSubmit = 0;
+	for (int f = 0; (f < int(sources.size())) && (numPlaced < numCells); f++)
+	{
+		while ((nextSubmit < int(sources.size())) && (nextSubmit < f + window))
+		{
+			// Dds files need the GL context to decode, so they are loaded right here. Pending edits are swapped in here
+			// too since that releases textures, and workers then read the edited pixels.
+			int index = nextSubmit++;
+			Image* source = sources[index];
+			source->UpdateEdits(true);
+			if (!source->IsLoaded() && (source->Filetype == tSystem::tFileType::DDS))
+				loadFrame(index);
+			else
+				pool.Submit([&loadFrame, index]() { loadFrame(index); });
+		}
+
+		tPicture* picture = nullptr;
+		bool opaque = true;
+		{
+			std::unique_lock<std::mutex> lock(frameMutex);
+			frameReady.wait(lock, [&]() { return frames[f].Ready; });
+			picture = frames[f].Picture;
+			opaque = frames[f].Opaque;
+			frames[f].Picture = nullptr;
+		}
+		if (!picture)
+			continue;
+
+		int cellX, cellY, cellW, cellH;
+		GetContactCell(cellX, cellY, cellW, cellH, numPlaced, sheetWidth, sheetHeight, numCols, numRows);
+		tPrintf("Processing frame %d : %s at (%d, %d).\n", numPlaced, sources[f]->Filename.Chars(), numPlaced % numCols, numPlaced / numCols);
+
+		// Copy the frame into its cell a row at a time. The frame is normally exactly the cell size. If not, the edge
+		// pixels are repeated or the excess is dropped.
+		int srcW = picture->GetWidth();
+		int srcH = picture->GetHeight();
+		int copyW = tMin(srcW, cellW);
+		for (int y = 0; y < cellH; y++)
+		{
+			tPixel* dst = outPic.GetPixelPointer(cellX, cellY + y);
+			const tPixel* src = picture->GetPixelPointer(0, tMin(y, srcH-1));
+			tStd::tMemcpy(dst, src, copyW*sizeof(tPixel));
+			for (int x = copyW; x < cellW; x++)
+				dst[x] = src[srcW-1];
+		}
+
+		allOpaque = allOpaque && opaque;
+		delete picture;
+		numPlaced++;
+	}
+
+	// Frames past the last cell may still be queued. They notice the sheet is full and skip the work.
+	sheetFull = true;
+	pool.WaitIdle();
+	for (ContactFrame& frame : frames)
+		delete frame.Picture;
+
+	tImage::tPicture::tColourFormat colourFmt = allOpaque ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
+	tImage::tImageTGA::tFormat tgaFmt = allOpaque ? tImage::tImageTGA::tFormat::Bit24 : tImage::tImageTGA::tFormat::Bit32;
+	if ((finalWidth != sheetWidth) || (finalHeight != sheetHeight))
+		ResamplePicture(outPic, finalWidth, finalHeight, tImage::tPicture::tFilter(options.ResampleFilter));
+
+	bool success = false;
+	if (options.FileType == 0)
+		success = outPic.SaveTGA(outFile, tgaFmt, options.TargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
+	else
+		success = outPic.Save(outFile, colourFmt, options.JpegQuality);
+
+	if (success)
+		tPrintf("Saved contact sheet as %s\n", outFile.Chars());
+	else
+		tPrintf("Failed to save contact sheet %s\n", outFile.Chars());
+
+	return success;
+}
+
+
+void Viewer::LoadAtlasFrames(std::vector<AtlasFrame>& frames, Image& img, const AtlasOptions& options)
+{
+	// As with contact sheets, images the viewer has loaded are only read from.
+	Image loader(img.Filename);
+	Image* source = &img;
+	if (!img.IsLoaded())
+	{
+		loader.CopyEdits(img);
+		if (!loader.Load())
+			return;
+		source = &loader;
+	}
+
+	// Dds parts are mipmaps, not frames.
+	bool allParts = options.AllParts && (img.Filetype != tSystem::tFileType::DDS);
+	int part = 0;
+	for (tPicture* pic = source->GetPrimaryPic(); pic; pic = pic->Next(), part++)
+	{
+		if (!allParts && (part != img.PartNum))
+			continue;
+
+		AtlasFrame frame;
+		frame.Name = tSystem::tGetFileName(img.Filename);
+		frame.Part = part;
+		frame.SourceWidth = pic->GetWidth();
+		frame.SourceHeight = pic->GetHeight();
+		frame.Duration = img.PartDurationOverrideEnabled ? img.PartDurationOverride : pic->Duration;
+		frame.Picture = options.TrimTransparent ? TrimPicture(*pic, frame.TrimX, frame.TrimY) : new tPicture(*pic);
+		frame.Width = frame.Picture->GetWidth();
+		frame.Height = frame.Picture->GetHeight();
+		frames.push_back(frame);
+	}
+}
+
+
+tPicture* Viewer::TrimPicture(const tPicture& pic, int& trimX, int& trimY)
+{
+	int width = pic.GetWidth();
+	int height = pic.GetHeight();
+	int minX = width;
+	int minY = height;
+	int maxX = -1;
+	int maxY = -1;
+	for (int y = 0; y < height; y++)
+	{
+		const tPixel* row = pic.GetPixelPointer(0, y);
+		for (int x = 0; x < width; x++)
+		{
+			if (row[x].A == 0)
+				continue;
+			minX = tMin(minX, x);
+			maxX = tMax(maxX, x);
+			minY = tMin(minY, y);
+			maxY = y;
+		}
+	}
+
+	// A frame with nothing visible keeps a single transparent pixel so it still gets a rect in the manifest.
+	if (maxX < 0)
+	{
+		minX = maxX = 0;
+		minY = maxY = 0;
+	}
+
+	int trimW = maxX - minX + 1;
+	int trimH = maxY - minY + 1;
+	tPicture* trimmed = new tPicture(trimW, trimH);
+	for (int y = 0; y < trimH; y++)
+		tStd::tMemcpy(trimmed->GetPixelPointer(0, y), pic.GetPixelPointer(minX, minY + y), trimW*sizeof(tPixel));
+
+	// Picture row 0 is the bottom.
+	trimX = minX;
+	trimY = height - 1 - maxY;
+	return trimmed;
+}
+
+
+bool Viewer::PackAtlasFrames(std::vector<AtlasFrame>& frames, int& width, int& height, const AtlasOptions& options)
+{
+	// Padded sizes are rounded up to the alignment. Since the packer places rects against the atlas edges and each
+	// other, every position ends up aligned too.
+	int align = tMax(options.Alignment, 1);
+	std::vector<stbrp_rect> rects(frames.size());
+	int64 area = 0;
+	int maxW = 0;
+	int maxH = 0;
+	for (int f = 0; f < int(frames.size()); f++)
+	{
+		stbrp_rect& rect = rects[f];
+		tStd::tMemset(&rect, 0, sizeof(rect));
+		rect.id = f;
+		rect.w = ((frames[f].Width + 2*options.Padding + align - 1) / align) * align;
+		rect.h = ((frames[f].Height + 2*options.Padding + align - 1) / align) * align;
+		area += int64(rect.w) * int64(rect.h);
+		maxW = tMax(maxW, int(rect.w));
+		maxH = tMax(maxH, int(rect.h));
+	}
+
+	// Try power of 2 sizes from the smallest area up, most square first. Packing is quick so trying many is fine.
+	std::vector<std::pair<int, int>> sizes;
+	for (int w = 16; w <= options.MaxSize; w *= 2)
+		for (int h = 16; h <= options.MaxSize; h *= 2)
+			if ((w >= maxW) && (h >= maxH) && (int64(w)*int64(h) >= area))
+				sizes.push_back(std::make_pair(w, h));
+
+	std::sort
+	(
+		sizes.begin(), sizes.end(),
+		[](const std::pair<int, int>& a, const std::pair<int, int>& b)
+		{
+			int64 areaA = int64(a.first) * int64(a.second);
+			int64 areaB = int64(b.first) * int64(b.second);
+			if (areaA != areaB)
+				return areaA < areaB;
+			return tAbs(a.first - a.second) < tAbs(b.first - b.second);
+		}
+	);
+
+	std::vector<stbrp_node> nodes;
+	for (const std::pair<int, int>& size : sizes)
+	{
+		nodes.resize(size.first);
+		stbrp_context context;
+		stbrp_init_target(&context, size.first, size.second, nodes.data(), int(nodes.size()));
+		if (!stbrp_pack_rects(&context, rects.data(), int(rects.size())))
+			continue;
+
+		width = options.PowerOfTwo ? size.first : 0;
+		height = options.PowerOfTwo ? size.second : 0;
+		for (const stbrp_rect& rect : rects)
+		{
+			frames[rect.id].X = rect.x + options.Padding;
+			frames[rect.id].Y = rect.y + options.Padding;
+			if (!options.PowerOfTwo)
+			{
+				width = tMax(width, rect.x + rect.w);
+				height = tMax(height, rect.y + rect.h);
+			}
+		}
+		return true;
+	}
+
+	return false;
+}
+
+
+tString Viewer::EscapeJSON(const tString& str)
+{
+	// Control characters aren't allowed in JSON strings so they are written as unicode escapes.
+	tString escaped;
+	for (const char* c = str.Chars(); *c; c++)
+	{
+		if (uint8(*c) < 0x20)
+		{
+			char code[8];
+			std::snprintf(code, sizeof(code), "\\u%04X", uint8(*c));
+			escaped += code;
+			continue;
+		}
+
+		if ((*c == '"') || (*c == '\\'))
+			escaped += "\\";
+		char ch[2] = { *c, '\0' };
+		escaped += ch;
+	}
+	return escaped;
+}
+
+
+bool Viewer::WriteAtlasManifest(const tString& manifestFile, const tString& atlasFile, int width, int height, const std::vector<AtlasFrame>& frames)
+{
+	FILE* file = fopen(manifestFile.Chars(), "wb");
+	if (!file)
+	{
+		tPrintf("Failed to save atlas manifest %s\n", manifestFile.Chars());
+		return false;
+	}
+
+	// Rects are in pixels with a top-left origin. The uvs cover the same area, so v needs flipping for GL.
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"image\": \"%s\",\n", EscapeJSON(tSystem::tGetFileName(atlasFile)).Chars());
+	fprintf(file, "\t\"width\": %d,\n", width);
+	fprintf(file, "\t\"height\": %d,\n", height);
+	fprintf(file, "\t\"frames\":\n\t[\n");
+	for (int f = 0; f < int(frames.size()); f++)
+	{
+		const AtlasFrame& frame = frames[f];
+		fprintf
+		(
+			file,
+			"\t\t{ \"name\": \"%s\", \"part\": %d, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, "
+			"\"u0\": %.6f, \"v0\": %.6f, \"u1\": %.6f, \"v1\": %.6f, "
+			"\"trimX\": %d, \"trimY\": %d, \"sourceW\": %d, \"sourceH\": %d, \"duration\": %.4f }%s\n",
+			EscapeJSON(frame.Name).Chars(), frame.Part, frame.X, frame.Y, frame.Width, frame.Height,
+			float(frame.X) / float(width), float(frame.Y) / float(height),
+			float(frame.X + frame.Width) / float(width), float(frame.Y + frame.Height) / float(height),
+			frame.TrimX, frame.TrimY, frame.SourceWidth, frame.SourceHeight, frame.Duration,
+			(f < int(frames.size())-1) ? "," : ""
+		);
+	}
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+
+	tPrintf("Saved atlas manifest as %s\n", manifestFile.Chars());
+	return true;
+}
+
+
+bool Viewer::SaveAtlasTo(tList<Image>& images, const tString& outFile, const AtlasOptions& options)
+{
+	// Every frame size is needed before packing can start, so all frames are loaded up front. Once trimmed they take
+	// no more memory than the atlas itself.
+	std::vector<Image*> sources;
+	for (Image* img = images.First(); img; img = img->Next())
+		sources.push_back(img);
+
+	std::vector<std::vector<AtlasFrame>> sourceFrames(sources.size());
+	{
+		ThreadPool pool(tMax(tSystem::tGetNumCores(), 1));
+		for (int s = 0; s < int(sources.size()); s++)
+		{
+			// Dds files need the GL context to decode, so they are loaded right here. Pending edits are swapped in here
+			// too, as for contact sheets.
+			Image* source = sources[s];
+			source->UpdateEdits(true);
+			if (!source->IsLoaded() && (source->Filetype == tSystem::tFileType::DDS))
+				LoadAtlasFrames(sourceFrames[s], *source, options);
+			else
+				pool.Submit([&sourceFrames, &options, source, s]() { LoadAtlasFrames(sourceFrames[s], *source, options); });
+		}
+		pool.WaitIdle();
+	}
+
+	std::vector<AtlasFrame> frames;
+	for (std::vector<AtlasFrame>& loaded : sourceFrames)
+		frames.insert(frames.end(), loaded.begin(), loaded.end());
+	if (frames.empty())
+	{
+		tPrintf("Failed to save atlas %s. No images loaded.\n", outFile.Chars());
+		return false;
+	}
+
+	int width = 0;
+	int height = 0;
+	if (!PackAtlasFrames(frames, width, height, options))
+	{
+		tPrintf("Failed to save atlas %s. Frames don't fit in %d x %d.\n", outFile.Chars(), options.MaxSize, options.MaxSize);
+		for (AtlasFrame& frame : frames)
+			delete frame.Picture;
+		return false;
+	}
+
+	tImage::tPicture atlas(width, height);
+	atlas.SetAll(tColouri(0, 0, 0, 0));
+	int pad = options.Padding;
+	for (AtlasFrame& frame : frames)
+	{
+		// Copy a row at a time. Rows and columns in the padding repeat the nearest edge pixel so filtering and mipmaps
+		// don't pull in neighbouring frames.
+		tPicture* picture = frame.Picture;
+		int bottom = height - (frame.Y + frame.Height);
+		for (int y = -pad; y < frame.Height + pad; y++)
+		{
+			const tPixel* src = picture->GetPixelPointer(0, tClamp(y, 0, frame.Height-1));
+			tPixel* dst = atlas.GetPixelPointer(frame.X, bottom + y);
+			tStd::tMemcpy(dst, src, frame.Width*sizeof(tPixel));
+			for (int x = 1; x <= pad; x++)
+			{
+				dst[-x] = src[0];
+				dst[frame.Width-1+x] = src[frame.Width-1];
+			}
+		}
+
+		delete picture;
+		frame.Picture = nullptr;
+	}
+
+	tPrintf("Packed %d frames into a %d x %d atlas.\n", int(frames.size()), width, height);
+	SaveOptions saveOptions;
+	bool success = SavePicture(atlas, outFile, saveOptions, atlas.IsOpaque());
+	if (success && options.WriteManifest)
+	{
+		tString manifestFile = tSystem::tGetDir(outFile) + tSystem::tGetFileBaseName(outFile) + ".json";
+		success = WriteAtlasManifest(manifestFile, outFile, width, height, frames);
+	}
+
+	return success;
+}
+
+
+Viewer::BatchSaver::~BatchSaver()
+{
+	Cancel();
+	Pool.WaitIdle();
+	for (Job& job : Jobs)
+	{
+		delete job.Picture;
+		delete job.Loader;
+	}
+}
+
+
+void Viewer::BatchSaver::Start(std::vector<Job>& jobs, int width, int height, float scale, Settings::SizeMode sizeMode)
+{
+	tAssert(Jobs.empty());
+	Jobs.swap(jobs);
+	Options = SaveOptions();
+	Width = width;
+	Height = height;
+	Scale = scale;
+	SizeMode = sizeMode;
+	SavedFiles.reserve(Jobs.size());
+}
+
+
+bool Viewer::BatchSaver::Update()
+{
+	// One image is always allowed in flight, even if it alone is over the memory limit.
+	while
+	(
+		!Cancelled && (NextJob < int(Jobs.size())) && (NumInFlight < MaxInFlight) &&
+		((NumInFlight == 0) || (InFlightBytes < MaxInFlightBytes))
+	)
+	{
+		Item* item = new Item;
+		item->SrcJob = &Jobs[NextJob++];
+		NumInFlight++;
+
+		// Dds files need a GL context to decode. Do at most one per update so the UI stays responsive.
+		Job& job = *item->SrcJob;
+		if (!job.Picture && (tSystem::tGetFileType(job.SrcFile) == tSystem::tFileType::DDS))
+		{
+			Decode(item);
+			break;
+		}
+
+		Pool.Submit([this, item]() { Decode(item); });
+	}
+
+	return (!Cancelled && (NextJob < int(Jobs.size()))) || (NumInFlight > 0);
+}
+
+
+void Viewer::BatchSaver::SetItemBytes(Item* item)
+{
+	int64 bytes = item->Picture ? int64(item->Picture->GetWidth()) * int64(item->Picture->GetHeight()) * int64(sizeof(tPixel)) : 0;
+	InFlightBytes += bytes - item->Bytes;
+	item->Bytes = bytes;
+}
+
+
+void Viewer::BatchSaver::Decode(Item* item)
+{
+	if (Cancelled)
+	{
+		Finish(item, false);
+		return;
+	}
+
+	Job& job = *item->SrcJob;
+	if (job.Picture)
+	{
+		item->Picture = job.Picture;
+		item->Opaque = job.Opaque;
+		job.Picture = nullptr;
+	}
+	else
+	{
+		// A private Image is used so the viewer's image list is never touched from here.
+		Image* image = job.Loader ? job.Loader : new Image(job.SrcFile);
+		job.Loader = nullptr;
+		image->PartNum = job.PartNum;
+		image->Load();
+		tPicture* currPic = image->GetCurrentPic();
+		if (currPic)
+		{
+			item->Picture = new tPicture();
+			item->Picture->Set(*currPic);
+			item->Opaque = image->IsOpaque();
+		}
+		delete image;
+	}
+
+	if (!item->Picture)
+	{
+		Finish(item, false);
+		return;
+	}
+
+	SetItemBytes(item);
+	Pool.Submit([this, item]() { Resample(item); });
+}
+
+
+void Viewer::BatchSaver::Resample(Item* item)
+{
+	if (Cancelled)
+	{
+		Finish(item, false);
+		return;
+	}
+
+	tPicture* picture = item->Picture;
+	int outW, outH;
+	GetSaveSize(outW, outH, picture->GetWidth(), picture->GetHeight(), Width, Height, Scale, SizeMode);
+	if ((picture->GetWidth() != outW) || (picture->GetHeight() != outH))
+	{
+		ResamplePicture(*picture, outW, outH, tImage::tPicture::tFilter(Options.ResampleFilter));
+		SetItemBytes(item);
+	}
+
+	Pool.Submit([this, item]() { Encode(item); });
+}
+
+
+void Viewer::BatchSaver::Encode(Item* item)
+{
+	if (Cancelled)
+	{
+		Finish(item, false);
+		return;
+	}
+
+	bool saved = SavePicture(*item->Picture, item->SrcJob->OutFile, Options, item->Opaque);
+	Finish(item, saved);
+}
+
+
+void Viewer::BatchSaver::Finish(Item* item, bool saved)
+{
+	if (saved)
+	{
+		std::lock_guard<std::mutex> lock(SavedFilesMutex);
+		SavedFiles.push_back(item->SrcJob->OutFile);
+	}
+	else if (!Cancelled)
+	{
+		NumFailed++;
+	}
+
+	InFlightBytes -= item->Bytes;
+	delete item->Picture;
+	delete item;
+	NumDone++;
+	NumInFlight--;
+}
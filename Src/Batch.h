@@ -0,0 +1,172 @@
+// Batch.h
+//
+// Image saving, contact sheet and atlas generation. Nothing in here touches the UI or the viewer's image list so it may be
+// used by the viewer dialogs as well as by tools that run without a window.
+//
+// Copyright (c) 2019, 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <Foundation/tList.h>
+#include <Foundation/tString.h>
+#include <Image/tPicture.h>
+#include "Settings.h"
+#include "ThreadPool.h"
+class Image;
+
+
+namespace Viewer
+{
+	// Appends all files in dir that have an extension the viewer can load. Does not recurse into sub-folders.
+	void FindImageFiles(tList<tStringItem>& foundFiles, const tString& dir);
+
+	// Returns the extension, including the dot, for a Config.SaveFileType value.
+	tString GetSaveFileTypeExtension(int saveFileType);
+
+	// The output format and resample options. A copy is taken when a save starts so changes made in the UI while it runs
+	// don't affect it.
+	struct SaveOptions
+	{
+		SaveOptions();					// Copies the current values from Config.
+		int FileType;
+		bool TargaRLE;
+		int JpegQuality;
+		int ResampleFilter;
+	};
+
+	// Computes the output dimensions for a size mode. Both are clamped to a minimum of 4.
+	void GetSaveSize(int& outW, int& outH, int srcW, int srcH, int width, int height, float scale, Settings::SizeMode);
+
+	// Writes the picture in the format given by the options. Opaque pictures are saved without alpha where the format
+	// allows. Pass what the image's load-time analysis says so the pixels don't need to be scanned again. Returns
+	// success.
+	bool SavePicture(tImage::tPicture&, const tString& outFile, const SaveOptions&, bool opaque);
+
+	// This function saves the picture to the filename specified. The resample filter and output format options are
+	// taken from Config. The loaded state of the image is left unchanged.
+	bool SaveImageAs(Image&, const tString& outFile, int width, int height, float scale = 1.0f, Settings::SizeMode = Settings::SizeMode::SetWidthAndHeight);
+
+	// Lays the images out left-to-right, top-to-bottom in a numCols x numRows grid of frames. Images that fail to load
+	// are skipped. Frames are loaded and resampled in parallel and only a few are held in memory at once. Images not
+	// already loaded are left unloaded. Each frame is resampled once, directly to its cell in the final sheet, unless
+	// resampleSheet is true. In that case a contactWidth x contactHeight sheet is built and the whole thing is then
+	// resampled to the final size. Returns success.
+	bool SaveContactSheetTo
+	(
+		tList<Image>& images, const tString& outFile,
+		int contactWidth, int contactHeight,
+		int numCols, int numRows,
+		int finalWidth, int finalHeight,
+		bool resampleSheet = false
+	);
+
+	// Options for packing frames tightly into an atlas rather than a fixed grid.
+	struct AtlasOptions
+	{
+		int MaxSize						= 4096;		// Maximum atlas width and height.
+		int Padding						= 2;		// Frame edge pixels are extended this far so mipmaps don't bleed.
+		int Alignment					= 4;		// Frame rects are placed on multiples of this. 4 suits block compression.
+		bool TrimTransparent			= true;		// Fully transparent borders are removed before packing.
+		bool PowerOfTwo					= false;	// Otherwise the atlas is cropped to the packed area.
+		bool AllParts					= true;		// Every part of animated images becomes a frame, not only the current one.
+		bool WriteManifest				= true;		// Writes a json file with the same base name as the atlas.
+	};
+
+	// Packs the images, at their original size, into the smallest atlas that fits. The manifest has the rect of each
+	// frame in atlas pixels (top-left origin) and uv space, where it was trimmed from in the source, and its duration.
+	// Images that fail to load are skipped. Returns false if nothing loaded or the frames don't fit.
+	bool SaveAtlasTo(tList<Image>& images, const tString& outFile, const AtlasOptions&);
+
+	// Saves many images at once. Each image goes through decode, resample, and encode stages that run as separate tasks
+	// on a thread pool, so while one image is being encoded others are being decoded. The number of images in flight
+	// and the memory their pictures use are both bounded. Nothing here touches the viewer's image list, so the caller
+	// applies the results once everything is finished.
+	class BatchSaver
+	{
+	public:
+		struct Job
+		{
+			tString SrcFile;
+			tString OutFile;
+			int PartNum						= 0;
+
+			// Optional. If set it is saved instead of loading SrcFile, for example when the image has unsaved edits.
+			// The saver takes ownership.
+			tImage::tPicture* Picture		= nullptr;
+			bool Opaque						= true;		// Of the Picture, if set.
+
+			// Optional. If set, and Picture isn't, this unloaded Image is loaded instead of SrcFile. It carries the load
+			// params and edits of the viewer's image. The saver takes ownership.
+			Image* Loader					= nullptr;
+		};
+
+		BatchSaver(int numThreads, int maxInFlightMB)																	: Pool(numThreads), MaxInFlight(2*numThreads), MaxInFlightBytes(int64(maxInFlightMB)*1024*1024) { }
+
+		// Cancels and waits for in-flight images to finish.
+		~BatchSaver();
+
+		// Takes the jobs and returns immediately. Call Update until it returns false.
+		void Start(std::vector<Job>& jobs, int width, int height, float scale, Settings::SizeMode);
+
+		// Hands more images to the pool as room becomes available. Must be called from the thread that called Start.
+		// Returns true while there is still work to do. Dds files are decoded here since decoding them requires GL.
+		bool Update();
+
+		// Images not yet started are skipped. Those in flight are finished. Keep calling Update until it returns false.
+		void Cancel()																									{ Cancelled = true; }
+		bool IsCancelled() const																						{ return Cancelled; }
+
+		int GetNumJobs() const																							{ return int(Jobs.size()); }
+		int GetNumDone() const																							{ return NumDone; }
+		int GetNumFailed() const																						{ return NumFailed; }
+
+		// The output files that were written. Only call once Update has returned false.
+		const std::vector<tString>& GetSavedFiles() const																{ return SavedFiles; }
+
+	private:
+		struct Item
+		{
+			Job* SrcJob;
+			tImage::tPicture* Picture		= nullptr;
+			bool Opaque						= true;
+			int64 Bytes						= 0;
+		};
+
+		void Decode(Item*);
+		void Resample(Item*);
+		void Encode(Item*);
+		void Finish(Item*, bool saved);
+		void SetItemBytes(Item*);
+
+		ThreadPool Pool;
+		int MaxInFlight;
+		int64 MaxInFlightBytes;
+
+		std::vector<Job> Jobs;
+		SaveOptions Options;
+		int Width						= 0;
+		int Height						= 0;
+		float Scale						= 1.0f;
+		Settings::SizeMode SizeMode		= Settings::SizeMode::Percent;
+		int NextJob						= 0;
+
+		std::atomic<bool> Cancelled		{ false };
+		std::atomic<int> NumInFlight	{ 0 };
+		std::atomic<int64> InFlightBytes{ 0 };
+		std::atomic<int> NumDone		{ 0 };
+		std::atomic<int> NumFailed		{ 0 };
+
+		std::mutex SavedFilesMutex;
+		std::vector<tString> SavedFiles;
+	};
+}
@@ -0,0 +1,515 @@
+// Benchmark.cpp
+//
+// Windowless benchmark harness. Measures image loading per format, thumbnail generation (both generating and writing
+// the cache file, and reading it back), contact sheet generation, and resampling with every filter. No window or GL
+// context is created, so dds files are skipped, but GLFW and glad are still linked. A summary is printed and the
+// results are written as JSON so runs may be compared by scripts.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <vector>
+#include <deque>
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include <System/tCommand.h>
+#include <System/tFile.h>
+#include <Math/tFundamentals.h>
+#include "Image.h"
+#include "Batch.h"
+#include "Profile.h"
+#include "Resample.h"
+#include "Sequence.h"
+#include "Version.cmake.h"
+using namespace tStd;
+using namespace tSystem;
+using namespace tImage;
+using namespace tMath;
+using namespace Viewer;
+
+
+namespace Bench
+{
+	tCommand::tParam ParamTestDir(1, "TestImagesDir", "Folder containing FormatVariety, Photos and Flipbook. Defaults to TestImages in the current folder.");
+	tCommand::tOption OptionOutput("JSON results file. Defaults to BenchResults.json in the current folder.", 'o', "output", 1);
+	tCommand::tOption OptionRepeat("Number of times each measurement is repeated. Defaults to 3.", 'r', "repeat", 1);
+
+	struct Result
+	{
+		tString Name;
+		int NumImages		= 0;			// Total over all repeats.
+		double Seconds		= 0.0;			// Total over all repeats.
+		uint64 Bytes		= 0;			// Source file bytes, or pixel bytes for resamples.
+		double PeakRSSMB	= 0.0;			// Process peak so far, sampled when the measurement finished.
+	};
+	std::deque<Result> Results;				// A deque so references from GetResult stay valid as results are added.
+
+	// Matches tImage::tPicture::tFilter.
+	const char* FilterNames[] = { "NearestNeighbour", "Box", "Bilinear", "Bicubic", "Quadratic", "Hamming" };
+
+	// The mean difference per channel allowed between ResamplePicture and tPicture::Resample. Edge handling and the
+	// halving done for large reductions mean they are close but not identical.
+	const double ResampleMeanTolerance = 2.0;
+	bool ResampleToleranceFailed = false;
+
+	double GetPeakRSSMB();
+	Result& GetResult(const tString& name);
+	void FinishResult(Result&);
+
+	// Loading a dds file uses GL to decode it into pictures. There is no context so they can't be measured.
+	void SkipDDSFiles(tList<tStringItem>& files);
+
+	void BenchLoad(const tString& dir, int repeat);
+	void BenchThumbnails(const tString& dir, const tString& label, int repeat);
+	void BenchContactSheet(const tString& dir, const tString& workDir, int repeat);
+
+	// Plays the folder as an image sequence showing every frame, with the frame rate set high enough that decoding is
+	// the limit. The frames shown per second is how fast a sequence could be reviewed.
+	void BenchSequence(const tString& dir, int repeat);
+	void BenchResample(const tString& dir, const tString& workDir, int repeat);
+
+	// Times ResamplePicture against tPicture::Resample for every filter and checks the results agree.
+	void BenchResampleFilters(const tString& dir, int repeat);
+
+	void PrintResults();
+	bool WriteResults(const tString& filename, int repeat);
+}
+
+
+double Bench::GetPeakRSSMB()
+{
+	#ifdef PLATFORM_WINDOWS
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0.0;
+	return double(counters.PeakWorkingSetSize) / (1024.0*1024.0);
+
+	#else
+	// On Linux ru_maxrss is in kilobytes.
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return double(usage.ru_maxrss) / 1024.0;
+	#endif
+}
+
+
+Bench::Result& Bench::GetResult(const tString& name)
+{
+	for (Result& result : Results)
+		if (result.Name == name)
+			return result;
+
+	Result result;
+	result.Name = name;
+	Results.push_back(result);
+	return Results.back();
+}
+
+
+void Bench::FinishResult(Result& result)
+{
+	result.PeakRSSMB = GetPeakRSSMB();
+}
+
+
+void Bench::SkipDDSFiles(tList<tStringItem>& files)
+{
+	for (tStringItem* file = files.First(); file;)
+	{
+		tStringItem* next = file->Next();
+		if (tGetFileType(*file) == tFileType::DDS)
+			delete files.Remove(file);
+		file = next;
+	}
+}
+
+
+void Bench::BenchLoad(const tString& dir, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+	SkipDDSFiles(files);
+	tPrintf("Load: %d files in %s\n", files.Count(), dir.Chars());
+
+	// Results are per file type.
+	for (int r = 0; r < repeat; r++)
+	{
+		for (tStringItem* file = files.First(); file; file = file->Next())
+		{
+			Image image(*file);
+			double startTime = ProfileGetTime();
+			bool loaded = image.Load();
+			double endTime = ProfileGetTime();
+			if (!loaded)
+				continue;
+
+			tString ext = tGetFileExtension(*file);
+			ext.ToLower();
+			Result& result = GetResult(tString("load_") + ext);
+			result.NumImages++;
+			result.Seconds += endTime - startTime;
+			result.Bytes += image.FileSizeB;
+			FinishResult(result);
+
+			// Revisiting an image that was evicted to the compressed tier only decompresses it. Bytes are pixel bytes.
+			int pixelBytes = image.Info.MemSizeBytes;
+			if (!image.UnloadCompressed())
+				continue;
+
+			startTime = ProfileGetTime();
+			bool reloaded = image.Load();
+			endTime = ProfileGetTime();
+			if (!reloaded)
+				continue;
+
+			Result& reload = GetResult("reload_compressed");
+			reload.NumImages++;
+			reload.Seconds += endTime - startTime;
+			reload.Bytes += pixelBytes;
+			FinishResult(reload);
+		}
+	}
+}
+
+
+void Bench::BenchThumbnails(const tString& dir, const tString& label, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+
+	SkipDDSFiles(files);
+	tPrintf("Thumbnails: %d files in %s\n", files.Count(), dir.Chars());
+
+	// The first pass starts with an empty cache so every thumbnail is generated and written. The remaining passes
+	// read them back from the cache. A fresh Image is used each time so nothing is kept in memory between passes.
+	for (int pass = 0; pass < repeat+1; pass++)
+	{
+		Result& result = GetResult(tString((pass == 0) ? "thumbnail_generate_" : "thumbnail_cache_read_") + label);
+		for (tStringItem* file = files.First(); file; file = file->Next())
+		{
+			Image image(*file);
+			double startTime = ProfileGetTime();
+			bool generated = image.GenerateThumbnailNow();
+			double endTime = ProfileGetTime();
+			if (!generated)
+				continue;
+
+			result.NumImages++;
+			result.Seconds += endTime - startTime;
+			result.Bytes += image.FileSizeB;
+		}
+		FinishResult(result);
+	}
+}
+
+
+void Bench::BenchContactSheet(const tString& dir, const tString& workDir, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+	tList<Image> frames;
+	uint64 totalBytes = 0;
+	for (tStringItem* file = files.First(); file; file = file->Next())
+	{
+		Image* image = new Image(*file);
+		totalBytes += image->FileSizeB;
+		frames.Append(image);
+	}
+	tPrintf("Contact Sheet: %d frames in %s\n", frames.Count(), dir.Chars());
+	if (frames.Count() < 2)
+		return;
+
+	// Frame size comes from the first frame, just like the contact sheet dialog.
+	Image* first = frames.First();
+	if (!first->Load())
+		return;
+	int frameWidth = first->GetWidth();
+	int frameHeight = first->GetHeight();
+	first->Unload();
+
+	int numCols = int(tCeiling(tSqrt(float(frames.Count()))));
+	int numRows = numCols;
+	int contactWidth = frameWidth * numCols;
+	int contactHeight = frameHeight * numRows;
+	tString outFile = workDir + "ContactSheet.tga";
+
+	Result& result = GetResult("contact_sheet");
+	for (int r = 0; r < repeat; r++)
+	{
+		// Unload so every repeat includes loading the frames.
+		for (Image* image = frames.First(); image; image = image->Next())
+			image->Unload(true);
+
+		double startTime = ProfileGetTime();
+		bool saved = SaveContactSheetTo(frames, outFile, contactWidth, contactHeight, numCols, numRows, contactWidth, contactHeight);
+		double endTime = ProfileGetTime();
+		if (!saved)
+			continue;
+
+		result.NumImages += frames.Count();
+		result.Seconds += endTime - startTime;
+		result.Bytes += totalBytes;
+	}
+	FinishResult(result);
+}
+
+
+void Bench::BenchSequence(const tString& dir, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+	SkipDDSFiles(files);
+
+	tList<Image> images;
+	uint64 totalBytes = 0;
+	for (tStringItem* file = files.First(); file; file = file->Next())
+	{
+		Image* image = new Image(*file);
+		totalBytes += image->FileSizeB;
+		images.Append(image);
+	}
+
+	std::vector<Image*> frames;
+	if (FindImageSequence(frames, images, images.First()) < 0)
+		return;
+	tPrintf("Sequence: %d frames in %s\n", int(frames.size()), dir.Chars());
+
+	const float fps = 1000.0f;
+	const int cacheMB = 256;
+	Result& result = GetResult("sequence");
+	SequencePlayer player(tMax(int(std::thread::hardware_concurrency()) - 1, 1));
+	for (int r = 0; r < repeat; r++)
+	{
+		// The frame that was showing when the last repeat finished stays loaded.
+		for (Image* image : frames)
+			image->Unload(true);
+
+		double startTime = ProfileGetTime();
+		player.Start(frames, 0, fps, false, false, cacheMB);
+		double lastTime = startTime;
+		while (player.IsPlaying())
+		{
+			double time = ProfileGetTime();
+			player.Update(time - lastTime);
+			lastTime = time;
+		}
+		double endTime = ProfileGetTime();
+
+		result.NumImages += int(frames.size());
+		result.Seconds += endTime - startTime;
+		result.Bytes += totalBytes;
+	}
+	FinishResult(result);
+}
+
+
+void Bench::BenchResample(const tString& dir, const tString& workDir, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+	if (files.Count() == 0)
+		return;
+
+	// The image stays loaded so only the resample and save are measured. Halving both dimensions keeps the save
+	// cheap compared to the resample.
+	Image image(*files.First());
+	if (!image.Load())
+		return;
+	int srcW = image.GetWidth();
+	int srcH = image.GetHeight();
+	tPrintf("Resample: %s (%d x %d)\n", files.First()->Chars(), srcW, srcH);
+
+	tString outFile = workDir + "Resample.tga";
+	for (int filter = 0; filter < tNumElements(FilterNames); filter++)
+	{
+		Config.ResampleFilter = filter;
+		Result& result = GetResult(tString("save_as_") + FilterNames[filter]);
+		for (int r = 0; r < repeat; r++)
+		{
+			double startTime = ProfileGetTime();
+			bool saved = SaveImageAs(image, outFile, srcW/2, srcH/2);
+			double endTime = ProfileGetTime();
+			if (!saved)
+				continue;
+
+			result.NumImages++;
+			result.Seconds += endTime - startTime;
+			result.Bytes += uint64(srcW*srcH) * sizeof(tPixel);
+		}
+		FinishResult(result);
+	}
+}
+
+
+void Bench::BenchResampleFilters(const tString& dir, int repeat)
+{
+	tList<tStringItem> files;
+	FindImageFiles(files, dir);
+	SkipDDSFiles(files);
+	if (files.Count() == 0)
+		return;
+
+	Image image(*files.First());
+	if (!image.Load())
+		return;
+	const tPicture* srcPic = image.GetCurrentPic();
+	if (!srcPic)
+		return;
+	int srcW = srcPic->GetWidth();
+	int srcH = srcPic->GetHeight();
+	tPrintf("Resample Filters: %s (%d x %d)\n", files.First()->Chars(), srcW, srcH);
+
+	// A small reduction, a large one that goes through the halving path, and an enlargement.
+	struct Size { const char* Label; int Width; int Height; };
+	Size sizes[] =
+	{
+		{ "half",		tMax(srcW/2, 1),	tMax(srcH/2, 1) },
+		{ "eighth",		tMax(srcW/8, 1),	tMax(srcH/8, 1) },
+		{ "double",		srcW*2,				srcH*2 }
+	};
+
+	for (int filter = 0; filter < tNumElements(FilterNames); filter++)
+	{
+		for (const Size& size : sizes)
+		{
+			tString label = tString(FilterNames[filter]) + "_" + size.Label;
+			Result& reference = GetResult(tString("resample_picture_") + label);
+			Result& fast = GetResult(tString("resample_fast_") + label);
+			tPicture referencePic;
+			tPicture fastPic;
+			for (int r = 0; r < repeat; r++)
+			{
+				referencePic.Set(*srcPic);
+				double startTime = ProfileGetTime();
+				referencePic.Resample(size.Width, size.Height, tPicture::tFilter(filter));
+				double endTime = ProfileGetTime();
+				reference.NumImages++;
+				reference.Seconds += endTime - startTime;
+				reference.Bytes += uint64(srcW*srcH) * sizeof(tPixel);
+
+				fastPic.Set(*srcPic);
+				startTime = ProfileGetTime();
+				ResamplePicture(fastPic, size.Width, size.Height, tPicture::tFilter(filter));
+				endTime = ProfileGetTime();
+				fast.NumImages++;
+				fast.Seconds += endTime - startTime;
+				fast.Bytes += uint64(srcW*srcH) * sizeof(tPixel);
+			}
+			FinishResult(reference);
+			FinishResult(fast);
+
+			const uint8* a = (const uint8*)referencePic.GetPixelPointer();
+			const uint8* b = (const uint8*)fastPic.GetPixelPointer();
+			int numChannels = size.Width * size.Height * 4;
+			int maxError = 0;
+			double totalError = 0.0;
+			for (int c = 0; c < numChannels; c++)
+			{
+				int error = tAbs(int(a[c]) - int(b[c]));
+				maxError = tMax(maxError, error);
+				totalError += double(error);
+			}
+			double meanError = totalError / double(numChannels);
+			bool passed = (meanError <= ResampleMeanTolerance);
+			if (!passed)
+				ResampleToleranceFailed = true;
+			tPrintf("Resample %-24s mean error %6.3f max error %3d %s\n", label.Chars(), meanError, maxError, passed ? "" : "FAILED");
+		}
+	}
+}
+
+
+void Bench::PrintResults()
+{
+	tPrintf("\n%-32s %8s %12s %12s %12s\n", "Measurement", "Images", "ms/Image", "MB/s", "PeakRSS MB");
+	for (const Result& result : Results)
+	{
+		double msPerImage = result.NumImages ? (result.Seconds * 1000.0) / double(result.NumImages) : 0.0;
+		double mbPerSec = (result.Seconds > 0.0) ? (double(result.Bytes) / (1024.0*1024.0)) / result.Seconds : 0.0;
+		tPrintf("%-32s %8d %12.3f %12.2f %12.1f\n", result.Name.Chars(), result.NumImages, msPerImage, mbPerSec, result.PeakRSSMB);
+	}
+}
+
+
+bool Bench::WriteResults(const tString& filename, int repeat)
+{
+	FILE* file = fopen(filename.Chars(), "wb");
+	if (!file)
+		return false;
+
+	fprintf(file, "{\n");
+	fprintf(file, "\"version\":\"%d.%d.%d\",\n", ViewerVersion::Major, ViewerVersion::Minor, ViewerVersion::Revision);
+	fprintf(file, "\"repeat\":%d,\n", repeat);
+	fprintf(file, "\"peak_rss_mb\":%.1f,\n", GetPeakRSSMB());
+	fprintf(file, "\"results\":[\n");
+	for (int r = 0; r < int(Results.size()); r++)
+	{
+		const Result& result = Results[r];
+		double msPerImage = result.NumImages ? (result.Seconds * 1000.0) / double(result.NumImages) : 0.0;
+		double mbPerSec = (result.Seconds > 0.0) ? (double(result.Bytes) / (1024.0*1024.0)) / result.Seconds : 0.0;
+		fprintf
+		(
+			file, "{\"name\":\"%s\",\"images\":%d,\"total_ms\":%.3f,\"ms_per_image\":%.3f,\"mb_per_sec\":%.3f,\"peak_rss_mb\":%.1f}%s\n",
+			result.Name.Chars(), result.NumImages, result.Seconds * 1000.0, msPerImage, mbPerSec, result.PeakRSSMB,
+			(r < int(Results.size())-1) ? "," : ""
+		);
+	}
+	fprintf(file, "]\n}\n");
+	fclose(file);
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	tCommand::tParse(argc, argv);
+
+	tString testDir = Bench::ParamTestDir.IsPresent() ? Bench::ParamTestDir.Get() : tGetCurrentDir() + "TestImages";
+	testDir = tGetSimplifiedPath(testDir + "/");
+	int repeat = Bench::OptionRepeat.IsPresent() ? Bench::OptionRepeat.Arg1().GetAsInt() : 3;
+	tiClampMin(repeat, 1);
+	tString outFile = Bench::OptionOutput.IsPresent() ? Bench::OptionOutput.Arg1() : tGetCurrentDir() + "BenchResults.json";
+
+	// Everything the benchmark writes, including the thumbnail cache, goes into a scratch folder that starts empty.
+	tString workDir = tGetCurrentDir() + "BenchWork/";
+	if (tDirExists(workDir))
+		tDeleteDir(workDir);
+	tCreateDir(workDir);
+	Image::ThumbCacheDir = workDir + "Cache/";
+	tCreateDir(Image::ThumbCacheDir);
+
+	// Fixed save settings so runs are comparable regardless of defaults. Saves are uncompressed tga.
+	Config.ResetBehaviourSettings();
+	Config.SaveFileType = 0;
+	Config.SaveFileTargaRLE = false;
+
+	Bench::BenchLoad(testDir + "FormatVariety/", repeat);
+	Bench::BenchThumbnails(testDir + "FormatVariety/", "formats", repeat);
+	Bench::BenchThumbnails(testDir + "Photos/", "photos", repeat);
+	Bench::BenchContactSheet(testDir + "Flipbook/", workDir, repeat);
+	Bench::BenchSequence(testDir + "Flipbook/", repeat);
+	Bench::BenchResample(testDir + "Photos/", workDir, repeat);
+	Bench::BenchResampleFilters(testDir + "Photos/", repeat);
+
+	Bench::PrintResults();
+	bool written = Bench::WriteResults(outFile, repeat);
+	tPrintf("%s %s\n", written ? "Results written to" : "Failed to write results to", outFile.Chars());
+
+	tDeleteDir(workDir);
+	if (Bench::ResampleToleranceFailed)
+		tPrintf("Resample results are outside the tolerance of %.1f.\n", Bench::ResampleMeanTolerance);
+	return (written && !Bench::ResampleToleranceFailed) ? 0 : 1;
+}
@@ -0,0 +1,375 @@
+// BlockCompress.cpp
+//
+// A small BC1 and BC3 (DXT1 and DXT5) encoder for thumbnails. The blocks can be handed straight to the GPU. It aims
+// for good quality on small images rather than raw speed.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <Math/tFundamentals.h>
+#include "BlockCompress.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	// The 16 pixels of a block, RGBA.
+	typedef uint8 BlockPixels[16][4];
+	void LoadBlock(BlockPixels& block, const uint8* rgba, int width, int bx, int by);
+
+	// Colours are 565. The end points are expanded by bit replication, just as the GPU does.
+	uint16 PackColour(const float rgb[3]);
+	void UnpackColour(uint16 colour, int rgb[3]);
+	int ColourError(const int a[3], const uint8* b);
+
+	// Chooses end points along the principal axis of the used pixels and then refines them once by least squares.
+	// With punchThrough set, pixels with alpha below 128 are transparent and only the end points are used for the rest.
+	void EncodeColourBlock(uint8* dst, const BlockPixels& block, bool punchThrough);
+	int FitColourIndices(uint32& indices, uint16 c0, uint16 c1, const BlockPixels& block, const bool* used, bool endPointsOnly);
+	void EncodeAlphaBlock(uint8* dst, const BlockPixels& block);
+}
+
+
+void Viewer::LoadBlock(BlockPixels& block, const uint8* rgba, int width, int bx, int by)
+{
+	for (int y = 0; y < 4; y++)
+		std::memcpy(block[y*4], rgba + ((by*4 + y)*width + bx*4)*4, 16);
+}
+
+
+uint16 Viewer::PackColour(const float rgb[3])
+{
+	int r = tClamp(int(rgb[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+	int g = tClamp(int(rgb[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+	int b = tClamp(int(rgb[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+	return uint16((r << 11) | (g << 5) | b);
+}
+
+
+void Viewer::UnpackColour(uint16 colour, int rgb[3])
+{
+	int r = (colour >> 11) & 31;
+	int g = (colour >> 5) & 63;
+	int b = colour & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+int Viewer::ColourError(const int a[3], const uint8* b)
+{
+	int dr = a[0] - b[0];
+	int dg = a[1] - b[1];
+	int db = a[2] - b[2];
+	return dr*dr + dg*dg + db*db;
+}
+
+
+int Viewer::FitColourIndices(uint32& indices, uint16 c0, uint16 c1, const BlockPixels& block, const bool* used, bool endPointsOnly)
+{
+	// Indices 0 and 1 are the end points. In four colour mode 2 and 3 are a third and two thirds of the way to c1.
+	int palette[4][3];
+	UnpackColour(c0, palette[0]);
+	UnpackColour(c1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+	}
+
+	int numChoices = endPointsOnly ? 2 : 4;
+	int totalError = 0;
+	indices = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		if (!used[p])
+		{
+			indices |= 3u << (2*p);
+			continue;
+		}
+
+		int best = 0;
+		int bestError = ColourError(palette[0], block[p]);
+		for (int i = 1; i < numChoices; i++)
+		{
+			int error = ColourError(palette[i], block[p]);
+			if (error < bestError)
+			{
+				best = i;
+				bestError = error;
+			}
+		}
+		indices |= uint32(best) << (2*p);
+		totalError += bestError;
+	}
+
+	return totalError;
+}
+
+
+void Viewer::EncodeColourBlock(uint8* dst, const BlockPixels& block, bool punchThrough)
+{
+	bool used[16];
+	int numUsed = 0;
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int p = 0; p < 16; p++)
+	{
+		used[p] = !punchThrough || (block[p][3] >= 128);
+		if (!used[p])
+			continue;
+
+		numUsed++;
+		for (int c = 0; c < 3; c++)
+			mean[c] += float(block[p][c]);
+	}
+
+	// A fully transparent block. Three colour mode with every pixel transparent.
+	if (numUsed == 0)
+	{
+		std::memset(dst, 0, 4);
+		std::memset(dst + 4, 0xFF, 4);
+		return;
+	}
+
+	for (int c = 0; c < 3; c++)
+		mean[c] /= float(numUsed);
+
+	// The principal axis of the colours is found by power iteration on their covariance.
+	float cov[3][3] = { };
+	for (int p = 0; p < 16; p++)
+	{
+		if (!used[p])
+			continue;
+
+		float d[3] = { float(block[p][0]) - mean[0], float(block[p][1]) - mean[1], float(block[p][2]) - mean[2] };
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				cov[i][j] += d[i]*d[j];
+	}
+
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iter = 0; iter < 8; iter++)
+	{
+		float next[3];
+		for (int i = 0; i < 3; i++)
+			next[i] = cov[i][0]*axis[0] + cov[i][1]*axis[1] + cov[i][2]*axis[2];
+		float length = std::sqrt(next[0]*next[0] + next[1]*next[1] + next[2]*next[2]);
+		if (length < 1e-6f)
+			break;
+		for (int i = 0; i < 3; i++)
+			axis[i] = next[i] / length;
+	}
+
+	float minT = 0.0f, maxT = 0.0f;
+	for (int p = 0; p < 16; p++)
+	{
+		if (!used[p])
+			continue;
+
+		float t = (float(block[p][0]) - mean[0])*axis[0] + (float(block[p][1]) - mean[1])*axis[1] + (float(block[p][2]) - mean[2])*axis[2];
+		minT = tMin(minT, t);
+		maxT = tMax(maxT, t);
+	}
+
+	float end0[3], end1[3];
+	for (int c = 0; c < 3; c++)
+	{
+		end0[c] = tClamp(mean[c] + axis[c]*maxT, 0.0f, 255.0f);
+		end1[c] = tClamp(mean[c] + axis[c]*minT, 0.0f, 255.0f);
+	}
+	uint16 c0 = PackColour(end0);
+	uint16 c1 = PackColour(end1);
+	uint32 indices = 0;
+	int error = FitColourIndices(indices, c0, c1, block, used, punchThrough);
+
+	// Refine the end points by least squares given the indices, and keep the result if it is better. Each index
+	// stands for a fixed blend of the two end points.
+	const float weight0[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f };
+	float bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int p = 0; p < 16; p++)
+	{
+		if (!used[p])
+			continue;
+
+		float a = weight0[(indices >> (2*p)) & 3];
+		float b = 1.0f - a;
+		aa += a*a;
+		ab += a*b;
+		bb += b*b;
+		for (int c = 0; c < 3; c++)
+		{
+			ax[c] += a * float(block[p][c]);
+			bx[c] += b * float(block[p][c]);
+		}
+	}
+
+	float det = aa*bb - ab*ab;
+	if (std::fabs(det) > 1e-6f)
+	{
+		float fit0[3], fit1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			fit0[c] = tClamp((bb*ax[c] - ab*bx[c]) / det, 0.0f, 255.0f);
+			fit1[c] = tClamp((aa*bx[c] - ab*ax[c]) / det, 0.0f, 255.0f);
+		}
+		uint16 fitC0 = PackColour(fit0);
+		uint16 fitC1 = PackColour(fit1);
+		uint32 fitIndices = 0;
+		int fitError = FitColourIndices(fitIndices, fitC0, fitC1, block, used, punchThrough);
+		if (fitError < error)
+		{
+			c0 = fitC0;
+			c1 = fitC1;
+			indices = fitIndices;
+		}
+	}
+
+	// Four colour mode needs c0 > c1 and three colour mode c0 <= c1. Swapping the end points swaps indices 0 and 1,
+	// and 2 and 3. Transparent pixels are index 3 in three colour mode and are left alone.
+	bool swap = punchThrough ? (c0 > c1) : (c0 < c1);
+	if (swap)
+	{
+		std::swap(c0, c1);
+		for (int p = 0; p < 16; p++)
+			if (used[p])
+				indices ^= 1u << (2*p);
+	}
+
+	// Equal end points mean three colour mode, where index 2 would be their average. Every pixel is c0 anyway.
+	if (!punchThrough && (c0 == c1))
+		indices = 0;
+
+	dst[0] = uint8(c0 & 0xFF);
+	dst[1] = uint8(c0 >> 8);
+	dst[2] = uint8(c1 & 0xFF);
+	dst[3] = uint8(c1 >> 8);
+	for (int b = 0; b < 4; b++)
+		dst[4 + b] = uint8(indices >> (8*b));
+}
+
+
+void Viewer::EncodeAlphaBlock(uint8* dst, const BlockPixels& block)
+{
+	int minA = 255, maxA = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		minA = tMin(minA, int(block[p][3]));
+		maxA = tMax(maxA, int(block[p][3]));
+	}
+
+	// With a0 > a1 there are eight values. Index 0 is a0, 1 is a1 and 2 to 7 step from a0 towards a1.
+	dst[0] = uint8(maxA);
+	dst[1] = uint8(minA);
+	uint64 indices = 0;
+	if (maxA > minA)
+	{
+		int palette[8] = { maxA, minA };
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8-i)*maxA + (i-1)*minA) / 7;
+
+		for (int p = 0; p < 16; p++)
+		{
+			int best = 0;
+			int bestError = tAbs(palette[0] - int(block[p][3]));
+			for (int i = 1; i < 8; i++)
+			{
+				int error = tAbs(palette[i] - int(block[p][3]));
+				if (error < bestError)
+				{
+					best = i;
+					bestError = error;
+				}
+			}
+			indices |= uint64(best) << (3*p);
+		}
+	}
+
+	for (int b = 0; b < 6; b++)
+		dst[2 + b] = uint8(indices >> (8*b));
+}
+
+
+bool Viewer::HasBinaryAlpha(const uint8* rgba, int numPixels)
+{
+	for (int p = 0; p < numPixels; p++)
+	{
+		uint8 alpha = rgba[p*4 + 3];
+		if ((alpha != 0) && (alpha != 255))
+			return false;
+	}
+	return true;
+}
+
+
+void Viewer::CompressBC1(uint8* dst, const uint8* rgba, int width, int height)
+{
+	BlockPixels block;
+	for (int by = 0; by < height/4; by++)
+	{
+		for (int bx = 0; bx < width/4; bx++)
+		{
+			LoadBlock(block, rgba, width, bx, by);
+			bool punchThrough = false;
+			for (int p = 0; p < 16; p++)
+				punchThrough = punchThrough || (block[p][3] < 128);
+
+			EncodeColourBlock(dst, block, punchThrough);
+			dst += BC1BlockSize;
+		}
+	}
+}
+
+
+void Viewer::CompressBC3(uint8* dst, const uint8* rgba, int width, int height)
+{
+	BlockPixels block;
+	for (int by = 0; by < height/4; by++)
+	{
+		for (int bx = 0; bx < width/4; bx++)
+		{
+			LoadBlock(block, rgba, width, bx, by);
+			EncodeAlphaBlock(dst, block);
+			EncodeColourBlock(dst + 8, block, false);
+			dst += BC3BlockSize;
+		}
+	}
+}
+
+
+void Viewer::TranscodeBC1ToBC3(uint8* dst, const uint8* src, int numBlocks)
+{
+	for (int b = 0; b < numBlocks; b++, src += BC1BlockSize, dst += BC3BlockSize)
+	{
+		// BC3 always decodes its colour in four colour mode. CompressBC1 only uses the end points in three colour
+		// blocks, so the colours come out the same and index 3 becomes alpha index 1, which is 0.
+		uint16 c0 = uint16(src[0] | (src[1] << 8));
+		uint16 c1 = uint16(src[2] | (src[3] << 8));
+		uint32 colourIndices = uint32(src[4]) | (uint32(src[5]) << 8) | (uint32(src[6]) << 16) | (uint32(src[7]) << 24);
+		uint64 alphaIndices = 0;
+		if (c0 <= c1)
+		{
+			for (int p = 0; p < 16; p++)
+				if (((colourIndices >> (2*p)) & 3) == 3)
+					alphaIndices |= uint64(1) << (3*p);
+		}
+
+		dst[0] = 255;
+		dst[1] = 0;
+		for (int i = 0; i < 6; i++)
+			dst[2 + i] = uint8(alphaIndices >> (8*i));
+		std::memcpy(dst + 8, src, BC1BlockSize);
+	}
+}
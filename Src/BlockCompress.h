@@ -0,0 +1,39 @@
+// BlockCompress.h
+//
+// A small BC1 and BC3 (DXT1 and DXT5) encoder for thumbnails. The blocks can be handed straight to the GPU. It aims
+// for good quality on small images rather than raw speed.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+
+
+namespace Viewer
+{
+	const int BC1BlockSize = 8;
+	const int BC3BlockSize = 16;
+
+	// Sources are RGBA with width and height multiples of 4. Blocks are written in the same row order as the source,
+	// so a bottom-up tPicture gives bottom-up blocks, which is what GL expects for a texture uploaded the same way.
+	inline int GetBlockCompressedSize(int width, int height, int blockSize)												{ return (width/4) * (height/4) * blockSize; }
+
+	// BC1 can only store fully opaque or fully transparent pixels. Returns true if every alpha is 0 or 255.
+	bool HasBinaryAlpha(const uint8* rgba, int numPixels);
+
+	// Alpha below 128 is encoded as transparent. Blocks with transparency never use the interpolated colour, so every
+	// block also decodes correctly as the colour part of a BC3 block. That is what makes TranscodeBC1ToBC3 exact.
+	void CompressBC1(uint8* dst, const uint8* rgba, int width, int height);
+	void CompressBC3(uint8* dst, const uint8* rgba, int width, int height);
+
+	// Turns blocks written by CompressBC1 into BC3 blocks without decoding them. Dst needs twice the space of src.
+	void TranscodeBC1ToBC3(uint8* dst, const uint8* src, int numBlocks);
+}
@@ -0,0 +1,181 @@
+// BufferPool.cpp
+//
+// Reuses the large temporary buffers that resampling, compression and texture uploads need over and over. Buffers are
+// grouped into size classes and are 64 byte aligned. On Linux the big ones are made eligible for transparent huge
+// pages so filling a fresh one doesn't fault in a page at a time.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdlib>
+#include <new>
+#include <Math/tFundamentals.h>
+#ifdef PLATFORM_WINDOWS
+#include <malloc.h>
+#elif defined(PLATFORM_LINUX)
+#include <sys/mman.h>
+#endif
+#include "BufferPool.h"
+using namespace tMath;
+
+
+const int BufferPool::MinClassBits			= 12;
+const int BufferPool::NumClasses			= 4 * (64 - BufferPool::MinClassBits);
+const int BufferPool::HeaderSize			= 64;
+const int64 BufferPool::HugePageSize		= 2*1024*1024;
+
+
+namespace Viewer
+{
+	BufferPool PixelBuffers(256*1024*1024);
+
+	// Sits just before the buffer handed out so Release knows where it came from.
+	struct BufferHeader
+	{
+		int Class;
+		int64 ClassBytes;
+	};
+}
+
+
+int BufferPool::GetClass(int64 numBytes, int64& classBytes)
+{
+	numBytes = tMax(numBytes, int64(1) << MinClassBits);
+
+	// Find the power of two at or below numBytes, then the quarter step above it that fits.
+	int bits = 0;
+	while ((int64(1) << (bits+1)) <= numBytes)
+		bits++;
+
+	int64 base = int64(1) << bits;
+	int64 step = base >> 2;
+	int quarter = int((numBytes - base + step - 1) / step);
+	classBytes = base + quarter*step;
+
+	// A quarter of 4 is the next power of two's first class.
+	return (bits - MinClassBits)*4 + quarter;
+}
+
+
+uint8* BufferPool::Allocate(int64 classBytes)
+{
+	int64 alignment = HeaderSize;
+	#ifdef PLATFORM_LINUX
+	if (classBytes >= HugePageSize)
+		alignment = HugePageSize;
+	#endif
+
+	// The header takes a whole 64 byte slot in front of the buffer so the buffer keeps the alignment. Big blocks start
+	// on a huge page boundary so the kernel can back all but the tail of them with huge pages.
+	int64 blockBytes = classBytes + HeaderSize;
+	void* block = nullptr;
+	#ifdef PLATFORM_WINDOWS
+	block = _aligned_malloc(size_t(blockBytes), size_t(alignment));
+	#else
+	if (posix_memalign(&block, size_t(alignment), size_t(blockBytes)) != 0)
+		block = nullptr;
+	#endif
+	if (!block)
+		throw std::bad_alloc();
+
+	#ifdef PLATFORM_LINUX
+	if (alignment == HugePageSize)
+		madvise(block, size_t(blockBytes & ~(HugePageSize-1)), MADV_HUGEPAGE);
+	#endif
+
+	return (uint8*)block;
+}
+
+
+void BufferPool::Free(uint8* block)
+{
+	#ifdef PLATFORM_WINDOWS
+	_aligned_free(block);
+	#else
+	free(block);
+	#endif
+}
+
+
+void* BufferPool::Acquire(int64 numBytes)
+{
+	int64 classBytes = 0;
+	int cls = GetClass(numBytes, classBytes);
+	uint8* block = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (Cached.empty())
+			Cached.resize(NumClasses);
+
+		Counts.NumAcquires++;
+		Counts.InUseBytes += classBytes;
+		std::vector<uint8*>& cached = Cached[cls];
+		if (!cached.empty())
+		{
+			block = cached.back();
+			cached.pop_back();
+			Counts.CachedBytes -= classBytes;
+			Counts.NumReused++;
+		}
+		Counts.PeakBytes = tMax(Counts.PeakBytes, Counts.InUseBytes + Counts.CachedBytes);
+	}
+
+	// Allocating outside the lock keeps other threads from waiting on the system allocator.
+	if (!block)
+		block = Allocate(classBytes);
+
+	Viewer::BufferHeader* header = (Viewer::BufferHeader*)block;
+	header->Class = cls;
+	header->ClassBytes = classBytes;
+	return block + HeaderSize;
+}
+
+
+void BufferPool::Release(void* buffer)
+{
+	if (!buffer)
+		return;
+
+	uint8* block = (uint8*)buffer - HeaderSize;
+	Viewer::BufferHeader* header = (Viewer::BufferHeader*)block;
+	int64 classBytes = header->ClassBytes;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Counts.InUseBytes -= classBytes;
+		if (Counts.CachedBytes + classBytes <= MaxCachedBytes)
+		{
+			Cached[header->Class].push_back(block);
+			Counts.CachedBytes += classBytes;
+			return;
+		}
+	}
+
+	Free(block);
+}
+
+
+void BufferPool::Clear()
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	for (std::vector<uint8*>& cached : Cached)
+	{
+		for (uint8* block : cached)
+			Free(block);
+		cached.clear();
+	}
+	Counts.CachedBytes = 0;
+}
+
+
+BufferPool::Stats BufferPool::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	return Counts;
+}
@@ -0,0 +1,72 @@
+// BufferPool.h
+//
+// Reuses the large temporary buffers that resampling, compression and texture uploads need over and over. Buffers are
+// grouped into size classes and are 64 byte aligned. On Linux the big ones are made eligible for transparent huge
+// pages so filling a fresh one doesn't fault in a page at a time.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <mutex>
+#include <vector>
+#include <Foundation/tStandard.h>
+
+
+// Buffers from the pool must go back to it with Release. They can't be given to a tPicture as it deletes its pixels
+// with delete[]. All functions are safe to call from any thread.
+class BufferPool
+{
+public:
+	// Released buffers are kept for reuse until there are maxCachedBytes of them. Beyond that they are freed.
+	BufferPool(int64 maxCachedBytes)																					: MaxCachedBytes(maxCachedBytes) { }
+	~BufferPool()																										{ Clear(); }
+
+	// The returned buffer has room for at least numBytes and its contents are undefined.
+	void* Acquire(int64 numBytes);
+	template<typename T> T* Acquire(int64 count)																		{ return (T*)Acquire(count*sizeof(T)); }
+	void Release(void* buffer);
+
+	// Frees all the cached buffers. Buffers in use are unaffected.
+	void Clear();
+
+	struct Stats
+	{
+		int64 NumAcquires			= 0;
+		int64 NumReused				= 0;		// Acquires that were given a cached buffer.
+		int64 InUseBytes			= 0;
+		int64 CachedBytes			= 0;
+		int64 PeakBytes				= 0;		// Of in use plus cached.
+	};
+	Stats GetStats() const;
+
+private:
+	// Each power of two is split into four classes so no more than a quarter of a buffer is wasted.
+	const static int MinClassBits;				// = 12;
+	const static int NumClasses;				// = 4 * (64 - MinClassBits);
+	const static int HeaderSize;				// = 64;
+	const static int64 HugePageSize;			// = 2 MB;
+
+	static int GetClass(int64 numBytes, int64& classBytes);
+	static uint8* Allocate(int64 classBytes);
+	static void Free(uint8* block);
+
+	int64 MaxCachedBytes;
+	mutable std::mutex Mutex;
+	std::vector<std::vector<uint8*>> Cached;	// Per class. The blocks include the header.
+	Stats Counts;
+};
+
+
+namespace Viewer
+{
+	// Shared by everything that needs temporary pixel sized buffers.
+	extern BufferPool PixelBuffers;
+}
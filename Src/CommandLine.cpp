@@ -0,0 +1,272 @@
+// CommandLine.cpp
+//
+// Batch conversion from the command line. Runs the same save code as the Save All dialog but never creates a window
+// or initializes GLFW, so it may be used on build servers.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#endif
+#include <cstdio>
+#include <cctype>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <System/tCommand.h>
+#include <System/tFile.h>
+#include <System/tMachine.h>
+#include <Math/tFundamentals.h>
+#include "CommandLine.h"
+#include "Batch.h"
+#include "Image.h"
+#include "Settings.h"
+using namespace tStd;
+using namespace tSystem;
+using namespace tMath;
+
+
+namespace Viewer
+{
+	tCommand::tOption ConvertOption("Convert images to this type (tga, png, bmp, jpg, or gif) without opening a window.", 'c', "convert", 1);
+	tCommand::tOption InputOption("Input folder, file, or quoted wildcard pattern like \"Dir/*.png\". Defaults to the current folder.", 'i', "input", 1);
+	tCommand::tOption OutputOption("Output folder. Defaults to a Saved sub-folder of the input folder.", 'o', "output", 1);
+	tCommand::tOption PercentOption("Resize by percent, retaining aspect.", 'p', "percent", 1);
+	tCommand::tOption WidthOption("Resize to this width. Retains aspect unless a height is also given.", 'w', "width", 1);
+	tCommand::tOption HeightOption("Resize to this height. Retains aspect unless a width is also given.", 'h', "height", 1);
+	tCommand::tOption FilterOption("Resample filter: NearestNeighbour, Box, Bilinear, Bicubic, Quadratic, or Hamming.", 'f', "filter", 1);
+	tCommand::tOption QualityOption("Jpg quality from 1 to 100.", 'q', "quality", 1);
+	tCommand::tOption RLEOption("Use RLE compression for tga files.", 'r', "rle");
+	tCommand::tOption JobsOption("Number of worker threads. Defaults to the number of cores.", 'j', "jobs", 1);
+
+	const int CommandLineMaxInFlightMB = 1024;
+	std::mutex CommandLinePrintMutex;
+	void CommandLinePrintCallback(const char* text, int numChars);
+
+	bool MatchWildcard(const char* pattern, const char* str);
+	tString FindConvertFiles(tList<tStringItem>& files, const tString& input);		// Returns the input folder.
+}
+
+
+void Viewer::CommandLinePrintCallback(const char* text, int numChars)
+{
+	// Worker threads print as they save so the output needs to be serialized.
+	std::lock_guard<std::mutex> lock(CommandLinePrintMutex);
+	fwrite(text, 1, numChars, stdout);
+	fflush(stdout);
+}
+
+
+bool Viewer::MatchWildcard(const char* pattern, const char* str)
+{
+	// Supports * and ? and is case-insensitive, as filenames on Windows are.
+	const char* starPattern = nullptr;
+	const char* starStr = nullptr;
+	while (*str)
+	{
+		if ((*pattern == '?') || (tolower(*pattern) == tolower(*str)))
+		{
+			pattern++;
+			str++;
+		}
+		else if (*pattern == '*')
+		{
+			starPattern = pattern++;
+			starStr = str;
+		}
+		else if (starPattern)
+		{
+			pattern = starPattern + 1;
+			str = ++starStr;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return (*pattern == '\0');
+}
+
+
+tString Viewer::FindConvertFiles(tList<tStringItem>& files, const tString& input)
+{
+	if (input.IsEmpty())
+	{
+		tString dir = tGetCurrentDir();
+		FindImageFiles(files, dir);
+		return dir;
+	}
+
+	if (tDirExists(input))
+	{
+		tString dir = input;
+		if ((dir[dir.Length()-1] != '/') && (dir[dir.Length()-1] != '\\'))
+			dir += "/";
+		FindImageFiles(files, dir);
+		return dir;
+	}
+
+	tString dir = tGetDir(input);
+	if (dir.IsEmpty())
+		dir = tGetCurrentDir();
+
+	tString pattern = tGetFileName(input);
+	if ((pattern.FindChar('*') == -1) && (pattern.FindChar('?') == -1))
+	{
+		if (tFileExists(input))
+			files.Append(new tStringItem(input));
+		return dir;
+	}
+
+	tList<tStringItem> candidates;
+	FindImageFiles(candidates, dir);
+	while (tStringItem* candidate = candidates.Remove())
+	{
+		if (MatchWildcard(pattern.Chars(), tGetFileName(*candidate).Chars()))
+			files.Append(candidate);
+		else
+			delete candidate;
+	}
+	return dir;
+}
+
+
+bool Viewer::IsCommandLineConvert()
+{
+	return ConvertOption.IsPresent();
+}
+
+
+int Viewer::DoCommandLineConvert()
+{
+	#ifdef PLATFORM_WINDOWS
+	// The viewer is a windows-subsystem program so it does not get a console. Use the one we were launched from.
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+		freopen("CONOUT$", "w", stdout);
+	#endif
+	tSystem::tSetStdoutRedirectCallback(CommandLinePrintCallback);
+
+	// Start from the default settings, not the user's, so build server results don't depend on who ran the viewer.
+	Config.Reset();
+
+	tString type = ConvertOption.Arg1();
+	type.ToLower();
+	const char* fileTypes[] = { "tga", "png", "bmp", "jpg", "gif" };
+	int saveFileType = -1;
+	for (int t = 0; t < tNumElements(fileTypes); t++)
+		if ((type == fileTypes[t]) || (type == tString(".") + fileTypes[t]))
+			saveFileType = t;
+	if (saveFileType < 0)
+	{
+		tPrintf("Error: Unsupported conversion type %s.\n", type.Chars());
+		tCommand::tPrintUsage();
+		return 1;
+	}
+	Config.SaveFileType = saveFileType;
+	Config.SaveFileTargaRLE = RLEOption.IsPresent();
+	if (QualityOption.IsPresent())
+		Config.SaveFileJpegQuality = tClamp(QualityOption.Arg1().GetAsInt(), 1, 100);
+
+	if (FilterOption.IsPresent())
+	{
+		// Matches tImage::tPicture::tFilter.
+		const char* filterNames[] = { "NearestNeighbour", "Box", "Bilinear", "Bicubic", "Quadratic", "Hamming" };
+		int filter = -1;
+		for (int f = 0; f < tNumElements(filterNames); f++)
+			if (FilterOption.Arg1().IsEqualCI(filterNames[f]))
+				filter = f;
+		if (filter < 0)
+		{
+			tPrintf("Error: Unknown resample filter %s.\n", FilterOption.Arg1().Chars());
+			tCommand::tPrintUsage();
+			return 1;
+		}
+		Config.ResampleFilter = filter;
+	}
+
+	// Same size modes as the Save All dialog. With no size options the images are converted at their original size.
+	Settings::SizeMode sizeMode = Settings::SizeMode::Percent;
+	float scale = 1.0f;
+	int width = WidthOption.IsPresent() ? WidthOption.Arg1().GetAsInt() : 0;
+	int height = HeightOption.IsPresent() ? HeightOption.Arg1().GetAsInt() : 0;
+	if (PercentOption.IsPresent())
+		scale = PercentOption.Arg1().GetAsFloat() / 100.0f;
+	else if (WidthOption.IsPresent() && HeightOption.IsPresent())
+		sizeMode = Settings::SizeMode::SetWidthAndHeight;
+	else if (WidthOption.IsPresent())
+		sizeMode = Settings::SizeMode::SetWidthRetainAspect;
+	else if (HeightOption.IsPresent())
+		sizeMode = Settings::SizeMode::SetHeightRetainAspect;
+
+	tList<tStringItem> inputFiles;
+	tString inputDir = FindConvertFiles(inputFiles, InputOption.IsPresent() ? InputOption.Arg1() : tString());
+
+	// Loading a dds file uses GL to decode it and there is no context, so they are skipped.
+	std::vector<tString> files;
+	for (tStringItem* file = inputFiles.First(); file; file = file->Next())
+	{
+		if (tGetFileType(*file) == tFileType::DDS)
+			tPrintf("Skipping %s. Dds conversion requires a window.\n", file->Chars());
+		else
+			files.push_back(*file);
+	}
+	if (files.empty())
+	{
+		tPrintf("Error: No images found to convert.\n");
+		return 1;
+	}
+
+	tString outDir = OutputOption.IsPresent() ? OutputOption.Arg1() : inputDir + "Saved/";
+	if ((outDir[outDir.Length()-1] != '/') && (outDir[outDir.Length()-1] != '\\'))
+		outDir += "/";
+	if (!tDirExists(outDir) && !tCreateDir(outDir))
+	{
+		tPrintf("Error: Could not create output folder %s.\n", outDir.Chars());
+		return 1;
+	}
+
+	int numThreads = JobsOption.IsPresent() ? JobsOption.Arg1().GetAsInt() : tGetNumCores();
+	tiClamp(numThreads, 1, int(files.size()));
+	tString extension = GetSaveFileTypeExtension(Config.SaveFileType);
+	tPrintf("Converting %d images to %s using %d threads.\n", int(files.size()), outDir.Chars(), numThreads);
+
+	// The same pipeline as Save All. Config is only read when the saver starts.
+	std::vector<BatchSaver::Job> jobs;
+	for (const tString& file : files)
+	{
+		BatchSaver::Job job;
+		job.SrcFile = file;
+		job.OutFile = outDir + tGetFileBaseName(file) + extension;
+		jobs.push_back(job);
+	}
+
+	BatchSaver saver(numThreads, CommandLineMaxInFlightMB);
+	saver.Start(jobs, width, height, scale, sizeMode);
+	int numReported = 0;
+	while (saver.Update())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		int numDone = saver.GetNumDone();
+		if (numDone != numReported)
+		{
+			tPrintf("Progress: %d/%d\n", numDone, saver.GetNumJobs());
+			numReported = numDone;
+		}
+	}
+	int numFailed = saver.GetNumFailed();
+
+	tPrintf("Converted %d of %d images.\n", int(files.size()) - numFailed, int(files.size()));
+	return (numFailed > 0) ? 1 : 0;
+}
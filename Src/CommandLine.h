@@ -0,0 +1,26 @@
+// CommandLine.h
+//
+// Batch conversion from the command line. Runs the same save code as the Save All dialog but never creates a window
+// or initializes GLFW, so it may be used on build servers.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+
+
+namespace Viewer
+{
+	// Returns true if the command line asked for a batch conversion. Only valid after tCommand::tParse.
+	bool IsCommandLineConvert();
+
+	// Converts all the requested images and returns the process exit code. Zero means every image was saved.
+	int DoCommandLineConvert();
+}
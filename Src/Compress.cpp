@@ -0,0 +1,328 @@
+// Compress.cpp
+//
+// A fast lossless compressor for keeping unloaded images in memory. The data is split into blocks that are compressed
+// and decompressed in parallel. Each block uses the LZ4 block format, which favours speed over ratio so getting the
+// pixels back is much quicker than decoding most image files again.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include <cstring>
+#include <Math/tFundamentals.h>
+#include <System/tMachine.h>
+#include "Compress.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	// Blocks are independent so they can be worked on in parallel. They are small enough that every match offset fits
+	// in the 16 bits the format allows for it.
+	const int CompressBlockSize			= 1024*1024;
+	const int CompressHashBits			= 14;
+	const int CompressMinMatch			= 4;
+	const int CompressMaxOffset			= 65535;
+	const int CompressLastLiterals		= 5;		// The format requires a block to end with at least this many literals.
+	const int CompressMatchLimit		= 12;		// And no match may start closer than this to the end.
+
+	// Shared by every caller. The calling thread always takes blocks itself, so a busy pool only slows things down.
+	ThreadPool CompressPool(tMax(tSystem::tGetNumCores(), 1));
+
+	struct CompressBlocks
+	{
+		std::function<void(int)> Func;
+		int NumBlocks;
+		std::atomic<int> NextBlock;
+		std::atomic<int> BlocksDone;
+		std::mutex Mutex;
+		std::condition_variable Done;
+	};
+
+	// Calls func(block) for every block in [0, numBlocks). Returns once they are all done.
+	void ParallelBlocks(int numBlocks, const std::function<void(int)>& func);
+	void RunBlocks(CompressBlocks&);
+
+	// Dst must have room for GetCompressBound(srcSize) bytes. Returns the compressed size.
+	int GetCompressBound(int srcSize)																					{ return srcSize + srcSize/255 + 16; }
+	int CompressBlock(uint8* dst, const uint8* src, int srcSize);
+	bool DecompressBlock(uint8* dst, int dstSize, const uint8* src, int srcSize);
+
+	uint32 Read32(const uint8* src)																						{ uint32 v; std::memcpy(&v, src, 4); return v; }
+	uint8* WriteLength(uint8* dst, int length);
+	bool ReadLength(const uint8*& src, const uint8* srcEnd, int& length);
+}
+
+
+void Viewer::ParallelBlocks(int numBlocks, const std::function<void(int)>& func)
+{
+	int numThreads = CompressPool.GetNumThreads();
+	if ((numBlocks <= 1) || (numThreads <= 1))
+	{
+		for (int b = 0; b < numBlocks; b++)
+			func(b);
+		return;
+	}
+
+	// Helpers may start after every block has been taken, so they share ownership of the blocks.
+	std::shared_ptr<CompressBlocks> blocks = std::make_shared<CompressBlocks>();
+	blocks->Func = func;
+	blocks->NumBlocks = numBlocks;
+	blocks->NextBlock = 0;
+	blocks->BlocksDone = 0;
+
+	int numHelpers = tMin(numBlocks-1, numThreads);
+	for (int h = 0; h < numHelpers; h++)
+		CompressPool.Submit([blocks]() { RunBlocks(*blocks); });
+
+	RunBlocks(*blocks);
+	std::unique_lock<std::mutex> lock(blocks->Mutex);
+	blocks->Done.wait(lock, [&blocks]() { return blocks->BlocksDone == blocks->NumBlocks; });
+}
+
+
+void Viewer::RunBlocks(CompressBlocks& blocks)
+{
+	for (int block = blocks.NextBlock++; block < blocks.NumBlocks; block = blocks.NextBlock++)
+	{
+		blocks.Func(block);
+		if (++blocks.BlocksDone == blocks.NumBlocks)
+		{
+			std::lock_guard<std::mutex> lock(blocks.Mutex);
+			blocks.Done.notify_all();
+		}
+	}
+}
+
+
+uint8* Viewer::WriteLength(uint8* dst, int length)
+{
+	// Only called for lengths of 15 or more. The 15 is already in the token.
+	for (length -= 15; length >= 255; length -= 255)
+		*dst++ = 255;
+	*dst++ = uint8(length);
+	return dst;
+}
+
+
+bool Viewer::ReadLength(const uint8*& src, const uint8* srcEnd, int& length)
+{
+	uint8 byte = 0;
+	do
+	{
+		if ((src >= srcEnd) || (length > CompressBlockSize))
+			return false;
+		byte = *src++;
+		length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+
+int Viewer::CompressBlock(uint8* dst, const uint8* src, int srcSize)
+{
+	// The table holds the last position each hashed 4-byte sequence was seen at.
+	int table[1 << CompressHashBits];
+	for (int& entry : table)
+		entry = -1;
+
+	uint8* out = dst;
+	int anchor = 0;
+	int pos = 0;
+	int matchStartLimit = srcSize - CompressMatchLimit;
+	int matchEndLimit = srcSize - CompressLastLiterals;
+	while (pos < matchStartLimit)
+	{
+		uint32 sequence = Read32(src + pos);
+		uint32 hash = (sequence * 2654435761u) >> (32 - CompressHashBits);
+		int ref = table[hash];
+		table[hash] = pos;
+		if ((ref < 0) || (pos - ref > CompressMaxOffset) || (Read32(src + ref) != sequence))
+		{
+			// Step further the longer nothing has matched, so incompressible data goes by quickly.
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+
+		// Extend the match backwards into the pending literals and then forwards as far as allowed.
+		while ((pos > anchor) && (ref > 0) && (src[pos-1] == src[ref-1]))
+		{
+			pos--;
+			ref--;
+		}
+		int length = CompressMinMatch;
+		while ((pos + length + 4 <= matchEndLimit) && (Read32(src + pos + length) == Read32(src + ref + length)))
+			length += 4;
+		while ((pos + length < matchEndLimit) && (src[pos + length] == src[ref + length]))
+			length++;
+
+		int numLiterals = pos - anchor;
+		int matchExtra = length - CompressMinMatch;
+		*out++ = uint8((tMin(numLiterals, 15) << 4) | tMin(matchExtra, 15));
+		if (numLiterals >= 15)
+			out = WriteLength(out, numLiterals);
+		std::memcpy(out, src + anchor, numLiterals);
+		out += numLiterals;
+
+		int offset = pos - ref;
+		*out++ = uint8(offset & 0xFF);
+		*out++ = uint8(offset >> 8);
+		if (matchExtra >= 15)
+			out = WriteLength(out, matchExtra);
+
+		pos += length;
+		anchor = pos;
+	}
+
+	// The last sequence is only literals.
+	int numLiterals = srcSize - anchor;
+	*out++ = uint8(tMin(numLiterals, 15) << 4);
+	if (numLiterals >= 15)
+		out = WriteLength(out, numLiterals);
+	std::memcpy(out, src + anchor, numLiterals);
+	out += numLiterals;
+
+	return int(out - dst);
+}
+
+
+bool Viewer::DecompressBlock(uint8* dst, int dstSize, const uint8* src, int srcSize)
+{
+	const uint8* srcEnd = src + srcSize;
+	uint8* out = dst;
+	uint8* outEnd = dst + dstSize;
+	while (src < srcEnd)
+	{
+		int token = *src++;
+		int numLiterals = token >> 4;
+		if ((numLiterals == 15) && !ReadLength(src, srcEnd, numLiterals))
+			return false;
+
+		if ((numLiterals > srcEnd - src) || (numLiterals > outEnd - out))
+			return false;
+		std::memcpy(out, src, numLiterals);
+		out += numLiterals;
+		src += numLiterals;
+		if (src == srcEnd)
+			break;
+
+		if (srcEnd - src < 2)
+			return false;
+		int offset = src[0] | (src[1] << 8);
+		src += 2;
+
+		int length = token & 0x0F;
+		if ((length == 15) && !ReadLength(src, srcEnd, length))
+			return false;
+		length += CompressMinMatch;
+		if ((offset == 0) || (offset > out - dst) || (length > outEnd - out))
+			return false;
+
+		// When the match overlaps what it is writing it repeats the last offset bytes. Copying from the start of the
+		// match each time doubles the amount that can be copied in one go.
+		const uint8* match = out - offset;
+		uint8* matchEnd = out + length;
+		while (out < matchEnd)
+		{
+			int count = tMin(int(out - match), int(matchEnd - out));
+			std::memcpy(out, match, count);
+			out += count;
+		}
+	}
+
+	return (out == outEnd);
+}
+
+
+void Viewer::Compress(CompressedData& data, const uint8* src, int numBytes)
+{
+	// Each block is compressed into its own pooled scratch buffer and the results are packed together afterwards.
+	// Blocks that don't shrink are left where they are and copied straight from src.
+	int numBlocks = (numBytes + CompressBlockSize - 1) / CompressBlockSize;
+	std::vector<uint8*> scratch(numBlocks, nullptr);
+	std::vector<int> sizes(numBlocks, 0);
+	ParallelBlocks
+	(
+		numBlocks,
+		[&scratch, &sizes, src, numBytes](int b)
+		{
+			int start = b*CompressBlockSize;
+			int size = tMin(CompressBlockSize, numBytes - start);
+			scratch[b] = PixelBuffers.Acquire<uint8>(GetCompressBound(size));
+			int compressedSize = CompressBlock(scratch[b], src + start, size);
+			if (compressedSize < size)
+			{
+				sizes[b] = compressedSize;
+			}
+			else
+			{
+				PixelBuffers.Release(scratch[b]);
+				scratch[b] = nullptr;
+				sizes[b] = size;
+			}
+		}
+	);
+
+	data.NumBytes = numBytes;
+	data.BlockEnds.resize(numBlocks);
+	int end = 0;
+	for (int b = 0; b < numBlocks; b++)
+	{
+		end += sizes[b];
+		data.BlockEnds[b] = end;
+	}
+
+	std::vector<uint8>(end).swap(data.Data);
+	for (int b = 0; b < numBlocks; b++)
+	{
+		uint8* dst = data.Data.data() + data.BlockEnds[b] - sizes[b];
+		if (scratch[b])
+			std::memcpy(dst, scratch[b], sizes[b]);
+		else
+			std::memcpy(dst, src + b*CompressBlockSize, sizes[b]);
+		PixelBuffers.Release(scratch[b]);
+	}
+}
+
+
+bool Viewer::Decompress(uint8* dst, int numBytes, const CompressedData& data)
+{
+	int numBlocks = (numBytes + CompressBlockSize - 1) / CompressBlockSize;
+	if ((numBytes != data.NumBytes) || (numBlocks != int(data.BlockEnds.size())))
+		return false;
+
+	std::atomic<bool> ok(true);
+	ParallelBlocks
+	(
+		numBlocks,
+		[&ok, &data, dst, numBytes](int b)
+		{
+			int start = b*CompressBlockSize;
+			int size = tMin(CompressBlockSize, numBytes - start);
+			int blockStart = b ? data.BlockEnds[b-1] : 0;
+			int blockSize = data.BlockEnds[b] - blockStart;
+			if ((blockStart < 0) || (blockSize < 0) || (data.BlockEnds[b] > int(data.Data.size())))
+				ok = false;
+			else if (blockSize == size)
+				std::memcpy(dst + start, data.Data.data() + blockStart, size);
+			else if (!DecompressBlock(dst + start, size, data.Data.data() + blockStart, blockSize))
+				ok = false;
+		}
+	);
+
+	return ok;
+}
@@ -0,0 +1,36 @@
+// Compress.h
+//
+// A fast lossless compressor for keeping unloaded images in memory. The data is split into blocks that are compressed
+// and decompressed in parallel. Each block uses the LZ4 block format, which favours speed over ratio so getting the
+// pixels back is much quicker than decoding most image files again.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tStandard.h>
+
+
+namespace Viewer
+{
+	struct CompressedData
+	{
+		int64 GetSize() const																							{ return int64(Data.size()) + int64(BlockEnds.size())*sizeof(int); }
+
+		int NumBytes				= 0;		// Uncompressed.
+		std::vector<int> BlockEnds;				// Where each block ends in Data. Blocks that didn't shrink are stored as is.
+		std::vector<uint8> Data;
+	};
+
+	// Both are safe to call from any thread. Decompress returns false if the data is corrupt or dst is the wrong size.
+	void Compress(CompressedData&, const uint8* src, int numBytes);
+	bool Decompress(uint8* dst, int numBytes, const CompressedData&);
+}
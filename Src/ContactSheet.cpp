@@ -16,6 +16,7 @@
 #include "imgui.h"
 #include "ContactSheet.h"
 #include "SaveDialogs.h"
+#include "Batch.h"
 #include "TacentView.h"
 #include "Image.h"
 using namespace tStd;
@@ -26,13 +27,17 @@ using namespace tImage;
 
 namespace Viewer
 {
-	void SaveContactSheetTo
+	void GenerateContactSheet
 	(
 		const tString& outFile,
 		int contactWidth, int contactHeight,
 		int numCols, int numRows,
-		int finalWidth, int finalHeight
+		int finalWidth, int finalHeight,
+		bool resampleSheet
 	);
+	void GenerateAtlas(const tString& outFile, const AtlasOptions&);
+	void ReloadIfInImagesDir(const tString& outFile);
+	void DoAtlasOptions(AtlasOptions&);
 }
 
 
@@ -44,6 +49,9 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 	static int numCols = 4;
 	static int finalWidth = 2048;
 	static int finalHeight = 2048;
+	static bool resampleSheet = false;
+	static int layout = 0;
+	static AtlasOptions atlasOptions;
 	tAssert(CurrImage);
 	tPicture* picture = CurrImage->GetCurrentPic();
 	tAssert(picture);
@@ -65,70 +73,97 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 		finalHeight = contactHeight;
 	}
 
-	static char lo[32];
-	static char hi[32];
-
-	ImGui::InputInt("Frame Width", &frameWidth);
-	tiClampMin(frameWidth, 4);
-	int loP2W = tNextLowerPower2(frameWidth);	tiClampMin(loP2W, 4);	tsPrintf(lo, "fw%d", loP2W);
-	ImGui::SameLine(); if (ImGui::Button(lo)) frameWidth = loP2W;
-	int hiP2W = tNextHigherPower2(frameWidth);							tsPrintf(hi, "fw%d", hiP2W);
-	ImGui::SameLine(); if (ImGui::Button(hi)) frameWidth = hiP2W;
-	ImGui::SameLine(); ShowHelpMark("Single frame width in pixels.");
-
-	ImGui::InputInt("Frame Height", &frameHeight);
-	tiClampMin(frameHeight, 4);
-	int loP2H = tNextLowerPower2(frameHeight);	tiClampMin(loP2H, 4);	tsPrintf(lo, "fh%d", loP2H);
-	ImGui::SameLine(); if (ImGui::Button(lo)) frameHeight = loP2H;
-	int hiP2H = tNextHigherPower2(frameHeight);							tsPrintf(hi, "fh%d", hiP2H);
-	ImGui::SameLine(); if (ImGui::Button(hi)) frameHeight = hiP2H;
-	ImGui::SameLine(); ShowHelpMark("Single frame height in pixels.");
-
-	ImGui::InputInt("Columns", &numCols);
+	const char* layoutItems[] = { "Grid", "Packed Atlas" };
+	ImGui::Combo("Layout", &layout, layoutItems, tNumElements(layoutItems));
 	ImGui::SameLine();
-	ShowHelpMark("Number of columns.");
- 
-	ImGui::InputInt("Rows", &numRows);
-	ImGui::SameLine();
-	ShowHelpMark("Number of rows.");
+	ShowHelpMark
+	(
+		"Grid places every image in a fixed size frame.\n"
+		"Packed Atlas keeps the original sizes and packs the frames as tightly as possible.\n"
+		"It can also write a json manifest with the frame rects, uvs, and durations."
+	);
+	ImGui::Separator();
 
-	if (ImGui::Button("Reset From Image") && CurrImage)
+	if (layout == 0)
 	{
-		frameWidth = picW;
-		frameHeight = picH;
-		numRows = int(tCeiling(tSqrt(float(Images.Count()))));
-		numCols = int(tCeiling(tSqrt(float(Images.Count()))));
-	}
-	ImGui::Separator();
+		static char lo[32];
+		static char hi[32];
+
+		ImGui::InputInt("Frame Width", &frameWidth);
+		tiClampMin(frameWidth, 4);
+		int loP2W = tNextLowerPower2(frameWidth);	tiClampMin(loP2W, 4);	tsPrintf(lo, "fw%d", loP2W);
+		ImGui::SameLine(); if (ImGui::Button(lo)) frameWidth = loP2W;
+		int hiP2W = tNextHigherPower2(frameWidth);							tsPrintf(hi, "fw%d", hiP2W);
+		ImGui::SameLine(); if (ImGui::Button(hi)) frameWidth = hiP2W;
+		ImGui::SameLine(); ShowHelpMark("Single frame width in pixels.");
+
+		ImGui::InputInt("Frame Height", &frameHeight);
+		tiClampMin(frameHeight, 4);
+		int loP2H = tNextLowerPower2(frameHeight);	tiClampMin(loP2H, 4);	tsPrintf(lo, "fh%d", loP2H);
+		ImGui::SameLine(); if (ImGui::Button(lo)) frameHeight = loP2H;
+		int hiP2H = tNextHigherPower2(frameHeight);							tsPrintf(hi, "fh%d", hiP2H);
+		ImGui::SameLine(); if (ImGui::Button(hi)) frameHeight = hiP2H;
+		ImGui::SameLine(); ShowHelpMark("Single frame height in pixels.");
+
+		ImGui::InputInt("Columns", &numCols);
+		ImGui::SameLine();
+		ShowHelpMark("Number of columns.");
+ 
+		ImGui::InputInt("Rows", &numRows);
+		ImGui::SameLine();
+		ShowHelpMark("Number of rows.");
 
-	ImGui::InputInt("Final Width", &finalWidth);
-	tiClampMin(finalWidth, 4);
-	loP2W = tNextLowerPower2(finalWidth);	tiClampMin(loP2W, 4);	tsPrintf(lo, "w%d", loP2W);
-	ImGui::SameLine(); if (ImGui::Button(lo)) finalWidth = loP2W;
-	hiP2W = tNextHigherPower2(finalWidth);							tsPrintf(hi, "w%d", hiP2W);
-	ImGui::SameLine(); if (ImGui::Button(hi)) finalWidth = hiP2W;
-	ImGui::SameLine(); ShowHelpMark("Final scaled output sheet width in pixels.");
-
-	ImGui::InputInt("Final Height", &finalHeight);
-	tiClampMin(finalHeight, 4);
-	loP2H = tNextLowerPower2(finalHeight);	tiClampMin(loP2H, 4);	tsPrintf(lo, "h%d", loP2H);
-	ImGui::SameLine(); if (ImGui::Button(lo)) finalHeight = loP2H;
-	hiP2H = tNextHigherPower2(finalHeight);							tsPrintf(hi, "h%d", hiP2H);
-	ImGui::SameLine(); if (ImGui::Button(hi)) finalHeight = hiP2H;
-	ImGui::SameLine(); ShowHelpMark("Final scaled output sheet height in pixels.");
-
-	if (ImGui::Button("Reset"))
+		if (ImGui::Button("Reset From Image") && CurrImage)
+		{
+			frameWidth = picW;
+			frameHeight = picH;
+			numRows = int(tCeiling(tSqrt(float(Images.Count()))));
+			numCols = int(tCeiling(tSqrt(float(Images.Count()))));
+		}
+		ImGui::Separator();
+
+		ImGui::InputInt("Final Width", &finalWidth);
+		tiClampMin(finalWidth, 4);
+		loP2W = tNextLowerPower2(finalWidth);	tiClampMin(loP2W, 4);	tsPrintf(lo, "w%d", loP2W);
+		ImGui::SameLine(); if (ImGui::Button(lo)) finalWidth = loP2W;
+		hiP2W = tNextHigherPower2(finalWidth);							tsPrintf(hi, "w%d", hiP2W);
+		ImGui::SameLine(); if (ImGui::Button(hi)) finalWidth = hiP2W;
+		ImGui::SameLine(); ShowHelpMark("Final scaled output sheet width in pixels.");
+
+		ImGui::InputInt("Final Height", &finalHeight);
+		tiClampMin(finalHeight, 4);
+		loP2H = tNextLowerPower2(finalHeight);	tiClampMin(loP2H, 4);	tsPrintf(lo, "h%d", loP2H);
+		ImGui::SameLine(); if (ImGui::Button(lo)) finalHeight = loP2H;
+		hiP2H = tNextHigherPower2(finalHeight);							tsPrintf(hi, "h%d", hiP2H);
+		ImGui::SameLine(); if (ImGui::Button(hi)) finalHeight = hiP2H;
+		ImGui::SameLine(); ShowHelpMark("Final scaled output sheet height in pixels.");
+
+		if (ImGui::Button("Reset"))
+		{
+			finalWidth = contactWidth;
+			finalHeight = contactHeight;
+		}
+		ImGui::Separator();
+
+		// Matches tImage::tPicture::tFilter.
+		const char* filterItems[] = { "NearestNeighbour", "Box", "Bilinear", "Bicubic", "Quadratic", "Hamming" };
+		ImGui::Combo("Filter", &Config.ResampleFilter, filterItems, tNumElements(filterItems));
+		ImGui::SameLine();
+		ShowHelpMark("Filtering method to use when resizing images.");
+
+		ImGui::Checkbox("Resample Whole Sheet", &resampleSheet);
+		ImGui::SameLine();
+		ShowHelpMark
+		(
+			"Frames are normally resampled once, straight to their place in the final sheet.\n"
+			"If checked the full-size sheet is built first and then resampled as a whole.\n"
+			"This is slower and uses more memory."
+		);
+	}
+	else
 	{
-		finalWidth = contactWidth;
-		finalHeight = contactHeight;
+		DoAtlasOptions(atlasOptions);
 	}
-	ImGui::Separator();
-
-	// Matches tImage::tPicture::tFilter.
-	const char* filterItems[] = { "NearestNeighbour", "Box", "Bilinear", "Bicubic", "Quadratic", "Hamming" };
-	ImGui::Combo("Filter", &Config.ResampleFilter, filterItems, tNumElements(filterItems));
-	ImGui::SameLine();
-	ShowHelpMark("Filtering method to use when resizing images.");
 
 	tString extension = DoSaveFiletype();
 	ImGui::Separator();
@@ -140,8 +175,10 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 
 	int numImg = Images.Count();
 	tString genMsg;
-	if (numImg >= 2)
+	if ((numImg >= 2) && (layout == 0))
 		tsPrintf(genMsg, " Sheet will have %d frames with %d images.", numRows*numCols, tMin(numImg, numRows*numCols));
+	else if (numImg >= 2)
+		tsPrintf(genMsg, " Atlas will have frames from %d images.", numImg);
 	else
 		tsPrintf(genMsg, " Warning: At least 2 images are needed.");
 	ImGui::Text(genMsg.Chars());
@@ -172,7 +209,10 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 			}
 			else
 			{
-				SaveContactSheetTo(outFile, contactWidth, contactHeight, numCols, numRows, finalWidth, finalHeight);
+				if (layout == 0)
+					GenerateContactSheet(outFile, contactWidth, contactHeight, numCols, numRows, finalWidth, finalHeight, resampleSheet);
+				else
+					GenerateAtlas(outFile, atlasOptions);
 				closeThisModal = true;
 			}
 		}
@@ -184,8 +224,10 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 	{
 		bool pressedOK = false, pressedCancel = false;
 		DoOverwriteFileModal(outFile, pressedOK, pressedCancel);
-		if (pressedOK)
-			SaveContactSheetTo(outFile, contactWidth, contactHeight, numCols, numRows, finalWidth, finalHeight);
+		if (pressedOK && (layout == 0))
+			GenerateContactSheet(outFile, contactWidth, contactHeight, numCols, numRows, finalWidth, finalHeight, resampleSheet);
+		else if (pressedOK)
+			GenerateAtlas(outFile, atlasOptions);
 		if (pressedOK || pressedCancel)
 			closeThisModal = true;
 	}
@@ -197,103 +239,73 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 }
 
 
-void Viewer::SaveContactSheetTo
+void Viewer::GenerateContactSheet
 (
 	const tString& outFile,
 	int contactWidth, int contactHeight,
 	int numCols, int numRows,
-	int finalWidth, int finalHeight
+	int finalWidth, int finalHeight,
+	bool resampleSheet
 )
 {
-	tImage::tPicture outPic(contactWidth, contactHeight);
-	outPic.SetAll(tColouri(0, 0, 0, 0));
-
-	// Do the work.
-	int frameWidth = contactWidth / numCols;
-	int frameHeight = contactHeight / numRows;
-	int ix = 0;
-	int iy = 0;
-	int frame = 0;
-
-	tPrintf("Loading all frames...\n");
-	bool allOpaque = true;
-	for (Image* img = Images.First(); img; img = img->Next())
-	{
-		if (!img->IsLoaded())
-			img->Load();
-
-		if (img->IsLoaded() && !img->IsOpaque())
-			allOpaque = false;
-	}
-
-	Image* currImg = Images.First();
-	while (currImg)
-	{
-		if (!currImg->IsLoaded())
-		{
-			currImg = currImg->Next();
-			continue;
-		}
-
-		tPrintf("Processing frame %d : %s at (%d, %d).\n", frame, currImg->Filename.Chars(), ix, iy);
-		frame++;
-		tImage::tPicture* currPic = currImg->GetCurrentPic();
-
-		tImage::tPicture resampled;
-		if ((currImg->GetWidth() != frameWidth) || (currImg->GetHeight() != frameHeight))
-		{
-			resampled.Set(*currPic);
-			resampled.Resample(frameWidth, frameHeight, tImage::tPicture::tFilter(Config.ResampleFilter));
-		}
-
-		// Copy resampled frame into place.
-		for (int y = 0; y < frameHeight; y++)
-			for (int x = 0; x < frameWidth; x++)
-				outPic.SetPixel
-				(
-					x + (ix*frameWidth),
-					y + ((numRows-1-iy)*frameHeight),
-					resampled.IsValid() ? resampled.GetPixel(x, y) : currPic->GetPixel(x, y)
-				);
-
-		currImg = currImg->Next();
+	bool success = SaveContactSheetTo(Images, outFile, contactWidth, contactHeight, numCols, numRows, finalWidth, finalHeight, resampleSheet);
+	if (success)
+		ReloadIfInImagesDir(outFile);
+}
 
-		ix++;
-		if (ix >= numCols)
-		{
-			ix = 0;
-			iy++;
-			if (iy >= numRows)
-				break;
-		}
-	}
 
-	tImage::tPicture::tColourFormat colourFmt = allOpaque ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
-	tImage::tImageTGA::tFormat tgaFmt = allOpaque ? tImage::tImageTGA::tFormat::Bit24 : tImage::tImageTGA::tFormat::Bit32;
-	if ((finalWidth == contactWidth) && (finalHeight == contactHeight))
-	{
-		if (Config.SaveFileType == 0)
-			outPic.SaveTGA(outFile, tgaFmt, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
-		else
-			outPic.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
-	}
-	else
-	{
-		tImage::tPicture finalResampled(outPic);
-		finalResampled.Resample(finalWidth, finalHeight, tImage::tPicture::tFilter(Config.ResampleFilter));
+void Viewer::GenerateAtlas(const tString& outFile, const AtlasOptions& options)
+{
+	bool success = SaveAtlasTo(Images, outFile, options);
+	if (success)
+		ReloadIfInImagesDir(outFile);
+}
 
-		if (Config.SaveFileType == 0)
-			finalResampled.SaveTGA(outFile, tgaFmt, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
-		else
-			finalResampled.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
-	}
 
+void Viewer::ReloadIfInImagesDir(const tString& outFile)
+{
 	// If we saved to the same dir we are currently viewing, reload
 	// and set the current image to the generated one.
 	if (ImagesDir.IsEqualCI( tGetDir(outFile) ))
 	{
-		Images.Clear();
 		PopulateImages();
 		SetCurrentImage(outFile);
 	}
 }
+
+
+void Viewer::DoAtlasOptions(AtlasOptions& options)
+{
+	// Matches the power of 2 sizes the packer tries.
+	const char* sizeItems[] = { "1024", "2048", "4096", "8192", "16384" };
+	int sizeIndex = 0;
+	while ((sizeIndex < tNumElements(sizeItems)-1) && ((1024 << sizeIndex) < options.MaxSize))
+		sizeIndex++;
+	ImGui::Combo("Max Size", &sizeIndex, sizeItems, tNumElements(sizeItems));
+	options.MaxSize = 1024 << sizeIndex;
+	ImGui::SameLine(); ShowHelpMark("Maximum atlas width and height in pixels.");
+
+	ImGui::InputInt("Padding", &options.Padding);
+	tiClamp(options.Padding, 0, 64);
+	ImGui::SameLine(); ShowHelpMark("Pixels around each frame. Edge pixels are repeated into the padding so\nfiltering and mipmaps don't bleed between frames.");
+
+	const char* alignItems[] = { "1", "2", "4", "8", "16" };
+	int alignIndex = 0;
+	while ((alignIndex < tNumElements(alignItems)-1) && ((1 << alignIndex) < options.Alignment))
+		alignIndex++;
+	ImGui::Combo("Alignment", &alignIndex, alignItems, tNumElements(alignItems));
+	options.Alignment = 1 << alignIndex;
+	ImGui::SameLine(); ShowHelpMark("Frame rects start on multiples of this. Use 4 if the atlas will be block compressed.");
+
+	ImGui::Checkbox("Trim Transparent", &options.TrimTransparent);
+	ImGui::SameLine(); ShowHelpMark("Remove fully transparent borders before packing.\nThe manifest records the trim offset and original size.");
+
+	ImGui::Checkbox("Power of 2", &options.PowerOfTwo);
+	ImGui::SameLine(); ShowHelpMark("Keep the atlas dimensions a power of 2. Otherwise it is cropped to the packed area.");
+
+	ImGui::Checkbox("All Parts", &options.AllParts);
+	ImGui::SameLine(); ShowHelpMark("Add every frame of animated images, not only the current one.");
+
+	ImGui::Checkbox("Write Manifest", &options.WriteManifest);
+	ImGui::SameLine(); ShowHelpMark("Write a json file next to the atlas with the frame rects, uvs, trims, and durations.");
+}
@@ -0,0 +1,222 @@
+// ContentKey.cpp
+//
+// Keys cached data by what is in a file rather than where it is, so renamed, moved and copied files still find their
+// thumbnails. A small index remembers the key for each path along with the file's size and modification time, so
+// files that haven't changed don't need to be read again.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdio>
+#include <ctime>
+#include <Math/tFundamentals.h>
+#include <System/tFile.h>
+#include "ContentKey.h"
+using namespace tSystem;
+using namespace tMath;
+
+
+namespace Viewer
+{
+	const int64 ContentKeyFullHashSize	= 4*1024*1024;	// Files up to this size are hashed completely.
+	const int ContentKeyEndBytes		= 256*1024;		// Hashed from both the head and the tail of larger files.
+	const int ContentKeySampleBytes		= 4*1024;
+	const int ContentKeyNumSamples		= 64;			// Evenly spaced between the head and the tail.
+	const int ContentKeyIndexMaxEntries	= 1024*1024;	// Guards against a damaged count.
+	const uint32 ContentKeyIndexID		= 0x4B435654;	// TVCK
+
+	struct ContentKeyIndexHeader
+	{
+		uint32 ID;
+		int32 NumEntries;
+	};
+
+	struct ContentKeyEntry
+	{
+		uint64 PathHash;
+		uint64 FileSize;
+		int64 ModificationTime;
+		int64 LastUsed;
+		tuint256 Key;
+	};
+
+	std::mutex ContentKeyMutex;
+	std::unordered_map<uint64, ContentKeyEntry> ContentKeyIndex;
+
+	bool ReadFileAt(std::FILE*, int64 offset, uint8* dst, int numBytes);
+	bool ComputeContentKey(tuint256& key, const tString& file, uint64 fileSize);
+}
+
+
+bool Viewer::ReadFileAt(std::FILE* file, int64 offset, uint8* dst, int numBytes)
+{
+	#ifdef PLATFORM_WINDOWS
+	bool seeked = (_fseeki64(file, offset, SEEK_SET) == 0);
+	#else
+	bool seeked = (fseeko(file, off_t(offset), SEEK_SET) == 0);
+	#endif
+	return seeked && (std::fread(dst, 1, numBytes, file) == size_t(numBytes));
+}
+
+
+bool Viewer::ComputeContentKey(tuint256& key, const tString& filename, uint64 fileSize)
+{
+	std::FILE* file = std::fopen(filename.Chars(), "rb");
+	if (!file)
+		return false;
+
+	// The size goes in first so files that share their sampled blocks but differ in length still get their own key.
+	key = tHashData256((uint8*)&fileSize, sizeof(fileSize));
+	std::vector<uint8> buffer(ContentKeyEndBytes);
+	bool ok = true;
+	int64 size = int64(fileSize);
+	if (size <= ContentKeyFullHashSize)
+	{
+		for (int64 offset = 0; ok && (offset < size); offset += ContentKeyEndBytes)
+		{
+			int numBytes = int(tMin(size - offset, int64(ContentKeyEndBytes)));
+			ok = ReadFileAt(file, offset, buffer.data(), numBytes);
+			if (ok)
+				key = tHashData256(buffer.data(), numBytes, key);
+		}
+	}
+	else
+	{
+		ok = ReadFileAt(file, 0, buffer.data(), ContentKeyEndBytes);
+		if (ok)
+			key = tHashData256(buffer.data(), ContentKeyEndBytes, key);
+
+		int64 middle = size - 2*ContentKeyEndBytes - ContentKeySampleBytes;
+		for (int s = 0; ok && (s < ContentKeyNumSamples); s++)
+		{
+			int64 offset = ContentKeyEndBytes + middle*s/(ContentKeyNumSamples-1);
+			ok = ReadFileAt(file, offset, buffer.data(), ContentKeySampleBytes);
+			if (ok)
+				key = tHashData256(buffer.data(), ContentKeySampleBytes, key);
+		}
+
+		ok = ok && ReadFileAt(file, size - ContentKeyEndBytes, buffer.data(), ContentKeyEndBytes);
+		if (ok)
+			key = tHashData256(buffer.data(), ContentKeyEndBytes, key);
+	}
+
+	std::fclose(file);
+	return ok;
+}
+
+
+bool Viewer::GetContentKey(tuint256& key, const tString& file)
+{
+	tFileInfo fileInfo;
+	if (!tGetFileInfo(fileInfo, file))
+		return false;
+
+	uint64 pathHash = tHashString64(file.Chars());
+	int64 modTime = int64(fileInfo.ModificationTime);
+	int64 now = int64(std::time(nullptr));
+	{
+		std::lock_guard<std::mutex> lock(ContentKeyMutex);
+		auto found = ContentKeyIndex.find(pathHash);
+		if ((found != ContentKeyIndex.end()) && (found->second.FileSize == fileInfo.FileSize) && (found->second.ModificationTime == modTime))
+		{
+			found->second.LastUsed = now;
+			key = found->second.Key;
+			return true;
+		}
+	}
+
+	// Reading happens outside the lock so other threads aren't held up. Two threads hashing the same file just write the
+	// same entry.
+	if (!ComputeContentKey(key, file, fileInfo.FileSize))
+		return false;
+
+	ContentKeyEntry entry;
+	entry.PathHash = pathHash;
+	entry.FileSize = fileInfo.FileSize;
+	entry.ModificationTime = modTime;
+	entry.LastUsed = now;
+	entry.Key = key;
+	std::lock_guard<std::mutex> lock(ContentKeyMutex);
+	ContentKeyIndex[pathHash] = entry;
+	return true;
+}
+
+
+void Viewer::LoadContentKeyIndex(const tString& indexFile)
+{
+	if (!tFileExists(indexFile))
+		return;
+
+	tFileHandle handle = tOpenFile(indexFile.Chars(), "rb");
+	if (!handle)
+		return;
+
+	ContentKeyIndexHeader header;
+	bool ok = (tReadFile(handle, &header, sizeof(header)) == sizeof(header)) && (header.ID == ContentKeyIndexID) &&
+		(header.NumEntries >= 0) && (header.NumEntries <= ContentKeyIndexMaxEntries);
+	std::vector<ContentKeyEntry> entries(ok ? header.NumEntries : 0);
+	int entriesSize = int(entries.size() * sizeof(ContentKeyEntry));
+	ok = ok && (tReadFile(handle, entries.data(), entriesSize) == entriesSize);
+	tCloseFile(handle);
+
+	// A damaged index is removed. Keys are simply computed again.
+	if (!ok)
+	{
+		tDeleteFile(indexFile);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(ContentKeyMutex);
+	for (const ContentKeyEntry& entry : entries)
+		ContentKeyIndex[entry.PathHash] = entry;
+}
+
+
+void Viewer::SaveContentKeyIndex(const tString& indexFile, int maxEntries)
+{
+	maxEntries = tMax(maxEntries, 0);
+	std::vector<ContentKeyEntry> entries;
+	{
+		std::lock_guard<std::mutex> lock(ContentKeyMutex);
+		entries.reserve(ContentKeyIndex.size());
+		for (const auto& item : ContentKeyIndex)
+			entries.push_back(item.second);
+	}
+
+	if (int(entries.size()) > maxEntries)
+	{
+		auto newerFirst = [](const ContentKeyEntry& a, const ContentKeyEntry& b) { return a.LastUsed > b.LastUsed; };
+		std::nth_element(entries.begin(), entries.begin() + maxEntries, entries.end(), newerFirst);
+		entries.resize(maxEntries);
+	}
+
+	tString tempFile = indexFile + ".tmp";
+	tFileHandle handle = tOpenFile(tempFile.Chars(), "wb");
+	if (!handle)
+		return;
+
+	ContentKeyIndexHeader header;
+	header.ID = ContentKeyIndexID;
+	header.NumEntries = int32(entries.size());
+	int entriesSize = int(entries.size() * sizeof(ContentKeyEntry));
+	bool ok =
+		(tWriteFile(handle, &header, sizeof(header)) == sizeof(header)) &&
+		(tWriteFile(handle, entries.data(), entriesSize) == entriesSize);
+	tCloseFile(handle);
+
+	// Rename won't replace an existing file on Windows so the old index goes first. At worst the keys are computed again.
+	tDeleteFile(indexFile);
+	if (!ok || (std::rename(tempFile.Chars(), indexFile.Chars()) != 0))
+		tDeleteFile(tempFile);
+}
@@ -0,0 +1,32 @@
+// ContentKey.h
+//
+// Keys cached data by what is in a file rather than where it is, so renamed, moved and copied files still find their
+// thumbnails. A small index remembers the key for each path along with the file's size and modification time, so
+// files that haven't changed don't need to be read again.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Math/tHash.h>
+
+
+namespace Viewer
+{
+	// Small files are hashed completely. Larger ones hash their size, head, tail and evenly spaced blocks in between,
+	// which reads well under a megabyte however big the file is. Safe to call from any thread. Returns false if the
+	// file can't be read.
+	bool GetContentKey(tuint256& key, const tString& file);
+
+	// The index lives in the cache dir between runs. Saving keeps the maxEntries most recently used paths.
+	void LoadContentKeyIndex(const tString& indexFile);
+	void SaveContentKeyIndex(const tString& indexFile, int maxEntries);
+}
@@ -12,6 +12,7 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <vector>
 #include <System/tTime.h>
 #include <Math/tVector2.h>
 #include "imgui.h"
@@ -21,6 +22,84 @@
 using namespace tMath;
 
 
+namespace Viewer
+{
+	// The Images list is a linked list. The content view needs random access to find the first visible row without
+	// walking the list, so we cache a flat array that is rebuilt only when the list changes.
+	std::vector<Image*> ContentItems;
+	int ContentItemsVersion = -1;
+	float ContentLastScrollY = 0.0f;
+	float ContentScrollVelocity = 0.0f;			// In rows per second. Positive is scrolling down.
+
+	// Thumbnails this many visible-row-counts away from the view are released. Only part of the list is checked each
+	// frame so large folders stay cheap.
+	const int ContentReleaseDistance = 4;
+	const int ContentReleaseSweep = 256;
+	int ContentReleaseNext = 0;
+
+	void UpdateContentItems();
+	void RequestThumbnailRows(int rowBegin, int rowEnd, int numPerRow);
+	void ReleaseDistantThumbnails(int firstRow, int lastRow, int numPerRow);
+}
+
+
+void Viewer::UpdateContentItems()
+{
+	int numImages = Images.GetNumItems();
+	if ((ContentItemsVersion == ImagesVersion) && (int(ContentItems.size()) == numImages))
+		return;
+
+	ContentItems.clear();
+	ContentItems.reserve(numImages);
+	for (Image* i = Images.First(); i; i = i->Next())
+		ContentItems.push_back(i);
+	ContentItemsVersion = ImagesVersion;
+}
+
+
+void Viewer::RequestThumbnailRows(int rowBegin, int rowEnd, int numPerRow)
+{
+	// Rows are requested in the order given, so callers list the most important rows first. Requests fail silently
+	// once all worker threads are busy, which is what gives earlier rows priority.
+	int numItems = int(ContentItems.size());
+	int step = (rowBegin <= rowEnd) ? 1 : -1;
+	for (int row = rowBegin; row != rowEnd + step; row += step)
+	{
+		for (int col = 0; col < numPerRow; col++)
+		{
+			int index = row*numPerRow + col;
+			if ((index < 0) || (index >= numItems))
+				continue;
+			ContentItems[index]->RequestThumbnail();
+		}
+	}
+}
+
+
+void Viewer::ReleaseDistantThumbnails(int firstRow, int lastRow, int numPerRow)
+{
+	int numItems = int(ContentItems.size());
+	if (numItems <= 0)
+		return;
+
+	int keepRows = ContentReleaseDistance * (lastRow - firstRow + 1);
+	int keepBegin = (firstRow - keepRows) * numPerRow;
+	int keepEnd = (lastRow + keepRows + 1) * numPerRow;
+	bool released = false;
+	for (int n = 0; n < tMin(ContentReleaseSweep, numItems); n++)
+	{
+		int index = ContentReleaseNext++ % numItems;
+		Image* i = ContentItems[index];
+		if (((index < keepBegin) || (index >= keepEnd)) && (i != CurrImage) && i->ReleaseThumbnail())
+			released = true;
+	}
+	ContentReleaseNext %= numItems;
+
+	if (released)
+		Image::ThumbAtlas.ReleaseEmptyPages();
+}
+
+
 void Viewer::ShowContentViewDialog(bool* popen)
 {
 	ImGuiWindowFlags windowFlags = ImGuiWindowFlags_NoScrollbar;
@@ -35,78 +114,142 @@ void Viewer::ShowContentViewDialog(bool* popen)
 		return;
 	}
 
+	// Lets the atlas know which thumbnails are recently drawn so it doesn't reclaim their slots.
+	Image::ThumbAtlas.NewFrame();
+
+	// Finished workers must be joined even if their images are no longer visible. It frees up the worker threads.
+	Image::ReapThumbnailWorkers();
+	UpdateContentItems();
+
 	ImGuiWindowFlags thumbWindowFlags = 0;
 	ImGui::BeginChild("Thumbnails", tVector2(ImGui::GetWindowContentRegionWidth(), ImGui::GetWindowHeight()-61.0f), false, thumbWindowFlags);
 	
-	ImGuiStyle& style = ImGui::GetStyle();
-	float visibleW = ImGui::GetWindowPos().x + ImGui::GetWindowContentRegionMax().x;
-
 	float minSpacing = 4.0f;
 	float numPerRowF = ImGui::GetWindowContentRegionMax().x / (Config.ThumbnailWidth + minSpacing);
 	int numPerRow = tMath::tClampMin(int(numPerRowF), 1);
 	float extra = ImGui::GetWindowContentRegionMax().x - (float(numPerRow) * (Config.ThumbnailWidth + minSpacing));
-	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, tVector2(minSpacing + extra/float(numPerRow), minSpacing));
+	float spacingX = minSpacing + extra/float(numPerRow);
 	tVector2 thumbButtonSize(Config.ThumbnailWidth, Config.ThumbnailWidth*9.0f/16.0f); // 64 36, 32 18,
-	int thumbNum = 0;
-	for (Image* i = Images.First(); i; i = i->Next(), thumbNum++)
+	float itemHeight = thumbButtonSize.y + 32.0f;
+	float rowHeight = itemHeight + minSpacing;
+
+	int numItems = int(ContentItems.size());
+	int numRows = (numItems + numPerRow - 1) / numPerRow;
+
+	// Track how fast we're scrolling so we can prefetch further ahead in the direction of travel.
+	float dt = ImGui::GetIO().DeltaTime;
+	float scrollY = ImGui::GetScrollY();
+	if (dt > 0.0f)
+	{
+		float instVelocity = (scrollY - ContentLastScrollY) / (rowHeight * dt);
+		ContentScrollVelocity = tLisc(0.25f, ContentScrollVelocity, instVelocity);
+	}
+	ContentLastScrollY = scrollY;
+
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	ImFont* font = ImGui::GetFont();
+	float fontSize = ImGui::GetFontSize();
+	int firstRow = 0;
+	int lastRow = -1;
+
+	// Only the visible rows are submitted to ImGui. The clipper positions the cursor and accounts for the height of
+	// the skipped rows so the scrollbar is correct.
+	ImGuiListClipper clipper(numRows, rowHeight);
+	while (clipper.Step())
 	{
-		tVector2 cursor = ImGui::GetCursorPos();
-		if ((thumbNum % numPerRow) == 0)
-			ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow), cursor.y));
+		firstRow = clipper.DisplayStart;
+		lastRow = clipper.DisplayEnd - 1;
 
-		ImGui::PushID(thumbNum);
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tVector2::zero);
-		bool isCurr = (i == CurrImage);
+		// The visible rows get first pick of the worker threads.
+		RequestThumbnailRows(firstRow, lastRow, numPerRow);
 
-		// Unlike other widgets, BeginChild ALWAYS needs a corresponding EndChild, even if it's invisible.
-		bool visible = ImGui::BeginChild("ThumbItem", thumbButtonSize+tVector2(0.0, 32.0f), false, ImGuiWindowFlags_NoDecoration);
-		if (visible)
+		for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
 		{
-			i->RequestThumbnail();
-			uint64 thumbnailTexID = i->BindThumbnail();
-			if (!thumbnailTexID)
-				thumbnailTexID = DefaultThumbnailImage.Bind();
-			if
-			(
-				thumbnailTexID &&
-				ImGui::ImageButton(ImTextureID(thumbnailTexID), thumbButtonSize, tVector2(0,1), tVector2(1,0), 0,
-				ColourBG, ColourEnabledTint)
-			)
+			float rowY = ImGui::GetCursorPosY();
+			for (int col = 0; col < numPerRow; col++)
 			{
-				CurrImage = i;
-				LoadCurrImage();
-			}
+				int index = row*numPerRow + col;
+				if (index >= numItems)
+					break;
+
+				Image* i = ContentItems[index];
+				bool isCurr = (i == CurrImage);
+				ImGui::PushID(index);
+				ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow) + float(col)*(Config.ThumbnailWidth + spacingX), rowY));
+				tVector2 itemPos = ImGui::GetCursorScreenPos();
+
+				tVector2 uv0, uv1;
+				uint64 thumbnailTexID = i->BindThumbnail(uv0, uv1);
+				if (!thumbnailTexID)
+				{
+					thumbnailTexID = DefaultThumbnailImage.Bind();
+					uv0.Set(0.0f, 1.0f);
+					uv1.Set(1.0f, 0.0f);
+				}
+				if
+				(
+					thumbnailTexID &&
+					ImGui::ImageButton(ImTextureID(thumbnailTexID), thumbButtonSize, uv0, uv1, 0,
+					ColourBG, ColourEnabledTint)
+				)
+				{
+					CurrImage = i;
+					LoadCurrImage();
+				}
 
-			tString filename = tSystem::tGetFileName(i->Filename);
-			ImGui::Text(filename.Chars());
+				tString filename = tSystem::tGetFileName(i->Filename);
+				tString ttStr;
+				tsPrintf(ttStr, "%s\n%s\n%'d Bytes", 
+					filename.Chars(),
+					tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(), i->FileSizeB);
+				ShowToolTip(ttStr.Chars());
 
-			tString ttStr;
-			tsPrintf(ttStr, "%s\n%s\n%'d Bytes", 
-				filename.Chars(),
-				tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(), i->FileSizeB);
-			ShowToolTip(ttStr.Chars());
+				// The filename is drawn directly with a fine clip rect rather than pushing a clip rect (or a child
+				// window) per item. Pushing clip rects would break up the draw list and defeat the atlas batching.
+				tVector2 textPos(itemPos.x, itemPos.y + thumbButtonSize.y + 4.0f);
+				ImVec4 clipRect(itemPos.x, textPos.y, itemPos.x + thumbButtonSize.x, textPos.y + fontSize);
+				drawList->AddText
+				(
+					font, fontSize, textPos, ImGui::GetColorU32(ImGuiCol_Text),
+					filename.Chars(), nullptr, 0.0f, &clipRect
+				);
+
+				// We use a line under the filename to indicate the current item.
+				if (isCurr)
+				{
+					float lineY = textPos.y + fontSize + 4.0f;
+					drawList->AddLine
+					(
+						tVector2(itemPos.x, lineY), tVector2(itemPos.x + thumbButtonSize.x, lineY),
+						ImGui::GetColorU32(ImGuiCol_Separator), 2.0f
+					);
+				}
+				ImGui::PopID();
+			}
+			ImGui::SetCursorPosY(rowY + rowHeight);
+		}
+	}
 
-			// We use a separator to indicate the current item.
-			if (isCurr)
-				ImGui::Separator(2.0f);
+	// Prefetch rows just outside the visible range. More rows are fetched ahead in the direction of scrolling,
+	// proportional to the scroll speed, and a couple of rows are kept warm behind.
+	if (lastRow >= firstRow)
+	{
+		int numVisibleRows = lastRow - firstRow + 1;
+		int ahead = 1 + tMath::tClamp(int(tMath::tAbs(ContentScrollVelocity) * 0.5f), 0, 2*numVisibleRows);
+		int behind = 1;
+		if (ContentScrollVelocity >= 0.0f)
+		{
+			RequestThumbnailRows(lastRow+1, tMath::tClampMax(lastRow+ahead, numRows-1), numPerRow);
+			RequestThumbnailRows(firstRow-1, tMath::tClampMin(firstRow-behind, 0), numPerRow);
 		}
 		else
 		{
-			// We need to keep calling bind even if the image is not visible. It frees up the worker threads.
-			if (i->IsThumbnailWorkerActive())
-				i->BindThumbnail();
-			else
-				i->UnrequestThumbnail();
+			RequestThumbnailRows(firstRow-1, tMath::tClampMin(firstRow-ahead, 0), numPerRow);
+			RequestThumbnailRows(lastRow+1, tMath::tClampMax(lastRow+behind, numRows-1), numPerRow);
 		}
-		ImGui::EndChild();
-		ImGui::PopStyleVar();
 
-		if ((thumbNum+1) % numPerRow)
-			ImGui::SameLine();
-
-		ImGui::PopID();
+		ReleaseDistantThumbnails(firstRow, lastRow, numPerRow);
 	}
-	ImGui::PopStyleVar();
 	ImGui::EndChild();
 
 	ImGuiWindowFlags viewOptionsWindowFlags = ImGuiWindowFlags_NoScrollbar;
@@ -126,6 +269,12 @@ void Viewer::ShowContentViewDialog(bool* popen)
 	if (ImGui::Checkbox("Ascending", &Config.SortAscending))
 		SortImages(Settings::SortKeyEnum(Config.SortKey), Config.SortAscending);
 
+	ImGui::SameLine();
+	float thumbCPUMB = float(Image::GetThumbnailPictureBytes()) / (1024.0f*1024.0f);
+	float thumbGPUMB = float(Image::ThumbAtlas.GetNumBytes()) / (1024.0f*1024.0f);
+	ImGui::Text("Thumbnails: %.1f MB RAM %.0f MB VRAM", thumbCPUMB, thumbGPUMB);
+	ShowToolTip("Memory held by thumbnails. Thumbnails are freed from RAM once on the GPU and released from the GPU when scrolled well out of view. Either is quickly read back from the cache.");
+
 	ImGui::PopItemWidth();
 	ImGui::EndChild();
 	ImGui::End();
@@ -12,6 +12,7 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <cfloat>
 #include <Foundation/tVersion.cmake.h>
 #include <Math/tVector2.h>
 #include <Math/tColour.h>
@@ -21,11 +22,96 @@
 #include "Dialogs.h"
 #include "Settings.h"
 #include "Image.h"
+#include "Profile.h"
+#include "Sequence.h"
+#include "BufferPool.h"
+#include "MemoryBudget.h"
 #include "TacentView.h"
 #include "Version.cmake.h"
 using namespace tMath;
 
 
+namespace Viewer
+{
+	// Part of the image details overlay. Shows the statistics of the selected region, if there is one. Otherwise those
+	// of the whole image from when it was loaded, as long as the primary part is being viewed.
+	void ShowRegionStats();
+	void ShowPixelStats(const PixelStats&);
+	void ShowSequenceStats();
+}
+
+
+void Viewer::ShowRegionStats()
+{
+	int x, y, w, h;
+	if (!GetSelectedRegion(x, y, w, h))
+	{
+		const PixelStats& stats = CurrImage->Info.Stats;
+		if ((CurrImage->PartNum != 0) || CurrImage->IsAltPictureEnabled() || (stats.NumPixels == 0))
+			return;
+
+		ImGui::Separator();
+		ImGui::Text("Image: %d Pixels", stats.NumPixels);
+		ShowPixelStats(stats);
+		return;
+	}
+
+	ImGui::Separator();
+	ImGui::Text("Region: %dx%d at (%d, %d)", w, h, x, y);
+	const PixelStats* stats = CurrImage->GetRegionStats(x, y, w, h);
+	if (!stats)
+	{
+		ImGui::Text(CurrImage->IsAltPictureEnabled() ? "Not available for this view" : "Computing...");
+		return;
+	}
+	ShowPixelStats(*stats);
+}
+
+
+void Viewer::ShowPixelStats(const PixelStats& stats)
+{
+	ImGui::Text("Greyscale: %s", stats.Greyscale ? "true" : "false");
+	const char* channelNames[4] = { "R", "G", "B", "A" };
+	const tVector4 channelColours[4] =
+	{
+		tVector4(0.90f, 0.30f, 0.30f, 1.00f),
+		tVector4(0.30f, 0.85f, 0.30f, 1.00f),
+		tVector4(0.35f, 0.50f, 0.95f, 1.00f),
+		tVector4(0.80f, 0.80f, 0.80f, 1.00f)
+	};
+	for (int c = 0; c < 4; c++)
+	{
+		ImGui::Text
+		(
+			"%s  Min %3d  Max %3d  Mean %6.2f  SD %6.2f", channelNames[c],
+			stats.Min[c], stats.Max[c], stats.Mean[c], stats.StdDev[c]
+		);
+
+		float histogram[256];
+		for (int v = 0; v < 256; v++)
+			histogram[v] = float(stats.Histogram[c][v]);
+
+		tString label; tsPrintf(label, "##Histogram%s", channelNames[c]);
+		ImGui::PushStyleColor(ImGuiCol_PlotHistogram, channelColours[c]);
+		ImGui::PlotHistogram(label.Chars(), histogram, 256, 0, nullptr, 0.0f, FLT_MAX, tVector2(256.0f, 32.0f));
+		ImGui::PopStyleColor();
+	}
+}
+
+
+void Viewer::ShowSequenceStats()
+{
+	if (!Sequence.IsPlaying())
+		return;
+
+	ImGui::Separator();
+	ImGui::Text("Sequence Frame: %d/%d", Sequence.GetFrame()+1, Sequence.GetNumFrames());
+	ImGui::Text("Frame Rate: %.1f of %.1f fps", Sequence.GetAchievedFPS(), Sequence.GetFPS());
+	ImGui::Text("Dropped Frames: %d", Sequence.GetNumDropped());
+	ImGui::Text("Cached: %d Frames, %d MB", Sequence.GetNumCached(), int(Sequence.GetCacheBytes() / (1024*1024)));
+}
+
+
 void Viewer::ShowImageDetailsOverlay(bool* popen, float x, float y, float w, float h, int cursorX, int cursorY, float zoom)
 {
 	// This overlay function is pretty much taken from the DearImGui demo code.
@@ -84,6 +170,8 @@ void Viewer::ShowImageDetailsOverlay(bool* popen, float x, float y, float w, flo
 				ImGui::Text(sizeStr.Chars());
 				ImGui::Text("Cursor: (%d, %d)", cursorX, cursorY);
 				ImGui::Text("Zoom: %.0f%%", zoom);
+				ShowSequenceStats();
+				ShowRegionStats();
 			}
 		}
 		ImGui::Text("Images In Folder: %d", Images.GetNumItems());
@@ -132,10 +220,13 @@ void Viewer::ShowCheatSheetPopup(bool* popen)
 		ImGui::Text("Shift-Delete");ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Delete Current Image Permanently");
 		ImGui::Text("LMB-Click");	ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Set Colour Reticle Pos");
 		ImGui::Text("RMB-Drag");	ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Pan Image");
+		ImGui::Text("Shift-Drag");	ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Select Region For Stats");
 		ImGui::Text("Alt-F4");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Quit");
 		ImGui::Text("Ctrl-S");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Save As...");
 		ImGui::Text("Alt-S");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Save All...");
 
+		ImGui::Text("Ctrl-Z");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Undo Edit");
+		ImGui::Text("Ctrl-Y");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Redo Edit");
 		ImGui::Text("Ctrl <");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Flip Vertically");
 		ImGui::Text("Ctrl >");		ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Flip Horizontally");
 		ImGui::Text("<");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Rotate Anti-Clockwise");
@@ -145,6 +236,8 @@ void Viewer::ShowCheatSheetPopup(bool* popen)
 		ImGui::Text("R");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Refresh/Reload Image");
 		ImGui::Text("I");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Image Details");
 		ImGui::Text("T");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Tile");
+		ImGui::Text("K");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Cubemap Skybox");
+		ImGui::Text("Q");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Play/Stop Image Sequence");
 		ImGui::Text("M");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Menu Bar");
 		ImGui::Text("N");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Nav Bar");
 		ImGui::Text("S");			ImGui::SameLine(); ImGui::SetCursorPosX(col); ImGui::Text("Toggle Slideshow Counddown");
@@ -474,6 +567,26 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 	}
 	ImGui::Unindent();
 
+	ImGui::Separator();
+	ImGui::Text("Image Sequence");
+	ImGui::Indent();
+	ImGui::PushItemWidth(110);
+	ImGui::InputFloat("Frame Rate (fps)", &Config.SequenceFPS, 1.0f, 10.0f, "%.2f");
+	tMath::tiClamp(Config.SequenceFPS, 1.0f, 240.0f);
+	ImGui::InputInt("Frame Cache (MB)", &Config.SequenceCacheMB); ImGui::SameLine();
+	ShowHelpMark("Max memory for decoded frames, including those being decoded. Minimum 64 MB.");
+	tMath::tiClampMin(Config.SequenceCacheMB, 64);
+	ImGui::PopItemWidth();
+	ImGui::Checkbox("Drop Frames", &Config.SequenceDropFrames); ImGui::SameLine();
+	ShowHelpMark("Skip frames that aren't decoded in time to keep the frame rate. Otherwise every frame is shown.");
+	if (ImGui::Button("Reset Sequence"))
+	{
+		Config.SequenceFPS = 24.0f;
+		Config.SequenceDropFrames = true;
+		Config.SequenceCacheMB = 1024;
+	}
+	ImGui::Unindent();
+
 	ImGui::Separator();
 	ImGui::Text("Gamma");
 	ImGui::Indent();
@@ -489,11 +602,24 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 	ImGui::Indent();
 	ImGui::PushItemWidth(110);
 	ImGui::InputInt("Max Mem (MB)", &Config.MaxImageMemMB); ImGui::SameLine();
-	ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB.");
+	ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB. Used when adaptive memory is off or the system's free memory can't be read.");
 	tMath::tiClampMin(Config.MaxImageMemMB, 256);
+	ImGui::Checkbox("Adaptive Mem", &Config.AdaptiveImageMem); ImGui::SameLine();
+	ShowHelpMark("Grows the memory limit while the system has memory to spare and shrinks it, unloading images, when the system starts running short.");
+	ImGui::InputInt("Adaptive Cap (MB)", &Config.MaxAdaptiveMemMB); ImGui::SameLine();
+	ShowHelpMark("The adaptive memory limit never goes above this. Minimum 256 MB.");
+	tMath::tiClampMin(Config.MaxAdaptiveMemMB, 256);
+	ImGui::InputInt("Compressed Mem (MB)", &Config.MaxCompressedMemMB); ImGui::SameLine();
+	ShowHelpMark("Images unloaded to stay under the max mem are kept compressed, up to this much, so going back to them doesn't decode the file again. Zero disables.");
+	tMath::tiClampMin(Config.MaxCompressedMemMB, 0);
 	ImGui::InputInt("Max Cache Files", &Config.MaxCacheFiles); ImGui::SameLine();
 	ShowHelpMark("Maximum number of cache files that may be created. Minimum 200.");
 	tMath::tiClampMin(Config.MaxCacheFiles, 200);
+	ImGui::InputInt("Pixel Cache (MB)", &Config.MaxPixelCacheMB); ImGui::SameLine();
+	ShowHelpMark("Displayed files that are slow to decode have their full resolution pixels cached on disk, up to this much, so they open quickly next time. Least recently used files are removed when it fills up. Zero disables.");
+	tMath::tiClampMin(Config.MaxPixelCacheMB, 0);
+	ImGui::Checkbox("Compress Thumbnails", &Config.CompressThumbnails); ImGui::SameLine();
+	ShowHelpMark("Thumbnails are stored BC1/BC3 compressed in memory, on the GPU and in the cache, using about a quarter of the space. Applies to thumbnails generated after the change.");
 	if (!DeleteAllCacheFilesOnExit)
 	{
 		if (ImGui::Button("Clear Cache"))
@@ -666,6 +792,8 @@ void Viewer::NavLogBar::ClearLog()
 
 void Viewer::NavLogBar::AddLog(const char* fmt, ...)
 {
+	// Background jobs like Save All print from worker threads.
+	std::lock_guard<std::mutex> lock(LogMutex);
 	int oldSize = LogBuf.size();
 	va_list args;
 	va_start(args, fmt);
@@ -734,9 +862,7 @@ void Viewer::NavLogBar::Draw()
 
 void Viewer::NavLogBar::DrawLog()
 {
-	if (ImGui::Button("Clear"))
-		ClearLog();
-
+	bool clear = ImGui::Button("Clear");
 	ImGui::SameLine();
 	bool copy = ImGui::Button("Copy");
 	ImGui::SameLine();
@@ -746,6 +872,10 @@ void Viewer::NavLogBar::DrawLog()
 	if (copy)
 		ImGui::LogToClipboard();
 
+	std::lock_guard<std::mutex> lock(LogMutex);
+	if (clear)
+		ClearLog();
+
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, tVector2(0, 0));
 	const char* buf = LogBuf.begin();
 	const char* bufEnd = LogBuf.end();
@@ -793,3 +923,97 @@ void Viewer::NavLogBar::DrawLog()
 	LogScrollToBottom = false;
 	ImGui::EndChild();
 }
+
+
+void Viewer::ShowProfilerWindow(bool* popen)
+{
+	tVector2 windowPos = GetDialogOrigin(4);
+	ImGui::SetNextWindowPos(windowPos, ImGuiCond_FirstUseEver);
+	ImGui::SetNextWindowSize(tVector2(460, 520), ImGuiCond_FirstUseEver);
+
+	if (!ImGui::Begin("Profiler", popen))
+	{
+		ImGui::End();
+		return;
+	}
+
+	// Take a snapshot so recording threads aren't held up while we build UI.
+	static ProfileZoneHistory zones[int(ProfileZone::NumZones)];
+	ProfileGetHistory(zones);
+
+	for (int z = 0; z < int(ProfileZone::NumZones); z++)
+	{
+		const ProfileZoneHistory& history = zones[z];
+		ProfileZone zone = ProfileZone(z);
+		bool isJob = (zone >= ProfileZone::Decode);
+
+		// Per-frame totals for main thread zones. Worker jobs aren't frame-aligned so we show their individual
+		// durations instead.
+		const float* values = isJob ? history.JobMS : history.FrameMS;
+		int numValues = isJob ? ProfileJobHistorySize : ProfileHistorySize;
+		int offset = isJob ? history.JobHead : history.FrameHead;
+
+		float sum = 0.0f;
+		float maxMS = 0.0f;
+		for (int v = 0; v < numValues; v++)
+		{
+			sum += values[v];
+			maxMS = tMath::tMax(maxMS, values[v]);
+		}
+		float avgMS = sum / float(numValues);
+		float lastMS = values[(offset + numValues - 1) % numValues];
+
+		tString overlay;
+		tsPrintf(overlay, "last %.2f avg %.2f max %.2f ms", lastMS, avgMS, maxMS);
+		tString label;
+		tsPrintf(label, "%s%s", GetProfileZoneName(zone), isJob ? " (per job)" : "");
+		ImGui::Text("%s", label.Chars());
+		if (isJob)
+		{
+			tString countStr;
+			tsPrintf(countStr, "%'d total", int(history.TotalCount));
+			ImGui::SameLine();
+			ImGui::TextDisabled("%s", countStr.Chars());
+		}
+
+		ImGui::PushID(z);
+		ImGui::PlotHistogram
+		(
+			"##History", values, numValues, offset, overlay.Chars(),
+			0.0f, tMath::tMax(maxMS*1.1f, 1.0f), tVector2(ImGui::GetContentRegionAvail().x, 32.0f)
+		);
+		ImGui::PopID();
+	}
+
+	ImGui::Separator();
+	ImGui::Text("Thumbnail Atlas: %d Pages %d Slots Used", Image::ThumbAtlas.GetNumPages(), Image::ThumbAtlas.GetNumSlotsUsed());
+
+	MemoryStatus mem = GetMemoryStatus();
+	if (mem.Valid)
+	{
+		ImGui::Text("System Mem: %.0f MB Free of %.0f MB  Pressure %s", float(mem.AvailableBytes)/(1024.0f*1024.0f), float(mem.TotalBytes)/(1024.0f*1024.0f), mem.UnderPressure ? "Yes" : "No");
+		if (Config.AdaptiveImageMem)
+			ImGui::Text("Image Mem Budget: %.0f MB", float(mem.BudgetBytes)/(1024.0f*1024.0f));
+	}
+
+	BufferPool::Stats pool = PixelBuffers.GetStats();
+	float reusePercent = pool.NumAcquires ? 100.0f * float(pool.NumReused) / float(pool.NumAcquires) : 0.0f;
+	ImGui::Text("Buffer Pool: %.0f%% Reused  %.1f MB Used  %.1f MB Cached  %.1f MB Peak", reusePercent, float(pool.InUseBytes)/(1024.0f*1024.0f), float(pool.CachedBytes)/(1024.0f*1024.0f), float(pool.PeakBytes)/(1024.0f*1024.0f));
+
+	static tString lastExport;
+	if (ImGui::Button("Export Chrome Trace"))
+	{
+		tString traceFile = tSystem::tGetUpDir(Image::ThumbCacheDir) + "ProfileTrace.json";
+		if (ProfileExportChromeTrace(traceFile))
+			lastExport = traceFile;
+		else
+			lastExport = "Export failed.";
+	}
+	if (!lastExport.IsEmpty())
+	{
+		ImGui::SameLine();
+		ImGui::TextDisabled("%s", lastExport.Chars());
+	}
+
+	ImGui::End();
+}
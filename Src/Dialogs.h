@@ -13,6 +13,7 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #pragma once
+#include <mutex>
 
 
 namespace Viewer
@@ -22,6 +23,7 @@ namespace Viewer
 	void ShowAboutPopup(bool* popen);
 	void ShowPreferencesWindow(bool* popen);
 	void ShowPropertyEditorWindow(bool* popen);
+	void ShowProfilerWindow(bool* popen);
 	void ColourCopyAs();
 	void DoDeleteFileModal();
 	void DoDeleteFileNoRecycleModal();
@@ -38,10 +40,11 @@ namespace Viewer
 		void AddLog(const char* fmt, ...) IM_FMTARGS(2);
 
 	private:
-		void ClearLog();
+		void ClearLog();				// Caller must hold the log mutex unless no other thread can be logging yet.
 		void DrawLog();
 
 		bool ShowLog = false;
+		std::mutex LogMutex;
 		ImGuiTextBuffer LogBuf;
 		ImGuiTextFilter LogFilter;
 
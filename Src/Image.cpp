@@ -14,6 +14,10 @@
 
 #include <mutex>
 #include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <climits>
+#include <filesystem>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>				// Include glfw3.h after our OpenGL definitions.
 #include <Math/tHash.h>
@@ -25,22 +29,83 @@
 #include <System/tFile.h>
 #include <System/tTime.h>
 #include <System/tMachine.h>
-#include <System/tChunk.h>
 #include "Image.h"
 #include "Settings.h"
+#include "Profile.h"
+#include "PixelOps.h"
+#include "Resample.h"
+#include "BufferPool.h"
+#include "BlockCompress.h"
+#include "ContentKey.h"
 using namespace tStd;
 using namespace tSystem;
 using namespace tImage;
 using namespace tMath;
 using namespace Viewer;
 int Image::ThumbnailNumThreadsRunning = 0;
+std::atomic<int64> Image::CompressedSizeTotal(0);
+std::vector<Image*> Image::ThumbnailWorkers;
 tString Image::ThumbCacheDir;
-namespace Viewer { extern Settings Config; }
+tString Image::PixelCacheDir;
+std::atomic<int64> Image::PixelCacheBytes(-1);
+namespace Viewer
+{
+	extern Settings Config;
+
+	// Pixel cache files are this header, a PixelCachePart for each part, and then the pixels of each part exactly as
+	// they are in the tPicture. Being raw means reading one back is a single copy.
+	struct PixelCacheHeader
+	{
+		uint32 ID;
+		int32 NumParts;
+		int32 SrcPixelFormat;
+		int32 Reserved;
+	};
+	struct PixelCachePart
+	{
+		int32 Width;
+		int32 Height;
+		float Duration;
+		int32 SrcPixelFormat;
+	};
+	const uint32 PixelCacheID					= 0x58505654;		// TVPX.
+	const int PixelCacheMaxParts				= 4096;
+
+	// Only files that take at least this long to decode, and longer than reading their pixels back is estimated to
+	// take, are cached. Most jpg and png files decode well under the minimum.
+	const double PixelCacheMinDecodeSeconds		= 0.25;
+	const double PixelCacheReadMBPerSec			= 500.0;
+
+	// Once the cache is over budget it's trimmed to this fraction of it, so every write doesn't scan the cache dir.
+	const int64 PixelCacheTrimPercent			= 80;
+
+	// Thumbnail cache files are this header followed by the data. BC1 and BC3 data covers the bordered atlas slot.
+	// RGBA data is Viewer::Compress output, stored as the number of blocks, the block ends, and then the bytes.
+	struct ThumbCacheHeader
+	{
+		uint32 ID;
+		int32 Format;
+		int32 Width;
+		int32 Height;
+		int32 NumBytes;
+	};
+	enum class ThumbCacheFormat
+	{
+		RGBA,
+		BC1,
+		BC3
+	};
+	const uint32 ThumbCacheID					= 0x48545654;		// TVTH.
+}
 
 
 const int Image::ThumbWidth			= 256;
 const int Image::ThumbHeight		= 144;
 const int Image::ThumbMinDispWidth	= 64;
+ThumbnailAtlas Image::ThumbAtlas(Image::ThumbWidth, Image::ThumbHeight);
+bool Image::ThumbCompressionSupported = true;
+std::atomic<int64> Image::ThumbnailPictureBytes(0);
+ThreadPool Image::EditPool(int(std::thread::hardware_concurrency()));
 
 
 Image::Image() :
@@ -84,9 +149,12 @@ Image::~Image()
 	{
 		ThumbnailNumThreadsRunning--;
 		tiClampMin(ThumbnailNumThreadsRunning, 0);
+		ThumbnailWorkers.erase(std::remove(ThumbnailWorkers.begin(), ThumbnailWorkers.end(), this), ThumbnailWorkers.end());
 	}
 
-	// Free GPU image mem and texture IDs.
+	// Free GPU image mem and texture IDs. Freeing the atlas slot makes no GL calls.
+	ThumbAtlas.Free(ThumbnailSlot, this);
+	FreeThumbnailPicture();
 	Unload(true);
 }
 
@@ -116,22 +184,33 @@ bool Image::Load(const tString& filename)
 }
 
 
-bool Image::Load()
+bool Image::LoadFile(bool writePixelCache)
 {
-	if (IsLoaded() && !Dirty)
+	if (IsLoaded())
 	{
 		LoadedTime = tSystem::tGetTime();
 		return true;
 	}
 
+	if (IsCompressed() && LoadCompressed())
+		return true;
+
 	if (Filetype == tFileType::Unknown)
 		return false;
 
+	ProfileScope profile(ProfileZone::Decode);
 	Info.SrcPixelFormat = tPixelFormat::Invalid;
-	bool success = false;
+	tString pixelCacheFile = GetPixelCacheFile();
+	bool success = !pixelCacheFile.IsEmpty() && LoadPixelCache(pixelCacheFile);
+	bool decoded = !success;
+	double decodeStartTime = ProfileGetTime();
 	try
 	{
-		if (Filetype == tSystem::tFileType::DDS)
+		if (success)
+		{
+			// Nothing to decode as the pixels came from the pixel cache.
+		}
+		else if (Filetype == tSystem::tFileType::DDS)
 		{
 			success = DDSCubemap.Load(Filename);
 			if (success)
@@ -241,6 +320,15 @@ bool Image::Load()
 	if (!success)
 		return false;
 
+	// Files that are slow to decode, and took longer than it should take to read their pixels back, go in the cache.
+	if (writePixelCache && decoded && !pixelCacheFile.IsEmpty())
+	{
+		double decodeSeconds = ProfileGetTime() - decodeStartTime;
+		double readSeconds = double(GetMemSizeBytes()) / (PixelCacheReadMBPerSec*1024.0*1024.0);
+		if ((decodeSeconds >= PixelCacheMinDecodeSeconds) && (decodeSeconds > readSeconds))
+			SavePixelCache(pixelCacheFile);
+	}
+
 	if (Filetype == tSystem::tFileType::DDS)
 	{
 		if (DDSCubemap.IsValid())
@@ -251,20 +339,42 @@ bool Image::Load()
 
 	LoadedTime = tSystem::tGetTime();
 
-	// Fill in rest of info struct.
-	Info.Opaque				= IsOpaque();
+	// Fill in rest of info struct. The analysis is of the edited pixels.
+	ReplayEdits();
+	AnalysePixels();
 	Info.FileSizeBytes		= tSystem::tGetFileSize(Filename);
 	Info.MemSizeBytes		= GetMemSizeBytes();
+	PixelsVersion++;
+	return true;
+}
 
-	// Create alt image if possible.
-	if (DDSCubemap.IsValid())
-		CreateAltPictureFromDDS_Cubemap();
-
-	else if (DDSTexture2D.IsValid() && (DDSTexture2D.GetNumMipmaps() > 1))
-		CreateAltPictureFromDDS_2DMipmaps();
 
-	ClearDirty();
-	return true;
+void Image::TakePictures(Image& src)
+{
+	tAssert(!IsLoaded());
+	FreeCompressed();
+	src.UpdateEdits(true);
+	src.WaitRegionStats();
+	src.Unbind();
+	src.PixelsVersion++;
+
+	while (tPicture* picture = src.Pictures.Remove())
+		Pictures.Append(picture);
+	src.DDSTexture2D.Clear();
+	src.DDSCubemap.Clear();
+	src.AltPictureEnabled = false;
+	src.LoadedTime = -1.0f;
+
+	Info = src.Info;
+	src.Info.MemSizeBytes = 0;
+	LoadedTime = tSystem::tGetTime();
+	if (EditCount > 0)
+	{
+		ReplayEdits();
+		AnalysePixels();
+		Info.MemSizeBytes = GetMemSizeBytes();
+	}
+	PixelsVersion++;
 }
 
 
@@ -274,110 +384,331 @@ int Image::GetMemSizeBytes() const
 	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
 		numBytes += pic->GetNumPixels() * sizeof(tPixel);
 
-	numBytes += AltPicture.IsValid() ? AltPicture.GetNumPixels()*sizeof(tPixel) : 0;
 	return numBytes;
 }
 
 
-void Image::CreateAltPictureFromDDS_2DMipmaps()
+bool Image::Unload(bool force)
 {
-	int width = 0;
-	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
-		width += layer->GetWidth();
-	int height = GetHeight();
+	FreeCompressed();
+	if (force)
+	{
+		EditStack.clear();
+		EditCount = 0;
+		SavedEditCount = 0;
+	}
+
+	if (!IsLoaded())
+		return true;
+
+	// The edit and stats workers read the pictures.
+	UpdateEdits(true);
+	WaitRegionStats();
+	PixelsVersion++;
+
+	Unbind();
+	DDSTexture2D.Clear();
+	DDSCubemap.Clear();
+	AltPictureEnabled = false;
+	Pictures.Clear();
+	Info.MemSizeBytes = 0;
 
-	AltPicture.Set(width, height, tPixel::transparent);
-	int originY = 0;
-	int originX = 0;
-	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
+	LoadedTime = -1.0f;
+	return true;
+}
+
+
+bool Image::UnloadCompressed()
+{
+	// An undo may leave an edit pending with no edits applied.
+	UpdateEdits(true);
+	if (!IsLoaded() || (Filetype == tFileType::DDS) || (EditCount > 0))
 	{
-		for (int y = 0; y < layer->GetHeight(); y++)
-		{
-			for (int x = 0; x < layer->GetWidth(); x++)
-			{
-				tPixel pixel = layer->GetPixel(x, y);
-				AltPicture.SetPixel(originX + x, y, pixel);
-			}
-		}
-		originX += layer->GetWidth();
+		Unload();
+		return false;
+	}
+
+	std::vector<CompressedPicture> compressedPictures(Pictures.Count());
+	int64 compressedSize = 0;
+	int part = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), part++)
+	{
+		CompressedPicture& compressed = compressedPictures[part];
+		compressed.Width = picture->GetWidth();
+		compressed.Height = picture->GetHeight();
+		compressed.Duration = picture->Duration;
+		compressed.SrcPixelFormat = picture->SrcPixelFormat;
+		Viewer::Compress(compressed.Pixels, (const uint8*)picture->GetPixelPointer(), picture->GetNumPixels()*sizeof(tPixel));
+		compressedSize += compressed.Pixels.GetSize();
 	}
+
+	Unload();
+	CompressedPictures.swap(compressedPictures);
+	CompressedSize = compressedSize;
+	CompressedSizeTotal += compressedSize;
+	CompressedTime = tSystem::tGetTime();
+	return true;
 }
 
 
-void Image::CreateAltPictureFromDDS_Cubemap()
+bool Image::LoadCompressed()
 {
-	int width = Pictures.First()->GetWidth();
-	int height = Pictures.First()->GetHeight();
+	ProfileScope profile(ProfileZone::Decode);
+	bool ok = true;
+	for (CompressedPicture& compressed : CompressedPictures)
+	{
+		int numPixels = compressed.Width * compressed.Height;
+		tPixel* pixels = new tPixel[numPixels];
+		if (!Viewer::Decompress((uint8*)pixels, numPixels*sizeof(tPixel), compressed.Pixels))
+		{
+			delete[] pixels;
+			ok = false;
+			break;
+		}
 
-	AltPicture.Set(width*4, height*3, tPixel::transparent);
-	int originX, originY;
-	
-	// PosZ
-	tPicture* pic = Pictures.First();
-	originX = width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+		tPicture* picture = new tPicture();
+		picture->Set(compressed.Width, compressed.Height, pixels, false);
+		picture->Filename = Filename;
+		picture->Duration = compressed.Duration;
+		picture->SrcPixelFormat = compressed.SrcPixelFormat;
+		Pictures.Append(picture);
+	}
 
-	// NegZ
-	pic = pic->Next();
-	originX = 3*width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	// If something went wrong the file is loaded instead.
+	FreeCompressed();
+	if (!ok)
+	{
+		Pictures.Clear();
+		return false;
+	}
 
-	// PosX
-	pic = pic->Next();
-	originX = 2*width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	// The info is still that of the unedited pixels. Edits can only have been recorded since if the image was edited
+	// while unloaded.
+	LoadedTime = tSystem::tGetTime();
+	if (EditCount > 0)
+	{
+		ReplayEdits();
+		AnalysePixels();
+	}
+	Info.MemSizeBytes = GetMemSizeBytes();
+	PixelsVersion++;
+	return true;
+}
 
-	// NegX
-	pic = pic->Next();
-	originX = 0; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
 
-	// PosY
-	pic = pic->Next();
-	originX = width; originY = 2*height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+void Image::FreeCompressed()
+{
+	if (!IsCompressed())
+		return;
 
-	// NegY
-	pic = pic->Next();
-	originX = width; originY = 0;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	CompressedSizeTotal -= CompressedSize;
+	CompressedSize = 0;
+	CompressedTime = -1.0f;
+	std::vector<CompressedPicture>().swap(CompressedPictures);
 }
 
 
-bool Image::Unload(bool force)
+tString Image::GetPixelCacheFile() const
 {
-	if (!IsLoaded())
-		return true;
+	// Dds files are already fast to load and need their textures.
+	if (PixelCacheDir.IsEmpty() || (Config.MaxPixelCacheMB <= 0) || (Filetype == tFileType::DDS) || (Filetype == tFileType::Unknown))
+		return tString();
+
+	// Keyed by file contents as thumbnails are, so the key is usually in the index already and renamed, moved and copied
+	// files still find their pixels. The load params change the pixels of hdr and exr files.
+	tuint256 contentKey = 0;
+	if (!GetContentKey(contentKey, Filename))
+		return tString();
+
+	int pixelCacheVersion = 2;
+	float params[] =
+	{
+		LoadParams.GammaValue, float(LoadParams.HDR_Exposure), LoadParams.EXR_Exposure,
+		LoadParams.EXR_Defog, LoadParams.EXR_KneeLow, LoadParams.EXR_KneeHigh
+	};
+	tuint256 hash = tHashData256((uint8*)&pixelCacheVersion, sizeof(pixelCacheVersion));
+	hash = tHashData256((uint8*)&contentKey, sizeof(contentKey), hash);
+	hash = tHashData256((uint8*)params, sizeof(params), hash);
+	tString pixelCacheFile;
+	tsPrintf(pixelCacheFile, "%s%032|256X.pix", PixelCacheDir.Chars(), hash);
+	return pixelCacheFile;
+}
+
 
-	// Not allowed to unload if dirty (modified).
-	if (Dirty && !force)
+bool Image::LoadPixelCache(const tString& file)
+{
+	if (!tFileExists(file))
 		return false;
 
-	Unbind();
-	DDSTexture2D.Clear();
-	DDSCubemap.Clear();
-	AltPicture.Clear();
-	AltPictureEnabled = false;
-	Pictures.Clear();
-	Info.MemSizeBytes = 0;
+	ProfileScope profile(ProfileZone::CacheIO);
+	tFileHandle handle = tOpenFile(file.Chars(), "rb");
+	if (!handle)
+		return false;
 
-	LoadedTime = -1.0f;
+	PixelCacheHeader header;
+	bool ok =
+		(tReadFile(handle, &header, sizeof(header)) == sizeof(header)) && (header.ID == PixelCacheID) &&
+		(header.NumParts > 0) && (header.NumParts <= PixelCacheMaxParts);
+
+	std::vector<PixelCachePart> parts(ok ? header.NumParts : 0);
+	int partsSize = int(parts.size() * sizeof(PixelCachePart));
+	ok = ok && (tReadFile(handle, parts.data(), partsSize) == partsSize);
+	for (int p = 0; ok && (p < int(parts.size())); p++)
+	{
+		const PixelCachePart& part = parts[p];
+		int64 numBytes = int64(part.Width) * int64(part.Height) * sizeof(tPixel);
+		ok = (part.Width > 0) && (part.Height > 0) && (numBytes <= INT_MAX);
+		if (!ok)
+			break;
+
+		tPixel* pixels = new tPixel[part.Width * part.Height];
+		ok = (tReadFile(handle, pixels, int(numBytes)) == int(numBytes));
+		if (!ok)
+		{
+			delete[] pixels;
+			break;
+		}
+
+		tPicture* picture = new tPicture();
+		picture->Set(part.Width, part.Height, pixels, false);
+		picture->Filename = Filename;
+		picture->Duration = part.Duration;
+		picture->SrcPixelFormat = tPixelFormat(part.SrcPixelFormat);
+		Pictures.Append(picture);
+	}
+	tCloseFile(handle);
+
+	// A damaged file is removed so it gets written again.
+	if (!ok)
+	{
+		Pictures.Clear();
+		tDeleteFile(file);
+		return false;
+	}
+
+	// The trim keeps the most recently used files, so a file counts as modified each time it is read.
+	Info.SrcPixelFormat = tPixelFormat(header.SrcPixelFormat);
+	std::error_code error;
+	std::filesystem::last_write_time(std::filesystem::path(file.Chars()), std::filesystem::file_time_type::clock::now(), error);
 	return true;
 }
 
 
+void Image::SavePixelCache(const tString& file) const
+{
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+		if (int64(picture->GetNumPixels()) * sizeof(tPixel) > INT_MAX)
+			return;
+
+	if ((Pictures.Count() > PixelCacheMaxParts) || !tDirExists(PixelCacheDir))
+		return;
+
+	// Other threads may be loading the same file. Each writes its own temporary file and the rename makes a complete
+	// file appear all at once.
+	ProfileScope profile(ProfileZone::CacheIO);
+	static std::atomic<int> tempFileCount(0);
+	tString tempFile;
+	tsPrintf(tempFile, "%s.%d.tmp", file.Chars(), tempFileCount++);
+	tFileHandle handle = tOpenFile(tempFile.Chars(), "wb");
+	if (!handle)
+		return;
+
+	PixelCacheHeader header;
+	header.ID = PixelCacheID;
+	header.NumParts = Pictures.Count();
+	header.SrcPixelFormat = int32(Info.SrcPixelFormat);
+	header.Reserved = 0;
+	int64 fileBytes = sizeof(header);
+	bool ok = (tWriteFile(handle, &header, sizeof(header)) == sizeof(header));
+	for (tPicture* picture = Pictures.First(); ok && picture; picture = picture->Next())
+	{
+		PixelCachePart part;
+		part.Width = picture->GetWidth();
+		part.Height = picture->GetHeight();
+		part.Duration = picture->Duration;
+		part.SrcPixelFormat = int32(picture->SrcPixelFormat);
+		ok = (tWriteFile(handle, &part, sizeof(part)) == sizeof(part));
+		fileBytes += sizeof(part);
+	}
+	for (tPicture* picture = Pictures.First(); ok && picture; picture = picture->Next())
+	{
+		int numBytes = picture->GetNumPixels() * sizeof(tPixel);
+		ok = (tWriteFile(handle, picture->GetPixelPointer(), numBytes) == numBytes);
+		fileBytes += numBytes;
+	}
+	tCloseFile(handle);
+
+	// Rename won't replace an existing file on Windows. A stale entry that is rewritten has to go first.
+	#ifdef PLATFORM_WINDOWS
+	if (ok)
+		tDeleteFile(file);
+	#endif
+	if (!ok || (std::rename(tempFile.Chars(), file.Chars()) != 0))
+	{
+		tDeleteFile(tempFile);
+		return;
+	}
+
+	// The budget is kept during the session rather than only on exit. The file just written is the most recently used
+	// so it stays unless it's bigger than the budget on its own.
+	int64 maxBytes = int64(Config.MaxPixelCacheMB) * 1024 * 1024;
+	int64 cacheBytes = (PixelCacheBytes < 0) ? -1 : (PixelCacheBytes += fileBytes);
+	if ((cacheBytes < 0) || (cacheBytes > maxBytes))
+		TrimPixelCache((cacheBytes < 0) ? maxBytes : maxBytes * PixelCacheTrimPercent / 100);
+}
+
+
+int Image::TrimPixelCache(int64 maxBytes)
+{
+	if (PixelCacheDir.IsEmpty() || !tDirExists(PixelCacheDir))
+		return 0;
+
+	// Temporary files are only left behind by writes that didn't finish.
+	int numRemoved = 0;
+	tList<tStringItem> tempFiles;
+	tFindFiles(tempFiles, PixelCacheDir, "tmp");
+	for (tStringItem* tempFile = tempFiles.First(); tempFile; tempFile = tempFile->Next())
+		if (tDeleteFile(*tempFile))
+			numRemoved++;
+
+	struct CacheFile
+	{
+		tString Name;
+		std::time_t Time;
+		int64 Size;
+	};
+	std::vector<CacheFile> cacheFiles;
+	tList<tStringItem> files;
+	tFindFiles(files, PixelCacheDir, "pix");
+	for (tStringItem* file = files.First(); file; file = file->Next())
+	{
+		tFileInfo info;
+		if (tGetFileInfo(info, *file))
+			cacheFiles.push_back({ *file, info.ModificationTime, int64(info.FileSize) });
+	}
+
+	// Most recently used first. Everything after the budget is used up goes.
+	std::sort
+	(
+		cacheFiles.begin(), cacheFiles.end(),
+		[](const CacheFile& a, const CacheFile& b) { return a.Time > b.Time; }
+	);
+	int64 usedBytes = 0;
+	int64 keptBytes = 0;
+	for (const CacheFile& cacheFile : cacheFiles)
+	{
+		usedBytes += cacheFile.Size;
+		if ((usedBytes > maxBytes) && tDeleteFile(cacheFile.Name))
+			numRemoved++;
+		else
+			keptBytes += cacheFile.Size;
+	}
+
+	PixelCacheBytes = keptBytes;
+	return numRemoved;
+}
+
+
 void Image::Unbind()
 {
 	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
@@ -389,23 +720,35 @@ void Image::Unbind()
 		}
 	}
 
-	if (TexIDAlt != 0)
+	if (TexIDCubemap != 0)
 	{
-		glDeleteTextures(1, &TexIDAlt);
-		TexIDAlt = 0;
+		glDeleteTextures(1, &TexIDCubemap);
+		TexIDCubemap = 0;
 	}
 }
 
 
-bool Image::IsOpaque() const
+void Image::AnalysePixels()
 {
+	Info.Stats = PixelStats();
+	tPicture* picture = Pictures.First();
+	if (picture && picture->IsValid())
+		PixelRegionStats(*picture, 0, 0, picture->GetWidth(), picture->GetHeight(), Info.Stats);
+
+	// The other sides of a cubemap are not analysed so the dds is asked instead.
 	if (DDSCubemap.IsValid())
-		return DDSCubemap.AllSidesOpaque();
+		Info.Opaque = DDSCubemap.AllSidesOpaque();
+	else
+		Info.Opaque = (Info.Stats.NumPixels == 0) || (Info.Stats.Min[3] == 255);
+}
 
-	if (DDSTexture2D.IsValid())
-		return DDSTexture2D.IsOpaque();
 
-	tPicture* picture = Pictures.First();
+bool Image::IsOpaque() const
+{
+	if ((PartNum == 0) || DDSCubemap.IsValid())
+		return Info.Opaque;
+
+	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->IsOpaque();
 
@@ -413,14 +756,137 @@ bool Image::IsOpaque() const
 }
 
 
+void Image::GetAltSize(int& width, int& height) const
+{
+	width = 0;
+	height = 0;
+	tPicture* first = Pictures.First();
+	if (!first)
+		return;
+
+	if (DDSCubemap.IsValid())
+	{
+		width = first->GetWidth()*4;
+		height = first->GetHeight()*3;
+		return;
+	}
+
+	for (tPicture* pic = first; pic; pic = pic->Next())
+	{
+		width += pic->GetWidth();
+		height = tMax(height, pic->GetHeight());
+	}
+}
+
+
+bool Image::GetAltQuad(int index, int& x, int& y, int& w, int& h) const
+{
+	tPicture* pic = GetPicture(index);
+	if (!AltPictureEnabled || !pic || (index < 0))
+		return false;
+
+	w = pic->GetWidth();
+	h = pic->GetHeight();
+	if (DDSCubemap.IsValid())
+	{
+		// The sides are in the order ConvertCubemapToPicture adds them and are laid out as a horizontal cross.
+		const int sideCells[int(tCubemap::tSide::NumSides)][2] =
+		{
+			{ 1, 1 },		// PosZ
+			{ 3, 1 },		// NegZ
+			{ 2, 1 },		// PosX
+			{ 0, 1 },		// NegX
+			{ 1, 2 },		// PosY
+			{ 1, 0 }		// NegY
+		};
+		if (index >= int(tCubemap::tSide::NumSides))
+			return false;
+
+		tPicture* first = Pictures.First();
+		x = sideCells[index][0] * first->GetWidth();
+		y = sideCells[index][1] * first->GetHeight();
+		return true;
+	}
+
+	// Mipmaps are laid out left to right along the bottom.
+	x = 0;
+	y = 0;
+	for (tPicture* prev = Pictures.First(); prev != pic; prev = prev->Next())
+		x += prev->GetWidth();
+	return true;
+}
+
+
+uint64 Image::BindAltQuad(int index)
+{
+	if (!AltPictureEnabled)
+		return 0;
+
+	return BindPicture(GetPicture(index));
+}
+
+
+uint64 Image::BindCubemap()
+{
+	if (!DDSCubemap.IsValid() || (Pictures.Count() < int(tCubemap::tSide::NumSides)))
+		return 0;
+
+	if (TexIDCubemap != 0)
+	{
+		glBindTexture(GL_TEXTURE_CUBE_MAP, TexIDCubemap);
+		return TexIDCubemap;
+	}
+
+	ProfileScope profile(ProfileZone::GLUpload);
+	glGenTextures(1, &TexIDCubemap);
+	if (TexIDCubemap == 0)
+		return 0;
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, TexIDCubemap);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	// GL wants the first row of each side at the top, while pictures start at the bottom, so each side is flipped on
+	// the way up. The pictures are in PosZ, NegZ, PosX, NegX, PosY, NegY order.
+	const GLenum sideTargets[int(tCubemap::tSide::NumSides)] =
+	{
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+		GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+	};
+	int side = 0;
+	for (tPicture* pic = Pictures.First(); pic && (side < int(tCubemap::tSide::NumSides)); pic = pic->Next(), side++)
+	{
+		// The flipped copy is only needed until GL has it, so it comes from the pool.
+		int width = pic->GetWidth();
+		int height = pic->GetHeight();
+		const tPixel* src = pic->GetPixelPointer();
+		tPixel* flipped = PixelBuffers.Acquire<tPixel>(width*height);
+		for (int y = 0; y < height; y++)
+			tStd::tMemcpy(flipped + y*width, src + (height-1-y)*width, width*sizeof(tPixel));
+		glTexImage2D(sideTargets[side], 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, flipped);
+		PixelBuffers.Release(flipped);
+	}
+
+	return TexIDCubemap;
+}
+
+
 int Image::GetWidth() const
 {
-	if (AltPicture.IsValid() && AltPictureEnabled)
-		return AltPicture.GetWidth();
+	if (AltPictureEnabled)
+	{
+		int width, height;
+		GetAltSize(width, height);
+		return width;
+	}
 
+	// While a rotation is pending the pictures still have the old orientation.
 	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
-		return picture->GetWidth();
+		return IsEditTransposed() ? picture->GetHeight() : picture->GetWidth();
 
 	return 0;
 }
@@ -428,12 +894,16 @@ int Image::GetWidth() const
 
 int Image::GetHeight() const
 {
-	if (AltPicture.IsValid() && AltPictureEnabled)
-		return AltPicture.GetHeight();
+	if (AltPictureEnabled)
+	{
+		int width, height;
+		GetAltSize(width, height);
+		return height;
+	}
 
 	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
-		return picture->GetHeight();
+		return IsEditTransposed() ? picture->GetWidth() : picture->GetHeight();
 
 	return 0;
 }
@@ -441,12 +911,28 @@ int Image::GetHeight() const
 
 tColouri Image::GetPixel(int x, int y) const
 {
-	if (AltPicture.IsValid() && AltPictureEnabled)
-		return AltPicture.GetPixel(x, y);
+	if (AltPictureEnabled)
+	{
+		int qx, qy, qw, qh;
+		for (int q = 0; GetAltQuad(q, qx, qy, qw, qh); q++)
+			if ((x >= qx) && (x < qx+qw) && (y >= qy) && (y < qy+qh))
+				return GetPicture(q)->GetPixel(x-qx, y-qy);
+		return tColouri::transparent;
+	}
 
 	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
+	{
+		// Same mapping as GetTextureUV but in pixels.
+		if (IsEditPending() && !AltPictureEnabled)
+		{
+			const int* m = EditUVMat;
+			int srcX = m[0]*x + m[1]*y + (((m[0] + m[1]) < 0) ? picture->GetWidth()-1 : 0);
+			int srcY = m[2]*x + m[3]*y + (((m[2] + m[3]) < 0) ? picture->GetHeight()-1 : 0);
+			return picture->GetPixel(srcX, srcY);
+		}
 		return picture->GetPixel(x, y);
+	}
 
 	// Generally the PictureImage should always be valid. When dds files (tTextures) are loaded, they get
 	// uncompressed into valid PictureImage files so the pixel info can be read.
@@ -456,28 +942,282 @@ tColouri Image::GetPixel(int x, int y) const
 
 void Image::Rotate90(bool antiClockWise)
 {
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Rotate90(antiClockWise);
-
-	Dirty = true;
+	Edit edit;
+	edit.Type = antiClockWise ? Edit::EditType::RotateACW : Edit::EditType::RotateCW;
+	AddEdit(edit);
 }
 
 
 void Image::Flip(bool horizontal)
 {
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Flip(horizontal);
-
-	Dirty = true;
+	Edit edit;
+	edit.Type = horizontal ? Edit::EditType::FlipH : Edit::EditType::FlipV;
+	AddEdit(edit);
 }
 
 
 void Image::Crop(int newWidth, int newHeight, int originX, int originY)
 {
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Crop(newWidth, newHeight, originX, originY);
+	Edit edit;
+	edit.Type = Edit::EditType::Crop;
+	edit.Width = newWidth;
+	edit.Height = newHeight;
+	edit.OriginX = originX;
+	edit.OriginY = originY;
+	AddEdit(edit);
+}
 
-	Dirty = true;
+
+void Image::Undo()
+{
+	if (!CanUndo())
+		return;
+
+	Edit edit = EditStack[--EditCount];
+	if (!IsLoaded())
+		return;
+
+	Edit inverse = edit;
+	switch (edit.Type)
+	{
+		case Edit::EditType::RotateACW:	inverse.Type = Edit::EditType::RotateCW;	break;
+		case Edit::EditType::RotateCW:	inverse.Type = Edit::EditType::RotateACW;	break;
+		case Edit::EditType::FlipH:
+		case Edit::EditType::FlipV:													break;
+
+		case Edit::EditType::Crop:
+			// Cropped pixels are gone so start again from the file.
+			Unload();
+			Load();
+			return;
+	}
+	ApplyEdit(inverse);
+}
+
+
+void Image::Redo()
+{
+	if (!CanRedo())
+		return;
+
+	const Edit& edit = EditStack[EditCount++];
+	if (IsLoaded())
+		ApplyEdit(edit);
+}
+
+
+void Image::CopyEdits(const Image& src)
+{
+	tAssert(!IsLoaded());
+	LoadParams = src.LoadParams;
+	EditStack = src.EditStack;
+	EditCount = src.EditCount;
+	SavedEditCount = src.SavedEditCount;
+}
+
+
+void Image::AddEdit(const Edit& edit)
+{
+	if (!IsLoaded())
+		return;
+
+	EditStack.resize(EditCount);
+	if (SavedEditCount > EditCount)
+		SavedEditCount = -1;
+
+	EditStack.push_back(edit);
+	EditCount++;
+	ApplyEdit(edit);
+}
+
+
+Image::EditOp Image::GetEditOp(const Edit& edit)
+{
+	switch (edit.Type)
+	{
+		case Edit::EditType::RotateACW:
+			return [](const tPicture& pic, int& w, int& h) { return PixelRotate90(pic, true, w, h); };
+
+		case Edit::EditType::RotateCW:
+			return [](const tPicture& pic, int& w, int& h) { return PixelRotate90(pic, false, w, h); };
+
+		case Edit::EditType::FlipH:
+			return [](const tPicture& pic, int& w, int& h) { return PixelFlip(pic, true, w, h); };
+
+		case Edit::EditType::FlipV:
+			return [](const tPicture& pic, int& w, int& h) { return PixelFlip(pic, false, w, h); };
+
+		case Edit::EditType::Crop:
+			return [edit](const tPicture& pic, int& w, int& h) { return PixelCrop(pic, edit.Width, edit.Height, edit.OriginX, edit.OriginY, w, h); };
+	}
+	return nullptr;
+}
+
+
+void Image::ApplyEdit(const Edit& edit)
+{
+	// Clockwise, the displayed (u, v) comes from (1-v, u) of the unrotated texture.
+	EditOp op = GetEditOp(edit);
+	switch (edit.Type)
+	{
+		case Edit::EditType::RotateACW:		StartEdit(op, 0, 1, -1, 0);		break;
+		case Edit::EditType::RotateCW:		StartEdit(op, 0, -1, 1, 0);		break;
+		case Edit::EditType::FlipH:			StartEdit(op, -1, 0, 0, 1);		break;
+		case Edit::EditType::FlipV:			StartEdit(op, 1, 0, 0, -1);		break;
+
+		case Edit::EditType::Crop:
+			// The texture can't show a crop with a uv transform alone, so this one waits. Rotations and flips keep the
+			// same pixel values but a crop may remove some or add transparent ones.
+			StartEdit(op, 1, 0, 0, 1);
+			UpdateEdits(true);
+			AnalysePixels();
+			break;
+	}
+}
+
+
+void Image::ReplayEdits()
+{
+	for (int e = 0; e < EditCount; e++)
+	{
+		EditOp op = GetEditOp(EditStack[e]);
+		for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+		{
+			int width = 0, height = 0;
+			tPixel* pixels = op(*picture, width, height);
+			PixelReplace(*picture, pixels, width, height);
+		}
+	}
+}
+
+
+void Image::StartEdit(EditOp op, int m0, int m1, int m2, int m3)
+{
+	// Edits are applied one at a time.
+	UpdateEdits(true);
+	if (!IsLoaded())
+		return;
+
+	PixelsVersion++;
+	EditResults.resize(Pictures.Count());
+	EditsRemaining = Pictures.Count();
+	EditUVMat[0] = m0;	EditUVMat[1] = m1;
+	EditUVMat[2] = m2;	EditUVMat[3] = m3;
+
+	// The pictures are only read until UpdateEdits swaps in the results on the main thread.
+	int part = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), part++)
+	{
+		EditResult* result = &EditResults[part];
+		EditPool.Submit
+		(
+			[this, op, picture, result]()
+			{
+				result->Pixels = op(*picture, result->Width, result->Height);
+				std::lock_guard<std::mutex> lock(WorkerMutex);
+				EditsRemaining--;
+				WorkerDone.notify_all();
+			}
+		);
+	}
+}
+
+
+void Image::WaitEdits()
+{
+	std::unique_lock<std::mutex> lock(WorkerMutex);
+	WorkerDone.wait(lock, [this]() { return EditsRemaining <= 0; });
+}
+
+
+void Image::UpdateEdits(bool wait)
+{
+	if (!IsEditPending())
+		return;
+
+	if (wait)
+		WaitEdits();
+	else if (EditsRemaining > 0)
+		return;
+
+	// The textures hold the old pixels and are uploaded again by the next Bind.
+	WaitRegionStats();
+	PixelsVersion++;
+	Unbind();
+	int part = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), part++)
+	{
+		EditResult& result = EditResults[part];
+		PixelReplace(*picture, result.Pixels, result.Width, result.Height);
+	}
+
+	EditResults.clear();
+	EditUVMat[0] = 1;	EditUVMat[1] = 0;
+	EditUVMat[2] = 0;	EditUVMat[3] = 1;
+}
+
+
+void Image::RequestRegionStats(int x, int y, int w, int h)
+{
+	// A new request is made once the one in flight finishes. Callers ask every frame so the latest region gets done.
+	if (!IsLoaded() || AltPictureEnabled || IsEditPending() || StatsRunning || (w <= 0) || (h <= 0))
+		return;
+
+	RegionStatsKey key;
+	key.X = x;	key.Y = y;	key.W = w;	key.H = h;
+	key.Part = PartNum;
+	key.Version = PixelsVersion;
+	if (key == StatsKey)
+		return;
+
+	tPicture* picture = GetCurrentPic();
+	if (!picture || !picture->IsValid())
+		return;
+
+	StatsKey = key;
+	StatsRunning = true;
+	EditPool.Submit
+	(
+		[this, picture, key]()
+		{
+			PixelRegionStats(*picture, key.X, key.Y, key.W, key.H, StatsResult);
+			std::lock_guard<std::mutex> lock(WorkerMutex);
+			StatsRunning = false;
+			WorkerDone.notify_all();
+		}
+	);
+}
+
+
+void Image::WaitRegionStats()
+{
+	std::unique_lock<std::mutex> lock(WorkerMutex);
+	WorkerDone.wait(lock, [this]() { return !StatsRunning; });
+}
+
+
+const PixelStats* Image::GetRegionStats(int x, int y, int w, int h) const
+{
+	if (StatsRunning || AltPictureEnabled)
+		return nullptr;
+
+	RegionStatsKey key;
+	key.X = x;	key.Y = y;	key.W = w;	key.H = h;
+	key.Part = PartNum;
+	key.Version = PixelsVersion;
+	return (key == StatsKey) ? &StatsResult : nullptr;
+}
+
+
+tVector2 Image::GetTextureUV(float u, float v) const
+{
+	if (!IsEditPending() || AltPictureEnabled)
+		return tVector2(u, v);
+
+	const int* m = EditUVMat;
+	float texU = float(m[0])*u + float(m[1])*v + (((m[0] + m[1]) < 0) ? 1.0f : 0.0f);
+	float texV = float(m[2])*u + float(m[3])*v + (((m[2] + m[3]) < 0) ? 1.0f : 0.0f);
+	return tVector2(texU, texV);
 }
 
 
@@ -495,69 +1235,48 @@ void Image::PrintInfo()
 	{
 		tPicture* picture = Pictures.First();
 		if (picture)
-			format = picture->IsOpaque() ? tPixelFormat::R8G8B8 : tPixelFormat::R8G8B8A8;
+			format = Info.Opaque ? tPixelFormat::R8G8B8 : tPixelFormat::R8G8B8A8;
 	}
 }
 
 
 uint64 Image::Bind()
 {
-	if (AltPictureEnabled && AltPicture.IsValid())
-	{
-		if (TexIDAlt != 0)
-		{
-			glBindTexture(GL_TEXTURE_2D, TexIDAlt);
-			return TexIDAlt;
-		}
-
-		glGenTextures(1, &TexIDAlt);
-		if (TexIDAlt == 0)
-			return 0;
-
-		tList<tLayer> layers;
-		layers.Append
-		(
-			new tLayer
-			(
-				tPixelFormat::R8G8B8A8, AltPicture.GetWidth(), AltPicture.GetHeight(),
-				(uint8*)AltPicture.GetPixelPointer()
-			)
-		);
+	return BindPicture(GetCurrentPic());
+}
 
-		BindLayers(layers, TexIDAlt);
-		return TexIDAlt;
-	}
 
-	tPicture* currPic = GetCurrentPic();
-	if (currPic && (currPic->TextureID != 0))
+uint64 Image::BindPicture(tPicture* picture)
+{
+	if (picture && (picture->TextureID != 0))
 	{
-		glBindTexture(GL_TEXTURE_2D, currPic->TextureID);
-		return currPic->TextureID;
+		glBindTexture(GL_TEXTURE_2D, picture->TextureID);
+		return picture->TextureID;
 	}
 
 	if (!IsLoaded())
 		return 0;
 
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-	{
-		if (!picture->IsValid())
-			continue;
+	// Parts are uploaded when they are first bound, so an edit that releases every texture doesn't cost a reupload of
+	// parts that aren't being displayed.
+	if (!picture || !picture->IsValid())
+		return 0;
 
-		glGenTextures(1, &picture->TextureID);
+	ProfileScope profile(ProfileZone::GLUpload);
+	glGenTextures(1, &picture->TextureID);
 
-		tList<tLayer> layers;
-		layers.Append
+	tList<tLayer> layers;
+	layers.Append
+	(
+		new tLayer
 		(
-			new tLayer
-			(
-				tPixelFormat::R8G8B8A8, picture->GetWidth(), picture->GetHeight(),
-				(uint8*)picture->GetPixelPointer()
-			)
-		);
+			tPixelFormat::R8G8B8A8, picture->GetWidth(), picture->GetHeight(),
+			(uint8*)picture->GetPixelPointer()
+		)
+	);
 
-		BindLayers(layers, picture->TextureID);
-	}
-	return GetCurrentPic()->TextureID;
+	BindLayers(layers, picture->TextureID);
+	return picture->TextureID;
 }
 
 
@@ -767,19 +1486,12 @@ bool Image::ConvertCubemapToPicture()
 }
 
 
-uint64 Image::BindThumbnail()
+uint64 Image::BindThumbnail(tVector2& uv0, tVector2& uv1)
 {
 	if (!ThumbnailRequested)
 		return 0;
 
-	if (!ThumbnailThreadFlag.test_and_set())
-	{
-		ThumbnailThread.join();
-		ThumbnailThreadRunning = false;
-		ThumbnailNumThreadsRunning--;
-	}
-
-	if (ThumbnailThreadRunning)
+	if (ReapThumbnailWorker())
 		return 0;
 
 	// We only ever access ThumbnailPicture once the worker thread is completed,
@@ -788,42 +1500,105 @@ uint64 Image::BindThumbnail()
 	{
 		ThumbnailRequested = false;
 		ThumbnailInvalidateRequested = false;
-		ThumbnailPicture.Clear();
-		if (TexIDThumbnail != 0)
-		{
-			glDeleteTextures(1, &TexIDThumbnail);
-			TexIDThumbnail = 0;
-		}
+		ThumbnailUploaded = false;
+		FreeThumbnailPicture();
+		ThumbAtlas.Free(ThumbnailSlot, this);
+		ThumbnailSlot = -1;
 		return 0;
 	}
 
-	if (ThumbnailPicture.IsValid())
+	if (ThumbAtlas.IsOwner(ThumbnailSlot, this) && ThumbnailUploaded)
+		return ThumbAtlas.Touch(ThumbnailSlot, uv0, uv1);
+
+	// The slot was reclaimed after the CPU copy was freed. A worker reads it back from the cache.
+	bool compressed = !ThumbnailBlocks.empty();
+	if (!ThumbnailPicture.IsValid() && !compressed)
 	{
-		if (TexIDThumbnail != 0)
+		if (ThumbnailUploaded)
 		{
-			glBindTexture(GL_TEXTURE_2D, TexIDThumbnail);
-			return TexIDThumbnail;
+			ThumbnailRequested = false;
+			ThumbnailUploaded = false;
+			RequestThumbnail();
 		}
+		return 0;
+	}
 
-		glGenTextures(1, &TexIDThumbnail);
-		if (TexIDThumbnail == 0)
-			return 0;
+	// We need a new slot (or never had one) and have to upload.
+	ProfileScope profile(ProfileZone::GLUpload);
+	ThumbnailSlot = ThumbAtlas.Allocate(this, compressed);
+	if (ThumbnailSlot < 0)
+		return 0;
 
-		tList<tLayer> layers;
-		layers.Append
+	bool uploaded = compressed ?
+		ThumbAtlas.UploadCompressed(ThumbnailSlot, ThumbnailBlocks.data(), int(ThumbnailBlocks.size())) :
+		ThumbAtlas.Upload
 		(
-			new tLayer
-			(
-				tPixelFormat::R8G8B8A8, ThumbnailPicture.GetWidth(), ThumbnailPicture.GetHeight(),
-				(uint8*)ThumbnailPicture.GetPixelPointer()
-			)
+			ThumbnailSlot, ThumbnailPicture.GetPixelPointer(),
+			ThumbnailPicture.GetWidth(), ThumbnailPicture.GetHeight()
 		);
+	if (!uploaded)
+	{
+		ThumbAtlas.Free(ThumbnailSlot, this);
+		ThumbnailSlot = -1;
+		return 0;
+	}
+
+	ThumbnailUploaded = true;
+	FreeThumbnailPicture();
+	return ThumbAtlas.Touch(ThumbnailSlot, uv0, uv1);
+}
+
+
+bool Image::ReleaseThumbnail()
+{
+	if (!ThumbnailRequested || ThumbnailThreadRunning)
+		return false;
 
-		BindLayers(layers, TexIDThumbnail);
-		return TexIDThumbnail;
+	ThumbnailRequested = false;
+	ThumbnailInvalidateRequested = false;
+	ThumbnailUploaded = false;
+	FreeThumbnailPicture();
+	ThumbAtlas.Free(ThumbnailSlot, this);
+	ThumbnailSlot = -1;
+	return true;
+}
+
+
+void Image::FreeThumbnailPicture()
+{
+	if (ThumbnailPicture.IsValid())
+	{
+		ThumbnailPictureBytes -= int64(ThumbnailPicture.GetNumPixels())*sizeof(tPixel);
+		ThumbnailPicture.Clear();
 	}
 
-	return 0;
+	ThumbnailPictureBytes -= int64(ThumbnailBlocks.size());
+	std::vector<uint8>().swap(ThumbnailBlocks);
+}
+
+
+bool Image::ReapThumbnailWorker()
+{
+	if (!ThumbnailThreadRunning)
+		return false;
+
+	if (ThumbnailThreadFlag.test_and_set())
+		return true;
+
+	ThumbnailThread.join();
+	ThumbnailThreadRunning = false;
+	ThumbnailNumThreadsRunning--;
+	ThumbnailWorkers.erase(std::remove(ThumbnailWorkers.begin(), ThumbnailWorkers.end(), this), ThumbnailWorkers.end());
+	return false;
+}
+
+
+void Image::ReapThumbnailWorkers()
+{
+	// Reaping removes from the worker list so we iterate over a copy.
+	std::vector<Image*> workers = ThumbnailWorkers;
+	for (Image* img : workers)
+		img->ReapThumbnailWorker();
 }
 
 
@@ -833,32 +1608,40 @@ void Image::GenerateThumbnailBridge(Image* img)
 }
 
 
+bool Image::GenerateThumbnailNow()
+{
+	if (ThumbnailThreadRunning)
+		return false;
+
+	ThumbnailCompress = Config.CompressThumbnails && ThumbCompressionSupported;
+	GenerateThumbnail();
+	return ThumbnailPicture.IsValid() || !ThumbnailBlocks.empty();
+}
+
+
 void Image::GenerateThumbnail()
 {
 	// This thread (only) is allowed to access ThumbnailPicture. The main thread will leave it alone until GenerateThumbnail is complete.
-	if (ThumbnailPicture.IsValid())
+	if (ThumbnailPicture.IsValid() || !ThumbnailBlocks.empty())
+		return;
+
+	// Retrieve from cache if possible. The key depends on the file contents, not its path or times, so renamed, moved
+	// and copied files find their thumbnails. Compressed and uncompressed thumbnails are cached separately.
+	tuint256 contentKey = 0;
+	if (!GetContentKey(contentKey, Filename))
 		return;
 
-	// Retrieve from cache if possible.
 	tuint256 hash = 0;
-	int thumbVersion = 1;
-	tFileInfo fileInfo;
-	tGetFileInfo(fileInfo, Filename);
+	int thumbVersion = 3;
 	hash = tHashData256((uint8*)&thumbVersion, sizeof(thumbVersion));
-	hash = tHashString256(Filename, hash);
-	hash = tHashData256((uint8*)&fileInfo.FileSize, sizeof(fileInfo.FileSize), hash);
-	hash = tHashData256((uint8*)&fileInfo.CreationTime, sizeof(fileInfo.CreationTime), hash);
-	hash = tHashData256((uint8*)&fileInfo.ModificationTime, sizeof(fileInfo.ModificationTime), hash);
+	hash = tHashData256((uint8*)&contentKey, sizeof(contentKey), hash);
 	hash = tHashData256((uint8*)&ThumbWidth, sizeof(ThumbWidth), hash);
 	hash = tHashData256((uint8*)&ThumbHeight, sizeof(ThumbHeight), hash);
+	hash = tHashData256((uint8*)&ThumbnailCompress, sizeof(ThumbnailCompress), hash);
 	tString hashFile;
 	tsPrintf(hashFile, "%s%032|256X.bin", ThumbCacheDir.Chars(), hash);
-	if (tFileExists(hashFile))
-	{
-		tChunkReader chunk(hashFile);
-		ThumbnailPicture.Load(chunk.First());
+	if (LoadThumbnailCache(hashFile))
 		return;
-	}
 
 	// We need an opengl context if we are processing dds files (for now... opengl is used for decompression). GLFW doesn't support creating
 	// contexts without an associated window. However, contexts with hidden windows can be created with the GLFW_VISIBLE window hint.
@@ -924,20 +1707,192 @@ void Image::GenerateThumbnail()
 	tAssert((iw == ThumbWidth) || (ih == ThumbHeight));
 
 	// Create an image that is big (or small) enough to exactly match either the width or height without ruining the aspect.
-	srcPic->Resample(iw, ih, tPicture::tFilter::Bilinear);
-
-	// Center-crop the image to what we need. Cropping to a bigger size adds transparent pixels.
-	srcPic->Crop(ThumbWidth, ThumbHeight);
+	{
+		ProfileScope profile(ProfileZone::Resample);
+		ResamplePicture(*srcPic, iw, ih, tPicture::tFilter::Bilinear);
 
-	ThumbnailPicture.Set(*srcPic);
+		// Center-crop the image to what we need. Cropping to a bigger size adds transparent pixels.
+		srcPic->Crop(ThumbWidth, ThumbHeight);
+	}
 
-	// Write to cache file.
-	tChunkWriter writer(hashFile);
-	ThumbnailPicture.Save(writer);
+	SetThumbnail(*srcPic);
+	SaveThumbnailCache(hashFile, *srcPic);
 	// std::this_thread::sleep_for(std::chrono::milliseconds(100));
 }
 
 
+void Image::SetThumbnail(const tPicture& picture)
+{
+	if (!ThumbnailCompress)
+	{
+		ThumbnailPicture.Set(picture);
+		ThumbnailPictureBytes += int64(ThumbnailPicture.GetNumPixels())*sizeof(tPixel);
+		return;
+	}
+
+	// The border is added before compressing so the whole slot can be uploaded as blocks.
+	int bw = ThumbAtlas.GetBorderedWidth();
+	int bh = ThumbAtlas.GetBorderedHeight();
+	std::vector<tPixel> bordered(bw*bh);
+	ThumbAtlas.AddBorder(bordered.data(), picture.GetPixelPointer(), picture.GetWidth(), picture.GetHeight());
+	ThumbnailBlocks.resize(GetBlockCompressedSize(bw, bh, BC3BlockSize));
+	CompressBC3(ThumbnailBlocks.data(), (const uint8*)bordered.data(), bw, bh);
+	ThumbnailPictureBytes += int64(ThumbnailBlocks.size());
+}
+
+
+bool Image::LoadThumbnailCache(const tString& file)
+{
+	if (!tFileExists(file))
+		return false;
+
+	ProfileScope profile(ProfileZone::CacheIO);
+	tFileHandle handle = tOpenFile(file.Chars(), "rb");
+	if (!handle)
+		return false;
+
+	ThumbCacheHeader header;
+	bool ok = (tReadFile(handle, &header, sizeof(header)) == sizeof(header)) && (header.ID == ThumbCacheID);
+	ThumbCacheFormat format = ThumbCacheFormat(header.Format);
+	int bw = ThumbAtlas.GetBorderedWidth();
+	int bh = ThumbAtlas.GetBorderedHeight();
+	if (ok && ThumbnailCompress)
+	{
+		// BC1 is only written for thumbnails without partial transparency. It's turned into the BC3 the atlas uses
+		// without decoding.
+		int bc1Size = GetBlockCompressedSize(bw, bh, BC1BlockSize);
+		int bc3Size = GetBlockCompressedSize(bw, bh, BC3BlockSize);
+		ok =
+			(header.Width == bw) && (header.Height == bh) &&
+			(((format == ThumbCacheFormat::BC1) && (header.NumBytes == bc1Size)) || ((format == ThumbCacheFormat::BC3) && (header.NumBytes == bc3Size)));
+
+		std::vector<uint8> blocks(ok ? header.NumBytes : 0);
+		ok = ok && (tReadFile(handle, blocks.data(), header.NumBytes) == header.NumBytes);
+		if (ok && (format == ThumbCacheFormat::BC1))
+		{
+			ThumbnailBlocks.resize(bc3Size);
+			TranscodeBC1ToBC3(ThumbnailBlocks.data(), blocks.data(), bc1Size / BC1BlockSize);
+		}
+		else if (ok)
+		{
+			ThumbnailBlocks.swap(blocks);
+		}
+		if (ok)
+			ThumbnailPictureBytes += int64(ThumbnailBlocks.size());
+	}
+	else if (ok)
+	{
+		int32 numBlocks = 0;
+		CompressedData data;
+		ok =
+			(format == ThumbCacheFormat::RGBA) && (header.Width == ThumbWidth) && (header.Height == ThumbHeight) &&
+			(header.NumBytes > 0) && (tReadFile(handle, &numBlocks, sizeof(numBlocks)) == sizeof(numBlocks)) &&
+			(numBlocks > 0) && (numBlocks <= header.NumBytes);
+		if (ok)
+		{
+			data.NumBytes = ThumbWidth*ThumbHeight*sizeof(tPixel);
+			data.BlockEnds.resize(numBlocks);
+			data.Data.resize(header.NumBytes);
+			int endsSize = numBlocks*sizeof(int);
+			ok =
+				(tReadFile(handle, data.BlockEnds.data(), endsSize) == endsSize) &&
+				(tReadFile(handle, data.Data.data(), header.NumBytes) == header.NumBytes);
+		}
+
+		tPixel* pixels = ok ? new tPixel[ThumbWidth*ThumbHeight] : nullptr;
+		ok = ok && Decompress((uint8*)pixels, data.NumBytes, data);
+		if (ok)
+		{
+			ThumbnailPicture.Set(ThumbWidth, ThumbHeight, pixels, false);
+			ThumbnailPictureBytes += int64(ThumbnailPicture.GetNumPixels())*sizeof(tPixel);
+		}
+		else
+		{
+			delete[] pixels;
+		}
+	}
+	tCloseFile(handle);
+
+	// A damaged file is removed so it gets written again.
+	if (!ok)
+		tDeleteFile(file);
+	return ok;
+}
+
+
+void Image::SaveThumbnailCache(const tString& file, const tPicture& picture) const
+{
+	ThumbCacheHeader header;
+	header.ID = ThumbCacheID;
+	const uint8* data = nullptr;
+	std::vector<uint8> bc1;
+	CompressedData compressed;
+	if (!ThumbnailBlocks.empty())
+	{
+		// Thumbnails with no partial transparency, which includes letterboxed ones, are written as BC1 at half the size.
+		header.Width = ThumbAtlas.GetBorderedWidth();
+		header.Height = ThumbAtlas.GetBorderedHeight();
+		std::vector<tPixel> bordered(header.Width*header.Height);
+		ThumbAtlas.AddBorder(bordered.data(), picture.GetPixelPointer(), picture.GetWidth(), picture.GetHeight());
+		if (HasBinaryAlpha((const uint8*)bordered.data(), int(bordered.size())))
+		{
+			bc1.resize(GetBlockCompressedSize(header.Width, header.Height, BC1BlockSize));
+			CompressBC1(bc1.data(), (const uint8*)bordered.data(), header.Width, header.Height);
+			header.Format = int32(ThumbCacheFormat::BC1);
+			header.NumBytes = int32(bc1.size());
+			data = bc1.data();
+		}
+		else
+		{
+			header.Format = int32(ThumbCacheFormat::BC3);
+			header.NumBytes = int32(ThumbnailBlocks.size());
+			data = ThumbnailBlocks.data();
+		}
+	}
+	else if (ThumbnailPicture.IsValid())
+	{
+		header.Width = ThumbnailPicture.GetWidth();
+		header.Height = ThumbnailPicture.GetHeight();
+		header.Format = int32(ThumbCacheFormat::RGBA);
+		Compress(compressed, (const uint8*)ThumbnailPicture.GetPixelPointer(), ThumbnailPicture.GetNumPixels()*sizeof(tPixel));
+		header.NumBytes = int32(compressed.Data.size());
+		data = compressed.Data.data();
+	}
+	else
+	{
+		return;
+	}
+
+	// Same as the pixel cache. Each thread writes its own temporary file and the rename makes it appear all at once.
+	ProfileScope profile(ProfileZone::CacheIO);
+	static std::atomic<int> tempFileCount(0);
+	tString tempFile;
+	tsPrintf(tempFile, "%s.%d.tmp", file.Chars(), tempFileCount++);
+	tFileHandle handle = tOpenFile(tempFile.Chars(), "wb");
+	if (!handle)
+		return;
+
+	bool ok = (tWriteFile(handle, &header, sizeof(header)) == sizeof(header));
+	if (ok && (header.Format == int32(ThumbCacheFormat::RGBA)))
+	{
+		int32 numBlocks = int32(compressed.BlockEnds.size());
+		int endsSize = numBlocks*sizeof(int);
+		ok =
+			(tWriteFile(handle, &numBlocks, sizeof(numBlocks)) == sizeof(numBlocks)) &&
+			(tWriteFile(handle, compressed.BlockEnds.data(), endsSize) == endsSize);
+	}
+	ok = ok && (tWriteFile(handle, data, header.NumBytes) == header.NumBytes);
+	tCloseFile(handle);
+
+	#ifdef PLATFORM_WINDOWS
+	if (ok)
+		tDeleteFile(file);
+	#endif
+	if (!ok || (std::rename(tempFile.Chars(), file.Chars()) != 0))
+		tDeleteFile(tempFile);
+}
+
+
 void Image::RequestThumbnail()
 {
 	if (ThumbnailRequested)
@@ -949,8 +1904,11 @@ void Image::RequestThumbnail()
 		return;
 
 	ThumbnailRequested = true;
+	ThumbnailUploaded = false;
+	ThumbnailCompress = Config.CompressThumbnails && ThumbCompressionSupported;
 	ThumbnailThreadRunning = true;
 	ThumbnailNumThreadsRunning++;
+	ThumbnailWorkers.push_back(this);
 	ThumbnailThreadFlag.test_and_set();
 	ThumbnailThread = std::thread
 	(
@@ -965,7 +1923,7 @@ void Image::RequestThumbnail()
 
 void Image::UnrequestThumbnail()
 {
-	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid())
+	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid() && !ThumbnailUploaded)
 		ThumbnailRequested = false;
 }
 
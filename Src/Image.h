@@ -15,6 +15,10 @@
 #pragma once
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <functional>
 #include <glad/glad.h>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
@@ -24,6 +28,10 @@
 #include <Image/tCubemap.h>
 #include <Image/tImageHDR.h>
 #include "Settings.h"
+#include "ThumbnailAtlas.h"
+#include "ThreadPool.h"
+#include "PixelOps.h"
+#include "Compress.h"
 
 
 class Image : public tLink<Image>
@@ -52,20 +60,45 @@ public:
 	int PartNum = 0;
 
 	bool Load(const tString& filename);
-	bool Load();						// Load into main memory.
+	bool Load()																											{ return LoadFile(false); }
+
+	// Same as Load except a file that is slow to decode is also written to the pixel cache. The viewer uses this for the
+	// image it displays so thumbnails, batch work and other background loads don't fill the cache.
+	bool LoadAndCache()																									{ return LoadFile(true); }
 	bool IsLoaded() const																								{ return (Pictures.Count() > 0); }
+
+	// Moves the pictures and info of another loaded image of the same file into this one, which must not be loaded.
+	// The other image is left unloaded and any textures it had are released. This image's edits are replayed. Lets a
+	// private image be loaded on a worker thread and then shown without copying the pixels. Call on the main thread.
+	void TakePictures(Image& src);
 	int GetNumParts() const																								{ return Pictures.Count(); }
 
+	// Whether the current part is opaque. The primary part, and all sides of a cubemap, are answered from the analysis
+	// done at load time. Only other parts are scanned.
 	bool IsOpaque() const;
+
+	// Edits are kept when unloading so they can be replayed by the next Load. If force is true they are discarded
+	// instead, for example because the file was overwritten with the edited image.
 	bool Unload(bool force = false);
 	float GetLoadedTime() const																							{ return LoadedTime; }
 
+	// Unloads but keeps the pixels in memory compressed so the next Load only has to decompress them. Dds files need
+	// their textures and images with edits would need the unedited pixels, so those are unloaded normally. Returns true
+	// if a compressed copy was kept. Unload and TakePictures discard it. Call on the main thread.
+	bool UnloadCompressed();
+	bool IsCompressed() const																							{ return !CompressedPictures.empty(); }
+	int64 GetCompressedSize() const																						{ return CompressedSize; }
+	float GetCompressedTime() const																						{ return CompressedTime; }
+	static int64 GetCompressedSizeTotal()																				{ return CompressedSizeTotal; }
+
 	// Bind to a texture ID and load into VRAM. If already in VRAM, it makes the texture current. Since some ImGui
-	// functions require a texture ID as parameter, this function return the ID.
-	// If the alt image is enabled, the bound texture and ID  will be the alt image's.
-	// Returns 0 (invalid id) if there was a problem.
+	// functions require a texture ID as parameter, this function return the ID. The current part is always the one
+	// bound, even if the alt view is enabled. Returns 0 (invalid id) if there was a problem.
 	uint64 Bind();
 	void Unbind();
+
+	// While the alt view is enabled the width and height are those of the whole layout and GetPixel reads from
+	// whichever part is at that position.
 	int GetWidth() const;
 	int GetHeight() const;
 	tColouri GetPixel(int x, int y) const;
@@ -73,16 +106,41 @@ public:
 	// Some images can store multiple complete images inside a single file (multiple parts).
 	// The primary one is the first one.
 	tImage::tPicture* GetPrimaryPic() const																				{ return Pictures.First(); }
-	tImage::tPicture* GetCurrentPic() const																				{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < PartNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
+	tImage::tPicture* GetCurrentPic() const																				{ return GetPicture(PartNum); }
 
-	// Functions that edit and cause dirty flag to be set.
+	// Functions that edit and cause dirty flag to be set. Each edit is recorded in a list so it can be undone, and so
+	// the image can be unloaded and have its edits replayed when it is loaded again. All parts are processed in
+	// parallel on worker threads. Flips and rotations return straight away, and until the new pixels are swapped in by
+	// UpdateEdits the existing textures are drawn with a uv transform (see GetTextureUV) so the result shows
+	// immediately. Crop waits for its result. There is no need to Unbind and Bind around any of these.
 	void Rotate90(bool antiClockWise);
 	void Flip(bool horizontal);
 	void Crop(int newWidth, int newHeight, int originX, int originY);
 
-	// Since from outside this class you can save to any filename, we need the ability to clear the dirty flag.
-	void ClearDirty()																									{ Dirty = false; }
-	bool IsDirty() const																								{ return Dirty; }
+	// Flips and rotations are undone by applying the opposite edit. Undoing a crop reloads the image and replays the
+	// edits before it.
+	void Undo();
+	void Redo();
+	bool CanUndo() const																								{ return (EditCount > 0); }
+	bool CanRedo() const																								{ return (EditCount < int(EditStack.size())); }
+
+	// Gives this image the load params and edits of src so loading it gives what src shows. Used for the private images
+	// that contact sheets and saves load on worker threads. Call before this image is loaded.
+	void CopyEdits(const Image& src);
+
+	// Swaps in the pixels of a finished edit and releases the old textures. Call once per frame. If wait is true it
+	// blocks until any pending edit is done.
+	void UpdateEdits(bool wait = false);
+	bool IsEditPending() const																							{ return !EditResults.empty(); }
+
+	// Maps a uv of the image as displayed to a uv of the currently bound texture. This is the identity unless an edit
+	// is pending. Works for uvs outside [0, 1] when tiling.
+	tMath::tVector2 GetTextureUV(float u, float v) const;
+
+	// Since from outside this class you can save to any filename, we need the ability to clear the dirty flag. The
+	// image is dirty whenever the applied edits differ from those at the last save, so undoing back to it is clean.
+	void ClearDirty()																									{ SavedEditCount = EditCount; }
+	bool IsDirty() const																								{ return (EditCount != SavedEditCount); }
 
 	struct ImgInfo
 	{
@@ -91,18 +149,46 @@ public:
 		bool Opaque							= false;
 		int FileSizeBytes					= 0;
 		int MemSizeBytes					= 0;
+
+		// Ranges, histograms, and whether it is greyscale, for the primary part. Computed by a single pass over the
+		// pixels as soon as they are loaded and again after a crop, so nothing else needs to read them for this.
+		Viewer::PixelStats Stats;
 	};
 	void PrintInfo();
 
-	bool IsAltMipmapsPictureAvail() const																				{ return DDSTexture2D.IsValid() && AltPicture.IsValid(); }
-	bool IsAltCubemapPictureAvail() const																				{ return DDSCubemap.IsValid() && AltPicture.IsValid(); }
-	void EnableAltPicture(bool enabled)																					{ AltPictureEnabled = enabled; }
+	// The alt view lays out every mipmap in a strip, or the cubemap sides in a cross. Nothing extra is allocated. It is
+	// drawn as one quad per part using the textures the parts already have.
+	bool IsAltMipmapsPictureAvail() const																				{ return DDSTexture2D.IsValid() && (DDSTexture2D.GetNumMipmaps() > 1); }
+	bool IsAltCubemapPictureAvail() const																				{ return DDSCubemap.IsValid(); }
+	void EnableAltPicture(bool enabled)																					{ AltPictureEnabled = enabled; PixelsVersion++; }
 	bool IsAltPictureEnabled() const																					{ return AltPictureEnabled; }
 
+	// Statistics for a rectangle of the current part, in the same coordinates as GetPixel. They are computed on a worker
+	// and only recomputed when the region or the pixels change, so it is fine to request them every frame. Get returns
+	// null until the result for that region is ready. Not available for the alt view or while an edit is pending.
+	void RequestRegionStats(int x, int y, int w, int h);
+	const Viewer::PixelStats* GetRegionStats(int x, int y, int w, int h) const;
+
+	// Incremented whenever the displayed pixels may have changed, so callers can cache things read from them.
+	uint32 GetPixelsVersion() const																					{ return PixelsVersion; }
+
+	// Gets the rectangle of a part in the alt layout in pixels, bottom-left origin. Returns false if there is no such
+	// part. BindAltQuad binds the texture of the part, uploading it if necessary.
+	int GetNumAltQuads() const																							{ return AltPictureEnabled ? Pictures.Count() : 0; }
+	bool GetAltQuad(int index, int& x, int& y, int& w, int& h) const;
+	uint64 BindAltQuad(int index);
+
+	// Binds all six sides as a GL_TEXTURE_CUBE_MAP for the skybox view. The texture is made from the pictures the
+	// first time it is needed and is released by Unbind. Returns 0 if this isn't a cubemap.
+	uint64 BindCubemap();
+
 	// Thumbnail generation is done on a seperate thread. Calling RequestThumbnail starts the thread. You should call it
 	// over and over as it will only ever start one thread, and it may not start it if too mnay threads are already
 	// working. BindThumbnail will at some point return a non-zero texture ID, but not necessarily right away. Just keep
-	// calling it. Unloaded images remain unloaded after thumbnail generation.
+	// calling it. Unloaded images remain unloaded after thumbnail generation. Thumbnails live in shared atlas pages so
+	// the returned ID is the page texture and uv0/uv1 (top-left and bottom-right, ready for ImGui) locate the thumbnail
+	// within it. Once the thumbnail is in the atlas the CPU copy is freed. If the slot is later reclaimed the thumbnail
+	// is read back from the cache by a worker.
 	void RequestThumbnail();
 
 	// Call this if you need to invaidate the thumbnail. For example, if the file was saved/edited this should be called
@@ -112,7 +198,24 @@ public:
 	// You are allowed to unrequest. It will succeed if a worker was never assigned.
 	void UnrequestThumbnail();
 	bool IsThumbnailWorkerActive() const { return ThumbnailThreadRunning; }
-	uint64 BindThumbnail();
+	uint64 BindThumbnail(tMath::tVector2& uv0, tMath::tVector2& uv1);
+
+	// Frees the atlas slot and any CPU copy of the thumbnail, for images scrolled well out of view. Does nothing while
+	// a worker is running. The thumbnail must be requested again before it can be bound. Returns true if anything
+	// was released.
+	bool ReleaseThumbnail();
+
+	// The memory held by thumbnails that are waiting to be uploaded, or were made by GenerateThumbnailNow.
+	static int64 GetThumbnailPictureBytes()																				{ return ThumbnailPictureBytes; }
+
+	// Joins any thumbnail worker threads that have finished so they are free for new requests. Only images with an
+	// active worker are visited, so this is cheap to call every frame regardless of how many images there are.
+	static void ReapThumbnailWorkers();
+
+	// Generates (or retrieves from the cache) the thumbnail on the calling thread. Intended for tools that run without
+	// a window. Must not be mixed with RequestThumbnail on the same image. Thumbnails of dds files need GLFW to be
+	// initialized. Returns true if a valid thumbnail is available afterwards.
+	bool GenerateThumbnailNow();
 
 	ImgInfo Info;						// Info is only valid AFTER loading.
 	tString Filename;					// Valid before load.
@@ -125,6 +228,16 @@ public:
 	const static int ThumbMinDispWidth;	// = 64;
 	static tString ThumbCacheDir;
 
+	// Thumbnails are stored and uploaded BC compressed when Config.CompressThumbnails is set and this is true. Set it
+	// once GL is up to whether S3TC textures are supported.
+	static bool ThumbCompressionSupported;
+
+	// Holds the full resolution decoded pixels of files that are slow to decode. Empty disables it, as does a zero
+	// MaxPixelCacheMB. TrimPixelCache deletes the least recently used files until the rest fit. Returns num removed.
+	static tString PixelCacheDir;
+	static int TrimPixelCache(int64 maxBytes);
+	static ThumbnailAtlas ThumbAtlas;	// Call ThumbAtlas.Clear() before the GL context goes away.
+
 	bool TypeSupportsProperties() const;
 
 private:
@@ -138,38 +251,147 @@ private:
 
 	tList<tImage::tPicture> Pictures;
 
-	// The 'alternative' picture is valid when there is another valid way of displaying the image.
-	// Specifically for cubemaps and dds files with mipmaps this offers an alternative view.
+	// The 'alternative' view is available when there is another valid way of displaying the image. Specifically for
+	// cubemaps and dds files with mipmaps.
 	bool AltPictureEnabled = false;
-	tImage::tPicture AltPicture;
 
 	bool ThumbnailRequested = false;			// True if ever requested.
 	bool ThumbnailInvalidateRequested = false;
 	bool ThumbnailThreadRunning = false;		// Only true while worker thread going.
 	static int ThumbnailNumThreadsRunning;		// How many worker threads active.
+	static std::vector<Image*> ThumbnailWorkers;	// Images with a worker thread that has not been joined yet.
 	std::thread ThumbnailThread;
 	std::atomic_flag ThumbnailThreadFlag = ATOMIC_FLAG_INIT;
-	tImage::tPicture ThumbnailPicture;
-
-	// These 2 functions run on a helper thread.
+	tImage::tPicture ThumbnailPicture;			// Used when thumbnails aren't compressed.
+	std::vector<uint8> ThumbnailBlocks;			// BC3 blocks of the bordered atlas slot when they are.
+	bool ThumbnailCompress = false;				// Chosen when the thumbnail is requested, so it's fixed for the worker.
+	bool ThumbnailUploaded = false;				// True once the thumbnail has been in the atlas. It's in the cache too.
+	static std::atomic<int64> ThumbnailPictureBytes;
+	void FreeThumbnailPicture();
+
+	// Joins the worker thread if it has finished. Returns true if a worker is still running.
+	bool ReapThumbnailWorker();
+
+	// These functions run on a helper thread. The thumbnail cache files are a header followed by either BC1 or BC3
+	// blocks, or losslessly compressed RGBA pixels if thumbnails aren't BC compressed.
 	static void GenerateThumbnailBridge(Image*);
 	void GenerateThumbnail();
+	void SetThumbnail(const tImage::tPicture&);
+	bool LoadThumbnailCache(const tString& file);
+	void SaveThumbnailCache(const tString& file, const tImage::tPicture&) const;
 
 	// Zero is invalid and means texture has never been bound and loaded into VRAM.
-	uint TexIDAlt			= 0;
-	uint TexIDThumbnail		= 0;
+	uint TexIDCubemap		= 0;
+
+	// The thumbnail atlas slot. It may be reclaimed by another image if this one hasn't been drawn in a while.
+	int ThumbnailSlot		= -1;
 
-	// Returns the approx main mem size of this image. Considers the Pictures list and the AltPicture.
+	// Returns the approx main mem size of this image. Considers the Pictures list.
 	int GetMemSizeBytes() const;
+
+	// Fills in the opacity and pixel stats of Info on the calling thread.
+	void AnalysePixels();
+
+	// Load into main memory. Slow files are written to the pixel cache if writePixelCache is true.
+	bool LoadFile(bool writePixelCache);
+
+	// The pixel cache file is keyed by the file contents and the load params. Returns an empty string if this image
+	// can't use the pixel cache. The saved pixels are the unedited ones. Saving trims the cache if it goes over budget.
+	tString GetPixelCacheFile() const;
+	bool LoadPixelCache(const tString& file);
+	void SavePixelCache(const tString& file) const;
+	static std::atomic<int64> PixelCacheBytes;	// -1 until the cache dir has been scanned.
 	bool ConvertTexture2DToPicture();
 	bool ConvertCubemapToPicture();
 	void GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat, bool& compressed, tImage::tPixelFormat);
 	void BindLayers(const tList<tImage::tLayer>&, uint texID);
-	void CreateAltPictureFromDDS_2DMipmaps();
-	void CreateAltPictureFromDDS_Cubemap();
+	uint64 BindPicture(tImage::tPicture*);
+	tImage::tPicture* GetPicture(int index) const																		{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < index; i++) pic = pic ? pic->Next() : nullptr; return pic; }
+	void GetAltSize(int& width, int& height) const;
+
+	// An edit produces one new pixel buffer per part. EditUVMat maps displayed uvs to the uvs of the unedited picture
+	// as u' = m0*u + m1*v and v' = m2*u + m3*v, plus whatever offset keeps the result in [0, 1].
+	struct EditResult
+	{
+		tImage::tPixel* Pixels		= nullptr;
+		int Width					= 0;
+		int Height					= 0;
+	};
+	typedef std::function<tImage::tPixel*(const tImage::tPicture&, int& newWidth, int& newHeight)> EditOp;
+	void StartEdit(EditOp, int m0, int m1, int m2, int m3);
+
+	struct Edit
+	{
+		enum class EditType
+		{
+			RotateACW,
+			RotateCW,
+			FlipH,
+			FlipV,
+			Crop
+		};
+		EditType Type;
+		int Width					= 0;		// Crop only.
+		int Height					= 0;
+		int OriginX					= 0;
+		int OriginY					= 0;
+	};
+
+	// Records the edit, dropping anything that could have been redone, and applies it.
+	void AddEdit(const Edit&);
+	void ApplyEdit(const Edit&);
+	static EditOp GetEditOp(const Edit&);
+
+	// Applies the recorded edits on the calling thread. Used by Load, which may run without a GL context.
+	void ReplayEdits();
+	bool IsEditTransposed() const																						{ return IsEditPending() && (EditUVMat[0] == 0); }
+
+	// The pool is shared by every image so waits are on this image's own work, never the whole pool. Workers signal
+	// WorkerDone with WorkerMutex held so a waiter can't return, and maybe destroy the image, before they are done.
+	static ThreadPool EditPool;
+	std::mutex WorkerMutex;
+	std::condition_variable WorkerDone;
+	void WaitEdits();
+	std::vector<EditResult> EditResults;
+	std::atomic<int> EditsRemaining { 0 };
+	int EditUVMat[4] = { 1, 0, 0, 1 };
+
+	std::vector<Edit> EditStack;
+	int EditCount				= 0;			// How many of the edits in the stack are applied. The rest may be redone.
+	int SavedEditCount			= 0;			// EditCount at the last save. -1 if that state can't be reached again.
+
+	// What the region stats were (or are being) computed from. The worker only reads the picture, and anything that
+	// changes the pictures waits for it first.
+	struct RegionStatsKey
+	{
+		bool operator==(const RegionStatsKey& k) const																	{ return (X == k.X) && (Y == k.Y) && (W == k.W) && (H == k.H) && (Part == k.Part) && (Version == k.Version); }
+		int X = 0, Y = 0, W = 0, H = 0;
+		int Part					= -1;
+		uint32 Version				= 0;
+	};
+	void WaitRegionStats();
+	RegionStatsKey StatsKey;
+	Viewer::PixelStats StatsResult;
+	std::atomic<bool> StatsRunning { false };
+	uint32 PixelsVersion		= 0;
 
 	float LoadedTime = -1.0f;
-	bool Dirty = false;
+
+	// What UnloadCompressed kept of each part.
+	struct CompressedPicture
+	{
+		int Width							= 0;
+		int Height							= 0;
+		float Duration						= 0.0f;
+		tImage::tPixelFormat SrcPixelFormat	= tImage::tPixelFormat::Invalid;
+		Viewer::CompressedData Pixels;
+	};
+	bool LoadCompressed();
+	void FreeCompressed();
+	std::vector<CompressedPicture> CompressedPictures;
+	int64 CompressedSize					= 0;
+	float CompressedTime					= -1.0f;
+	static std::atomic<int64> CompressedSizeTotal;
 };
 
 
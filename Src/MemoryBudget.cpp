@@ -0,0 +1,339 @@
+// MemoryBudget.cpp
+//
+// Watches how much memory the system has to spare and how hard it is working to find more, so the image memory
+// limit can follow it. On Linux this uses /proc/meminfo, the cgroup v2 memory limit and pressure stall information
+// (PSI). On Windows it uses the global memory status. Elsewhere the status is never valid and a fixed limit is used.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#elif defined(PLATFORM_LINUX)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+#include <Foundation/tString.h>
+#include <Math/tFundamentals.h>
+#include <System/tFile.h>
+#include "MemoryBudget.h"
+using namespace tMath;
+
+
+namespace Viewer
+{
+	const double MemoryPressureHoldTime		= 5.0;		// Seconds pressure is still reported after the last stall.
+	const float MemoryPressureThreshold		= 10.0f;	// PSI avg10 percent at or above which memory is under pressure.
+	const int MemorySampleInterval			= 1000;		// Milliseconds.
+
+	std::thread MemoryMonitorThread;
+	std::atomic<bool> MemoryMonitorStopping(false);
+	std::atomic<bool> MemoryPressureEvent(false);
+	std::mutex MemoryStatusMutex;
+	std::condition_variable MemoryMonitorWake;
+	MemoryStatus CurrMemoryStatus;
+	double LastStallTime = -MemoryPressureHoldTime;
+
+	void MemoryMonitorLoop();
+	void SampleMemory(bool stalled);
+	double GetMonitorTime();
+
+	#ifdef PLATFORM_LINUX
+	int MemoryMonitorStopFD = -1;
+	tString CGroupDir;								// Empty unless the process is in a cgroup v2 hierarchy.
+	tString PressureFile;
+
+	void FindCGroup();
+	bool ReadNumberFile(const tString& file, int64& value);
+	void ReadMemInfo(int64& totalBytes, int64& availableBytes);
+	float ReadPressure();
+	#endif
+}
+
+
+double Viewer::GetMonitorTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+#ifdef PLATFORM_LINUX
+void Viewer::FindCGroup()
+{
+	// In a v2 hierarchy the process's cgroup is the line starting with 0::.
+	CGroupDir.Clear();
+	FILE* file = fopen("/proc/self/cgroup", "rt");
+	if (file)
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), file))
+		{
+			if (strncmp(line, "0::", 3) != 0)
+				continue;
+
+			line[strcspn(line, "\n")] = '\0';
+			tString dir = tString("/sys/fs/cgroup") + (line + 3);
+			if (dir[dir.Length()-1] != '/')
+				dir += "/";
+			if (tSystem::tFileExists(dir + "memory.current") || tSystem::tFileExists(dir + "memory.pressure"))
+				CGroupDir = dir;
+			break;
+		}
+		fclose(file);
+	}
+
+	// Pressure inside our cgroup is what matters if there is one. Otherwise the whole system.
+	if (!CGroupDir.IsEmpty() && tSystem::tFileExists(CGroupDir + "memory.pressure"))
+		PressureFile = CGroupDir + "memory.pressure";
+	else if (tSystem::tFileExists("/proc/pressure/memory"))
+		PressureFile = "/proc/pressure/memory";
+	else
+		PressureFile.Clear();
+}
+
+
+bool Viewer::ReadNumberFile(const tString& filename, int64& value)
+{
+	// Limits that aren't set read as max, which is reported as no number.
+	FILE* file = fopen(filename.Chars(), "rt");
+	if (!file)
+		return false;
+
+	long long number = 0;
+	bool ok = (fscanf(file, "%lld", &number) == 1);
+	fclose(file);
+	if (ok)
+		value = int64(number);
+	return ok;
+}
+
+
+void Viewer::ReadMemInfo(int64& totalBytes, int64& availableBytes)
+{
+	totalBytes = 0;
+	availableBytes = 0;
+	FILE* file = fopen("/proc/meminfo", "rt");
+	if (!file)
+		return;
+
+	char line[256];
+	long long kb = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		if (sscanf(line, "MemTotal: %lld kB", &kb) == 1)
+			totalBytes = int64(kb) * 1024;
+		else if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1)
+			availableBytes = int64(kb) * 1024;
+	}
+	fclose(file);
+}
+
+
+float Viewer::ReadPressure()
+{
+	if (PressureFile.IsEmpty())
+		return -1.0f;
+
+	FILE* file = fopen(PressureFile.Chars(), "rt");
+	if (!file)
+		return -1.0f;
+
+	float avg10 = -1.0f;
+	if (fscanf(file, "some avg10=%f", &avg10) != 1)
+		avg10 = -1.0f;
+	fclose(file);
+	return avg10;
+}
+#endif
+
+
+void Viewer::SampleMemory(bool stalled)
+{
+	MemoryStatus status;
+
+	#if defined(PLATFORM_LINUX)
+	ReadMemInfo(status.TotalBytes, status.AvailableBytes);
+	int64 limit = 0, current = 0;
+	if (!CGroupDir.IsEmpty() && ReadNumberFile(CGroupDir + "memory.max", limit) && ReadNumberFile(CGroupDir + "memory.current", current))
+	{
+		status.CGroupLimitBytes = limit;
+		status.TotalBytes = tMin(status.TotalBytes, limit);
+		status.AvailableBytes = tMin(status.AvailableBytes, tMax(limit - current, int64(0)));
+	}
+	status.PressurePercent = ReadPressure();
+	status.Valid = (status.TotalBytes > 0);
+	bool pressured = (status.PressurePercent >= MemoryPressureThreshold);
+
+	#elif defined(PLATFORM_WINDOWS)
+	MEMORYSTATUSEX memStatus;
+	memStatus.dwLength = sizeof(memStatus);
+	status.Valid = GlobalMemoryStatusEx(&memStatus) ? true : false;
+	status.TotalBytes = int64(memStatus.ullTotalPhys);
+	status.AvailableBytes = int64(memStatus.ullAvailPhys);
+	bool pressured = status.Valid && (memStatus.dwMemoryLoad >= 90);
+
+	#else
+	bool pressured = false;
+	#endif
+
+	// Running out of available memory counts as pressure even if nothing has stalled yet.
+	double now = GetMonitorTime();
+	if (stalled)
+		LastStallTime = now;
+	pressured = pressured || (now - LastStallTime < MemoryPressureHoldTime);
+	if (status.Valid && (status.AvailableBytes < status.TotalBytes/20))
+		pressured = true;
+	status.UnderPressure = pressured;
+
+	std::lock_guard<std::mutex> lock(MemoryStatusMutex);
+	if (pressured && !CurrMemoryStatus.UnderPressure)
+		MemoryPressureEvent = true;
+	status.BudgetBytes = CurrMemoryStatus.BudgetBytes;
+	CurrMemoryStatus = status;
+}
+
+
+void Viewer::MemoryMonitorLoop()
+{
+	#ifdef PLATFORM_LINUX
+	// Asks the kernel to wake us if tasks stall on memory for 150ms in any 2s window. Unprivileged processes may only
+	// use windows that are a multiple of 2s. If triggers aren't available the sampling still catches pressure.
+	int triggerFD = -1;
+	if (!PressureFile.IsEmpty())
+	{
+		triggerFD = open(PressureFile.Chars(), O_RDWR | O_NONBLOCK);
+		const char* trigger = "some 150000 2000000";
+		if ((triggerFD >= 0) && (write(triggerFD, trigger, strlen(trigger) + 1) < 0))
+		{
+			close(triggerFD);
+			triggerFD = -1;
+		}
+	}
+
+	while (!MemoryMonitorStopping)
+	{
+		pollfd fds[2] = { { MemoryMonitorStopFD, POLLIN, 0 }, { triggerFD, POLLPRI, 0 } };
+		int numFDs = (triggerFD >= 0) ? 2 : 1;
+		bool stalled = false;
+		if (poll(fds, numFDs, MemorySampleInterval) > 0)
+		{
+			if (fds[1].revents & POLLERR)
+			{
+				close(triggerFD);
+				triggerFD = -1;
+			}
+			else if (fds[1].revents & POLLPRI)
+			{
+				stalled = true;
+			}
+		}
+		if (!MemoryMonitorStopping)
+			SampleMemory(stalled);
+	}
+
+	if (triggerFD >= 0)
+		close(triggerFD);
+
+	#else
+	while (!MemoryMonitorStopping)
+	{
+		SampleMemory(false);
+		std::unique_lock<std::mutex> lock(MemoryStatusMutex);
+		MemoryMonitorWake.wait_for(lock, std::chrono::milliseconds(MemorySampleInterval), []() { return MemoryMonitorStopping.load(); });
+	}
+	#endif
+}
+
+
+void Viewer::MemoryMonitorStart()
+{
+	if (MemoryMonitorThread.joinable())
+		return;
+
+	#ifdef PLATFORM_LINUX
+	FindCGroup();
+	MemoryMonitorStopFD = eventfd(0, EFD_NONBLOCK);
+	tPrintf("Memory monitor cgroup: %s pressure: %s\n", CGroupDir.IsEmpty() ? "none" : CGroupDir.Chars(), PressureFile.IsEmpty() ? "none" : PressureFile.Chars());
+	#endif
+
+	// The first sample is taken here so a budget is available before the first image loads.
+	MemoryMonitorStopping = false;
+	SampleMemory(false);
+	MemoryMonitorThread = std::thread(MemoryMonitorLoop);
+}
+
+
+void Viewer::MemoryMonitorStop()
+{
+	if (!MemoryMonitorThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(MemoryStatusMutex);
+		MemoryMonitorStopping = true;
+	}
+	MemoryMonitorWake.notify_all();
+
+	#ifdef PLATFORM_LINUX
+	uint64_t one = 1;
+	if (write(MemoryMonitorStopFD, &one, sizeof(one)) < 0)
+		tPrintf("Memory monitor could not be woken. Waiting for it.\n");
+	#endif
+
+	MemoryMonitorThread.join();
+
+	#ifdef PLATFORM_LINUX
+	close(MemoryMonitorStopFD);
+	MemoryMonitorStopFD = -1;
+	#endif
+}
+
+
+Viewer::MemoryStatus Viewer::GetMemoryStatus()
+{
+	std::lock_guard<std::mutex> lock(MemoryStatusMutex);
+	return CurrMemoryStatus;
+}
+
+
+int64 Viewer::GetImageMemBudget(int64 usedBytes, int64 minBytes, int64 hardCapBytes)
+{
+	std::lock_guard<std::mutex> lock(MemoryStatusMutex);
+	int64 budget = hardCapBytes;
+	const MemoryStatus& status = CurrMemoryStatus;
+	if (status.Valid)
+	{
+		// A tenth of memory is left for everyone else and only half of what remains is taken, so the viewer grows
+		// steadily rather than racing other programs for it. Under pressure half of what's in use is given back.
+		int64 spare = status.AvailableBytes - status.TotalBytes/10;
+		budget = tMin(usedBytes + spare/2, status.TotalBytes/2);
+		if (status.UnderPressure)
+			budget = tMin(budget, usedBytes/2);
+	}
+
+	budget = tClamp(budget, minBytes, tMax(minBytes, hardCapBytes));
+	CurrMemoryStatus.BudgetBytes = budget;
+	return budget;
+}
+
+
+bool Viewer::TakeMemoryPressureEvent()
+{
+	return MemoryPressureEvent.exchange(false);
+}
@@ -0,0 +1,45 @@
+// MemoryBudget.h
+//
+// Watches how much memory the system has to spare and how hard it is working to find more, so the image memory
+// limit can follow it. On Linux this uses /proc/meminfo, the cgroup v2 memory limit and pressure stall information
+// (PSI). On Windows it uses the global memory status. Elsewhere the status is never valid and a fixed limit is used.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+
+
+namespace Viewer
+{
+	// The monitor samples on its own thread about once a second, and straight away when the kernel reports a stall.
+	void MemoryMonitorStart();
+	void MemoryMonitorStop();
+
+	struct MemoryStatus
+	{
+		bool Valid					= false;	// False until the first sample, or always if the platform isn't supported.
+		int64 TotalBytes			= 0;		// The smaller of physical memory and the cgroup limit.
+		int64 AvailableBytes		= 0;		// What could be used without swapping, within the cgroup limit.
+		int64 CGroupLimitBytes		= -1;		// -1 if there is no cgroup memory limit.
+		float PressurePercent		= -1.0f;	// Share of the last 10s some task stalled waiting for memory. -1 if unknown.
+		bool UnderPressure			= false;
+		int64 BudgetBytes			= 0;		// The last value returned by GetImageMemBudget.
+	};
+	MemoryStatus GetMemoryStatus();
+
+	// Returns how many bytes loaded images may use, given usedBytes are in use now. Grows into idle memory and shrinks
+	// to half of usedBytes under pressure. Never goes below minBytes or above hardCapBytes.
+	int64 GetImageMemBudget(int64 usedBytes, int64 minBytes, int64 hardCapBytes);
+
+	// Returns true once for each new period of memory pressure. Lets caches be trimmed without waiting for a load.
+	bool TakeMemoryPressureEvent();
+}
@@ -0,0 +1,298 @@
+// PixelOps.cpp
+//
+// Fast pixel transforms used by the image edits. Each one reads from a source picture and returns a newly allocated
+// pixel buffer, leaving the source untouched so it may still be displayed while the work is done on another thread.
+// Rotation is cache-blocked and, like flipping, uses SSE2 on x64. Region statistics for the details overlay are here
+// too as they also run on a worker, and the same pass analyses each image once when it is loaded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef ARCHITECTURE_X64
+#include <emmintrin.h>
+#endif
+#include <Foundation/tStandard.h>
+#include <Math/tFundamentals.h>
+#include "PixelOps.h"
+using namespace tStd;
+using namespace tMath;
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Rotation walks the source in square blocks of this many pixels so both the rows being read and the rows being
+	// written stay in cache. 64 x 64 pixels is 16KB each way.
+	const int PixelBlockSize = 64;
+
+	// Rotates the 4x4 tile whose bottom-left source pixel is (x, y). Source column x+i becomes destination row
+	// dstRow(i), and the four pixels of that row start at dstCol. When reverse is set they are stored in reverse order.
+	void RotateTile4x4(tPixel* dst, int dstWidth, const tPixel* src, int srcWidth, int x, int y, int dstRow0, int dstRowStep, int dstCol, bool reverse);
+}
+
+
+void Viewer::RotateTile4x4(tPixel* dst, int dstWidth, const tPixel* src, int srcWidth, int x, int y, int dstRow0, int dstRowStep, int dstCol, bool reverse)
+{
+	#ifdef ARCHITECTURE_X64
+	__m128i r0 = _mm_loadu_si128((const __m128i*)(src + (y+0)*srcWidth + x));
+	__m128i r1 = _mm_loadu_si128((const __m128i*)(src + (y+1)*srcWidth + x));
+	__m128i r2 = _mm_loadu_si128((const __m128i*)(src + (y+2)*srcWidth + x));
+	__m128i r3 = _mm_loadu_si128((const __m128i*)(src + (y+3)*srcWidth + x));
+
+	// Standard 4x4 transpose of 32-bit elements. Afterwards c[i] holds source column x+i, bottom to top.
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+	__m128i c[4] =
+	{
+		_mm_unpacklo_epi64(t0, t1),
+		_mm_unpackhi_epi64(t0, t1),
+		_mm_unpacklo_epi64(t2, t3),
+		_mm_unpackhi_epi64(t2, t3)
+	};
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i col = reverse ? _mm_shuffle_epi32(c[i], _MM_SHUFFLE(0, 1, 2, 3)) : c[i];
+		_mm_storeu_si128((__m128i*)(dst + (dstRow0 + i*dstRowStep)*dstWidth + dstCol), col);
+	}
+
+	#else
+	for (int i = 0; i < 4; i++)
+	{
+		tPixel* dstRow = dst + (dstRow0 + i*dstRowStep)*dstWidth + dstCol;
+		for (int j = 0; j < 4; j++)
+			dstRow[reverse ? 3-j : j] = src[(y+j)*srcWidth + x + i];
+	}
+	#endif
+}
+
+
+tPixel* Viewer::PixelRotate90(const tPicture& picture, bool antiClockWise, int& newWidth, int& newHeight)
+{
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	newWidth = h;
+	newHeight = w;
+	tPixel* dst = new tPixel[w*h];
+	const tPixel* src = picture.GetPixelPointer();
+
+	// Clockwise, source (x, y) goes to (y, w-1-x). Anti-clockwise it goes to (h-1-y, x).
+	auto dstIndex = [&](int x, int y) -> int
+	{
+		return antiClockWise ? (x*newWidth + (h-1-y)) : ((w-1-x)*newWidth + y);
+	};
+
+	int w4 = w & ~3;
+	int h4 = h & ~3;
+	for (int by = 0; by < h4; by += PixelBlockSize)
+	{
+		int byEnd = tMin(by + PixelBlockSize, h4);
+		for (int bx = 0; bx < w4; bx += PixelBlockSize)
+		{
+			int bxEnd = tMin(bx + PixelBlockSize, w4);
+			for (int y = by; y < byEnd; y += 4)
+			{
+				for (int x = bx; x < bxEnd; x += 4)
+				{
+					if (antiClockWise)
+						RotateTile4x4(dst, newWidth, src, w, x, y, x, 1, h-4-y, true);
+					else
+						RotateTile4x4(dst, newWidth, src, w, x, y, w-1-x, -1, y, false);
+				}
+			}
+		}
+	}
+
+	// Columns and rows left over when the size isn't a multiple of 4.
+	for (int y = 0; y < h; y++)
+		for (int x = w4; x < w; x++)
+			dst[dstIndex(x, y)] = src[y*w + x];
+
+	for (int y = h4; y < h; y++)
+		for (int x = 0; x < w4; x++)
+			dst[dstIndex(x, y)] = src[y*w + x];
+
+	return dst;
+}
+
+
+tPixel* Viewer::PixelFlip(const tPicture& picture, bool horizontal, int& newWidth, int& newHeight)
+{
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	newWidth = w;
+	newHeight = h;
+	tPixel* dst = new tPixel[w*h];
+	const tPixel* src = picture.GetPixelPointer();
+
+	if (!horizontal)
+	{
+		for (int y = 0; y < h; y++)
+			tMemcpy(dst + y*w, src + (h-1-y)*w, w*sizeof(tPixel));
+		return dst;
+	}
+
+	for (int y = 0; y < h; y++)
+	{
+		const tPixel* srcRow = src + y*w;
+		tPixel* dstRow = dst + y*w;
+		int x = 0;
+
+		#ifdef ARCHITECTURE_X64
+		for (; x + 4 <= w; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(srcRow + w - 4 - x));
+			_mm_storeu_si128((__m128i*)(dstRow + x), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 1, 2, 3)));
+		}
+		#endif
+
+		for (; x < w; x++)
+			dstRow[x] = srcRow[w-1-x];
+	}
+
+	return dst;
+}
+
+
+tPixel* Viewer::PixelCrop(const tPicture& picture, int cropWidth, int cropHeight, int originX, int originY, int& newWidth, int& newHeight)
+{
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	newWidth = cropWidth;
+	newHeight = cropHeight;
+	tPixel* dst = new tPixel[cropWidth*cropHeight];
+	const tPixel* src = picture.GetPixelPointer();
+
+	// Only the part of each row that overlaps the source is copied. Everything else is transparent.
+	int x0 = tMax(0, -originX);
+	int x1 = tMin(cropWidth, w - originX);
+	for (int y = 0; y < cropHeight; y++)
+	{
+		tPixel* dstRow = dst + y*cropWidth;
+		int srcY = originY + y;
+		if ((srcY < 0) || (srcY >= h) || (x1 <= x0))
+		{
+			tMemset(dstRow, 0, cropWidth*sizeof(tPixel));
+			continue;
+		}
+
+		if (x0 > 0)
+			tMemset(dstRow, 0, x0*sizeof(tPixel));
+		tMemcpy(dstRow + x0, src + srcY*w + originX + x0, (x1-x0)*sizeof(tPixel));
+		if (x1 < cropWidth)
+			tMemset(dstRow + x1, 0, (cropWidth-x1)*sizeof(tPixel));
+	}
+
+	return dst;
+}
+
+
+void Viewer::PixelRegionStats(const tPicture& picture, int x, int y, int w, int h, PixelStats& stats)
+{
+	tMemset(stats.Histogram, 0, sizeof(stats.Histogram));
+	int pw = picture.GetWidth();
+	int x0 = tMax(x, 0);
+	int y0 = tMax(y, 0);
+	int x1 = tMin(x + w, pw);
+	int y1 = tMin(y + h, picture.GetHeight());
+	stats.NumPixels = tMax(x1-x0, 0) * tMax(y1-y0, 0);
+
+	// Each channel has its own table so consecutive increments rarely hit the same counter. Four pixels are done per
+	// step, and on x64 the same load is used to check whether red, green, and blue are equal. The xor of each pixel
+	// with itself shifted down a channel has r^g and g^b in its low two bytes, and these are or'd together so any
+	// non-grey pixel leaves a bit set.
+	const uint32* pixels = (const uint32*)picture.GetPixelPointer();
+	uint32* hr = stats.Histogram[0];
+	uint32* hg = stats.Histogram[1];
+	uint32* hb = stats.Histogram[2];
+	uint32* ha = stats.Histogram[3];
+	uint32 colourBits = 0;
+	#ifdef ARCHITECTURE_X64
+	const __m128i greyMask = _mm_set1_epi32(0x0000FFFF);
+	__m128i colourBits4 = _mm_setzero_si128();
+	#endif
+	for (int row = y0; row < y1 && (x1 > x0); row++)
+	{
+		const uint32* rowPixels = pixels + row*pw + x0;
+		const uint8* src = (const uint8*)rowPixels;
+		int count = x1 - x0;
+		int i = 0;
+		for (; i + 4 <= count; i += 4, src += 16)
+		{
+			#ifdef ARCHITECTURE_X64
+			__m128i four = _mm_loadu_si128((const __m128i*)(rowPixels + i));
+			colourBits4 = _mm_or_si128(colourBits4, _mm_and_si128(_mm_xor_si128(four, _mm_srli_epi32(four, 8)), greyMask));
+			#else
+			for (int j = 0; j < 4; j++)
+				colourBits |= (rowPixels[i+j] ^ (rowPixels[i+j] >> 8)) & 0x0000FFFF;
+			#endif
+			hr[src[0]]++;	hg[src[1]]++;	hb[src[2]]++;	ha[src[3]]++;
+			hr[src[4]]++;	hg[src[5]]++;	hb[src[6]]++;	ha[src[7]]++;
+			hr[src[8]]++;	hg[src[9]]++;	hb[src[10]]++;	ha[src[11]]++;
+			hr[src[12]]++;	hg[src[13]]++;	hb[src[14]]++;	ha[src[15]]++;
+		}
+		for (; i < count; i++, src += 4)
+		{
+			colourBits |= (rowPixels[i] ^ (rowPixels[i] >> 8)) & 0x0000FFFF;
+			hr[src[0]]++;	hg[src[1]]++;	hb[src[2]]++;	ha[src[3]]++;
+		}
+	}
+	#ifdef ARCHITECTURE_X64
+	colourBits |= uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(colourBits4, _mm_setzero_si128())) ^ 0xFFFF);
+	#endif
+	stats.Greyscale = (colourBits == 0);
+
+	for (int c = 0; c < 4; c++)
+	{
+		stats.Min[c] = 0;
+		stats.Max[c] = 0;
+		stats.Mean[c] = 0.0f;
+		stats.StdDev[c] = 0.0f;
+		if (stats.NumPixels == 0)
+			continue;
+
+		uint64 sum = 0;
+		uint64 sumSquares = 0;
+		int minValue = -1;
+		for (int v = 0; v < 256; v++)
+		{
+			uint64 n = stats.Histogram[c][v];
+			if (!n)
+				continue;
+			if (minValue < 0)
+				minValue = v;
+			stats.Max[c] = v;
+			sum += n * v;
+			sumSquares += n * v * v;
+		}
+		stats.Min[c] = minValue;
+
+		double mean = double(sum) / double(stats.NumPixels);
+		double variance = double(sumSquares) / double(stats.NumPixels) - mean*mean;
+		stats.Mean[c] = float(mean);
+		stats.StdDev[c] = float(tSqrt(float(tMax(variance, 0.0))));
+	}
+}
+
+
+void Viewer::PixelReplace(tPicture& picture, tPixel* pixels, int width, int height)
+{
+	tString filename = picture.Filename;
+	float duration = picture.Duration;
+	tPixelFormat srcPixelFormat = picture.SrcPixelFormat;
+
+	picture.Set(width, height, pixels, false);
+
+	picture.Filename = filename;
+	picture.Duration = duration;
+	picture.SrcPixelFormat = srcPixelFormat;
+}
@@ -0,0 +1,52 @@
+// PixelOps.h
+//
+// Fast pixel transforms used by the image edits. Each one reads from a source picture and returns a newly allocated
+// pixel buffer, leaving the source untouched so it may still be displayed while the work is done on another thread.
+// Rotation is cache-blocked and, like flipping, uses SSE2 on x64. Region statistics for the details overlay are here
+// too as they also run on a worker, and the same pass analyses each image once when it is loaded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Image/tPicture.h>
+
+
+namespace Viewer
+{
+	// All functions return a buffer allocated with new[] and set newWidth and newHeight. Rows are bottom-up as they
+	// are in tPicture. Rotation direction is as seen on screen.
+	tImage::tPixel* PixelRotate90(const tImage::tPicture&, bool antiClockWise, int& newWidth, int& newHeight);
+	tImage::tPixel* PixelFlip(const tImage::tPicture&, bool horizontal, int& newWidth, int& newHeight);
+
+	// The origin is the position in the source of the new bottom-left pixel. Areas outside the source are transparent.
+	tImage::tPixel* PixelCrop(const tImage::tPicture&, int cropWidth, int cropHeight, int originX, int originY, int& newWidth, int& newHeight);
+
+	// Per-channel statistics for a rectangle of pixels, in RGBA order. Greyscale is true if every pixel has equal red,
+	// green, and blue. The rectangle is opaque if the alpha minimum is 255.
+	struct PixelStats
+	{
+		int NumPixels			= 0;
+		bool Greyscale			= false;
+		int Min[4]				= { };
+		int Max[4]				= { };
+		float Mean[4]			= { };
+		float StdDev[4]			= { };
+		uint32 Histogram[4][256];
+	};
+
+	// The rectangle's bottom-left is (x, y) and it is clipped to the picture. Everything is derived from the histograms
+	// so the pixels are only read once. Pass the picture's full size to analyse all of it.
+	void PixelRegionStats(const tImage::tPicture&, int x, int y, int w, int h, PixelStats&);
+
+	// Replaces the pixels of the picture, taking ownership of the buffer. The picture's filename, duration, and source
+	// format are kept. Any texture must already have been released.
+	void PixelReplace(tImage::tPicture&, tImage::tPixel* pixels, int width, int height);
+}
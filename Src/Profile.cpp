@@ -0,0 +1,226 @@
+// Profile.cpp
+//
+// Lightweight instrumentation for finding out where frame time goes. Scoped timers record into per-zone rolling
+// histories that are displayed in the profiler window, and every interval is also kept in a ring buffer that can be
+// exported as Chrome trace JSON (load it in chrome://tracing or Perfetto).
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Math/tFundamentals.h>
+#include "Profile.h"
+
+
+namespace Viewer
+{
+	const int ProfileMaxEvents		= 1 << 16;		// Size of the trace event ring buffer.
+
+	struct ProfileEvent
+	{
+		ProfileZone Zone;
+		int ThreadIndex;
+		double StartTime;
+		double EndTime;
+	};
+
+	struct ProfileZoneData
+	{
+		// Accumulated for the frame currently in progress.
+		float FrameTotalMS							= 0.0f;
+		int FrameCount								= 0;
+
+		// Rolling per-frame totals and individual durations. Oldest is at the head index.
+		float FrameHistoryMS[ProfileHistorySize]	= { };
+		float JobHistoryMS[ProfileJobHistorySize]	= { };
+		int JobHistoryHead							= 0;
+		int64 TotalCount							= 0;
+	};
+
+	std::atomic<bool> ProfileEnabled(false);
+	std::mutex ProfileMutex;
+	const auto ProfileEpoch							= std::chrono::steady_clock::now();
+	ProfileZoneData ProfileZones[int(ProfileZone::NumZones)];
+	int ProfileHistoryHead							= 0;
+	double ProfileLastFrameTime						= -1.0;
+	std::vector<ProfileEvent> ProfileEvents;
+	int ProfileEventsHead							= 0;
+	std::atomic<int> ProfileNextThreadIndex(0);
+	thread_local int ProfileThreadIndex				= -1;
+
+	int GetProfileThreadIndex();
+}
+
+
+const char* Viewer::GetProfileZoneName(ProfileZone zone)
+{
+	static const char* names[int(ProfileZone::NumZones)] =
+	{
+		"Frame",
+		"Image Draw",
+		"ImGui Build",
+		"Content View",
+		"Nav Bar",
+		"GL Upload",
+		"Eviction",
+		"Decode",
+		"Resample",
+		"Cache IO"
+	};
+
+	if ((zone < ProfileZone::Frame) || (zone >= ProfileZone::NumZones))
+		return "Invalid";
+	return names[int(zone)];
+}
+
+
+void Viewer::ProfileEnable(bool enabled)
+{
+	if (enabled == ProfileEnabled)
+		return;
+
+	// Start from a clean slate so the first frame isn't the whole time we were disabled.
+	std::lock_guard<std::mutex> lock(ProfileMutex);
+	ProfileLastFrameTime = -1.0;
+	ProfileEnabled = enabled;
+}
+
+
+bool Viewer::IsProfileEnabled()
+{
+	return ProfileEnabled.load(std::memory_order_relaxed);
+}
+
+
+double Viewer::ProfileGetTime()
+{
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - ProfileEpoch;
+	return elapsed.count();
+}
+
+
+int Viewer::GetProfileThreadIndex()
+{
+	// The main thread is normally the first to record so it ends up as thread 0.
+	if (ProfileThreadIndex < 0)
+		ProfileThreadIndex = ProfileNextThreadIndex++;
+	return ProfileThreadIndex;
+}
+
+
+void Viewer::ProfileRecord(ProfileZone zone, double startTime, double endTime)
+{
+	if (!IsProfileEnabled() || (zone >= ProfileZone::NumZones))
+		return;
+
+	int threadIndex = GetProfileThreadIndex();
+	float durationMS = float((endTime - startTime) * 1000.0);
+
+	std::lock_guard<std::mutex> lock(ProfileMutex);
+	ProfileZoneData& data = ProfileZones[int(zone)];
+	data.FrameTotalMS += durationMS;
+	data.FrameCount++;
+	data.TotalCount++;
+	data.JobHistoryMS[data.JobHistoryHead] = durationMS;
+	data.JobHistoryHead = (data.JobHistoryHead + 1) % ProfileJobHistorySize;
+
+	if (ProfileEvents.empty())
+		ProfileEvents.resize(ProfileMaxEvents);
+	ProfileEvents[ProfileEventsHead % ProfileMaxEvents] = { zone, threadIndex, startTime, endTime };
+	ProfileEventsHead++;
+}
+
+
+void Viewer::ProfileNewFrame()
+{
+	if (!IsProfileEnabled())
+		return;
+
+	double now = ProfileGetTime();
+	double lastFrameTime;
+	{
+		std::lock_guard<std::mutex> lock(ProfileMutex);
+		lastFrameTime = ProfileLastFrameTime;
+		ProfileLastFrameTime = now;
+	}
+
+	// The Frame zone spans from one call to the next so it includes swap and any sleeping.
+	if (lastFrameTime >= 0.0)
+		ProfileRecord(ProfileZone::Frame, lastFrameTime, now);
+
+	std::lock_guard<std::mutex> lock(ProfileMutex);
+	for (int z = 0; z < int(ProfileZone::NumZones); z++)
+	{
+		ProfileZoneData& data = ProfileZones[z];
+		data.FrameHistoryMS[ProfileHistoryHead] = data.FrameTotalMS;
+		data.FrameTotalMS = 0.0f;
+		data.FrameCount = 0;
+	}
+	ProfileHistoryHead = (ProfileHistoryHead + 1) % ProfileHistorySize;
+}
+
+
+bool Viewer::ProfileExportChromeTrace(const tString& filename)
+{
+	// Copy out under the lock so the (slow) file writing doesn't block recording threads.
+	std::vector<ProfileEvent> events;
+	{
+		std::lock_guard<std::mutex> lock(ProfileMutex);
+		int numEvents = tMath::tMin(ProfileEventsHead, ProfileMaxEvents);
+		int first = ProfileEventsHead - numEvents;
+		events.reserve(numEvents);
+		for (int e = first; e < ProfileEventsHead; e++)
+			events.push_back(ProfileEvents[e % ProfileMaxEvents]);
+	}
+
+	FILE* file = fopen(filename.Chars(), "wb");
+	if (!file)
+		return false;
+
+	// Complete ('X') events with microsecond timestamps. Thread 0 is normally the main thread.
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (int e = 0; e < int(events.size()); e++)
+	{
+		const ProfileEvent& event = events[e];
+		fprintf
+		(
+			file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			GetProfileZoneName(event.Zone), (event.Zone >= ProfileZone::Decode) ? "job" : "frame", event.ThreadIndex,
+			event.StartTime * 1000000.0, (event.EndTime - event.StartTime) * 1000000.0,
+			(e < int(events.size())-1) ? "," : ""
+		);
+	}
+	fprintf(file, "]}\n");
+	fclose(file);
+
+	tPrintf("Exported %d profile events to %s\n", int(events.size()), filename.Chars());
+	return true;
+}
+
+
+void Viewer::ProfileGetHistory(ProfileZoneHistory* histories)
+{
+	std::lock_guard<std::mutex> lock(ProfileMutex);
+	for (int z = 0; z < int(ProfileZone::NumZones); z++)
+	{
+		const ProfileZoneData& data = ProfileZones[z];
+		ProfileZoneHistory& history = histories[z];
+		tStd::tMemcpy(history.FrameMS, data.FrameHistoryMS, sizeof(history.FrameMS));
+		history.FrameHead = ProfileHistoryHead;
+		tStd::tMemcpy(history.JobMS, data.JobHistoryMS, sizeof(history.JobMS));
+		history.JobHead = data.JobHistoryHead;
+		history.TotalCount = data.TotalCount;
+	}
+}
@@ -0,0 +1,86 @@
+// Profile.h
+//
+// Lightweight instrumentation for finding out where frame time goes. Scoped timers record into per-zone rolling
+// histories that are displayed in the profiler window, and every interval is also kept in a ring buffer that can be
+// exported as Chrome trace JSON (load it in chrome://tracing or Perfetto).
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+
+
+namespace Viewer
+{
+	enum class ProfileZone
+	{
+		// Main thread zones.
+		Frame,
+		ImageDraw,
+		ImGuiBuild,
+		ContentView,
+		NavBar,
+		GLUpload,
+		Eviction,
+
+		// These usually run on worker threads.
+		Decode,
+		Resample,
+		CacheIO,
+
+		NumZones
+	};
+	const char* GetProfileZoneName(ProfileZone);
+
+	// Nothing is recorded unless profiling is enabled. When disabled a ProfileScope costs one atomic load.
+	void ProfileEnable(bool enabled);
+	bool IsProfileEnabled();
+
+	// Call once at the start of every frame. The previous frame's totals are folded into the rolling history and the
+	// Frame zone is recorded.
+	void ProfileNewFrame();
+
+	// Records a completed interval. Safe to call from any thread. Times are seconds as returned by ProfileGetTime.
+	void ProfileRecord(ProfileZone, double startTime, double endTime);
+	double ProfileGetTime();
+
+	// Writes all intervals still in the event ring buffer as a Chrome trace JSON file. Returns success.
+	bool ProfileExportChromeTrace(const tString& filename);
+
+	const int ProfileHistorySize		= 240;			// Frames of history kept per zone.
+	const int ProfileJobHistorySize		= 128;			// Individual durations kept per zone.
+
+	// A copy of the recorded history for a single zone. All values are in milliseconds and the oldest entry in each
+	// array is at its head index.
+	struct ProfileZoneHistory
+	{
+		float FrameMS[ProfileHistorySize];
+		int FrameHead;
+		float JobMS[ProfileJobHistorySize];
+		int JobHead;
+		int64 TotalCount;
+	};
+
+	// Fills in one history per zone. The histories array must have ProfileZone::NumZones entries.
+	void ProfileGetHistory(ProfileZoneHistory* histories);
+
+	// Times the enclosing scope. Construct one at the top of the block to be measured.
+	class ProfileScope
+	{
+	public:
+		ProfileScope(ProfileZone zone)																					: Zone(zone), StartTime(IsProfileEnabled() ? ProfileGetTime() : -1.0) { }
+		~ProfileScope()																									{ if (StartTime >= 0.0) ProfileRecord(Zone, StartTime, ProfileGetTime()); }
+
+	private:
+		ProfileZone Zone;
+		double StartTime;
+	};
+}
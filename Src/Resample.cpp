@@ -0,0 +1,440 @@
+// Resample.cpp
+//
+// A separable, multithreaded picture resampler. Filter weights are computed once per output row and column, the
+// horizontal and vertical passes are split into bands that run on a thread pool, and the inner loops use SSE2 on x64.
+// Large reductions first halve the picture with an integer 2x2 box filter until the remaining ratio is small.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef ARCHITECTURE_X64
+#include <emmintrin.h>
+#endif
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Math/tFundamentals.h>
+#include <System/tMachine.h>
+#include "Resample.h"
+#include "PixelOps.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+using namespace tStd;
+using namespace tMath;
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Work is split into bands of at least this many output pixels. Anything smaller runs on the calling thread.
+	const int ResampleMinBandPixels = 32*1024;
+
+	// Shared by every caller. The calling thread always takes bands itself, so a busy pool only slows things down.
+	ThreadPool ResamplePool(tMax(tSystem::tGetNumCores(), 1));
+
+	// The source range and weights for a single output row or column. Weights sum to one.
+	struct ResampleKernel
+	{
+		int First;
+		int Count;
+		int WeightIndex;
+	};
+
+	struct ResampleKernels
+	{
+		std::vector<ResampleKernel> Kernels;
+		std::vector<float> Weights;
+	};
+
+	struct ResampleBands
+	{
+		std::function<void(int, int)> Func;
+		int Count;
+		int BandSize;
+		int NumBands;
+		std::atomic<int> NextBand;
+		std::atomic<int> BandsDone;
+		std::mutex Mutex;
+		std::condition_variable Done;
+	};
+
+	// Filter shapes at a scale of one. Bicubic is Catmull-Rom style with a = -0.5.
+	float GetResampleSupport(tPicture::tFilter);
+	float GetResampleWeight(tPicture::tFilter, float x);
+	void ComputeResampleKernels(ResampleKernels&, tPicture::tFilter, int srcSize, int dstSize);
+
+	// Calls func(start, end) over bands that together cover [0, count). Returns once every band is done.
+	void ParallelBands(int count, int pixelsPerItem, const std::function<void(int, int)>& func);
+	void RunBands(ResampleBands&);
+
+	// Each of these fills destination rows [rowStart, rowEnd).
+	void ResampleRows(tPixel* dst, int dstWidth, const tPixel* src, int srcWidth, const ResampleKernels&, int rowStart, int rowEnd);
+	void ResampleColumns(tPixel* dst, int width, const tPixel* src, const ResampleKernels&, int rowStart, int rowEnd);
+	void HalvePixels(tPixel* dst, const tPixel* src, int srcWidth, int srcHeight, int rowStart, int rowEnd);
+
+	#ifdef ARCHITECTURE_X64
+	__m128 LoadPixelPS(const tPixel*);
+	tPixel StorePixelPS(__m128);
+	#endif
+}
+
+
+float Viewer::GetResampleSupport(tPicture::tFilter filter)
+{
+	switch (filter)
+	{
+		case tPicture::tFilter::Box:			return 0.5f;
+		case tPicture::tFilter::Bilinear:		return 1.0f;
+		case tPicture::tFilter::Bicubic:		return 2.0f;
+		case tPicture::tFilter::Quadratic:		return 1.5f;
+		case tPicture::tFilter::Hamming:		return 1.0f;
+		default:								return 0.0f;
+	}
+}
+
+
+float Viewer::GetResampleWeight(tPicture::tFilter filter, float x)
+{
+	x = tAbs(x);
+	switch (filter)
+	{
+		case tPicture::tFilter::Box:
+			return (x <= 0.5f) ? 1.0f : 0.0f;
+
+		case tPicture::tFilter::Bilinear:
+			return (x < 1.0f) ? 1.0f - x : 0.0f;
+
+		case tPicture::tFilter::Bicubic:
+		{
+			const float a = -0.5f;
+			if (x < 1.0f)
+				return ((a + 2.0f)*x - (a + 3.0f))*x*x + 1.0f;
+			if (x < 2.0f)
+				return (((x - 5.0f)*x + 8.0f)*x - 4.0f)*a;
+			return 0.0f;
+		}
+
+		case tPicture::tFilter::Quadratic:
+			if (x < 0.5f)
+				return 0.75f - x*x;
+			if (x < 1.5f)
+				return 0.5f*(x - 1.5f)*(x - 1.5f);
+			return 0.0f;
+
+		case tPicture::tFilter::Hamming:
+		{
+			if (x == 0.0f)
+				return 1.0f;
+			if (x >= 1.0f)
+				return 0.0f;
+			const float pi = 3.14159265f;
+			float px = pi*x;
+			return (std::sin(px) / px) * (0.54f + 0.46f*std::cos(px));
+		}
+
+		default:
+			return 0.0f;
+	}
+}
+
+
+void Viewer::ComputeResampleKernels(ResampleKernels& kernels, tPicture::tFilter filter, int srcSize, int dstSize)
+{
+	kernels.Kernels.resize(dstSize);
+	kernels.Weights.clear();
+
+	// When reducing, the filter is stretched so every source pixel contributes. Pixel centres are at half-integers.
+	float scale = float(srcSize) / float(dstSize);
+	float filterScale = tMax(scale, 1.0f);
+	float support = GetResampleSupport(filter) * filterScale;
+	for (int d = 0; d < dstSize; d++)
+	{
+		ResampleKernel& kernel = kernels.Kernels[d];
+		float centre = (float(d) + 0.5f) * scale;
+		kernel.WeightIndex = int(kernels.Weights.size());
+
+		float total = 0.0f;
+		if (filter != tPicture::tFilter::NearestNeighbour)
+		{
+			kernel.First = tMax(int(centre - support + 0.5f), 0);
+			int last = tMin(int(centre + support + 0.5f), srcSize);
+			kernel.Count = last - kernel.First;
+			for (int s = kernel.First; s < last; s++)
+			{
+				float weight = GetResampleWeight(filter, (float(s) + 0.5f - centre) / filterScale);
+				kernels.Weights.push_back(weight);
+				total += weight;
+			}
+		}
+
+		// Nearest, or a box so narrow it missed every pixel centre, takes the single closest pixel.
+		if (total <= 0.0f)
+		{
+			kernels.Weights.resize(kernel.WeightIndex);
+			kernel.First = tClamp(int(centre), 0, srcSize-1);
+			kernel.Count = 1;
+			kernels.Weights.push_back(1.0f);
+			continue;
+		}
+
+		// Clipping at the edges removes taps, so normalizing also keeps the edges from darkening.
+		for (int w = 0; w < kernel.Count; w++)
+			kernels.Weights[kernel.WeightIndex + w] /= total;
+	}
+}
+
+
+void Viewer::ParallelBands(int count, int pixelsPerItem, const std::function<void(int, int)>& func)
+{
+	// A few bands per thread so the load still balances when some threads are busy with other work.
+	int numThreads = ResamplePool.GetNumThreads();
+	int bandSize = tMax(ResampleMinBandPixels / tMax(pixelsPerItem, 1), (count + numThreads*4 - 1) / (numThreads*4));
+	tiClampMin(bandSize, 1);
+	int numBands = (count + bandSize - 1) / bandSize;
+	if ((numBands <= 1) || (numThreads <= 1))
+	{
+		func(0, count);
+		return;
+	}
+
+	// Helpers may start after every band has been taken, so they share ownership of the bands.
+	std::shared_ptr<ResampleBands> bands = std::make_shared<ResampleBands>();
+	bands->Func = func;
+	bands->Count = count;
+	bands->BandSize = bandSize;
+	bands->NumBands = numBands;
+	bands->NextBand = 0;
+	bands->BandsDone = 0;
+
+	int numHelpers = tMin(numBands-1, numThreads);
+	for (int h = 0; h < numHelpers; h++)
+		ResamplePool.Submit([bands]() { RunBands(*bands); });
+
+	RunBands(*bands);
+	std::unique_lock<std::mutex> lock(bands->Mutex);
+	bands->Done.wait(lock, [&bands]() { return bands->BandsDone == bands->NumBands; });
+}
+
+
+void Viewer::RunBands(ResampleBands& bands)
+{
+	for (int band = bands.NextBand++; band < bands.NumBands; band = bands.NextBand++)
+	{
+		int start = band * bands.BandSize;
+		bands.Func(start, tMin(start + bands.BandSize, bands.Count));
+		if (++bands.BandsDone == bands.NumBands)
+		{
+			std::lock_guard<std::mutex> lock(bands.Mutex);
+			bands.Done.notify_all();
+		}
+	}
+}
+
+
+#ifdef ARCHITECTURE_X64
+__m128 Viewer::LoadPixelPS(const tPixel* pixel)
+{
+	uint32 bits;
+	tMemcpy(&bits, pixel, sizeof(uint32));
+	__m128i zero = _mm_setzero_si128();
+	__m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(bits)), zero), zero);
+	return _mm_cvtepi32_ps(channels);
+}
+
+
+tPixel Viewer::StorePixelPS(__m128 channels)
+{
+	// Rounds to nearest, then the saturating packs clamp to [0, 255].
+	__m128i packed = _mm_cvtps_epi32(channels);
+	packed = _mm_packs_epi32(packed, packed);
+	packed = _mm_packus_epi16(packed, packed);
+	uint32 bits = uint32(_mm_cvtsi128_si32(packed));
+	tPixel pixel;
+	tMemcpy(&pixel, &bits, sizeof(uint32));
+	return pixel;
+}
+#endif
+
+
+void Viewer::ResampleRows(tPixel* dst, int dstWidth, const tPixel* src, int srcWidth, const ResampleKernels& kernels, int rowStart, int rowEnd)
+{
+	for (int y = rowStart; y < rowEnd; y++)
+	{
+		const tPixel* srcRow = src + y*srcWidth;
+		tPixel* dstRow = dst + y*dstWidth;
+		for (int x = 0; x < dstWidth; x++)
+		{
+			const ResampleKernel& kernel = kernels.Kernels[x];
+			const float* weights = kernels.Weights.data() + kernel.WeightIndex;
+			const tPixel* taps = srcRow + kernel.First;
+
+			#ifdef ARCHITECTURE_X64
+			__m128 sum = _mm_setzero_ps();
+			for (int t = 0; t < kernel.Count; t++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(LoadPixelPS(taps + t), _mm_set1_ps(weights[t])));
+			dstRow[x] = StorePixelPS(sum);
+
+			#else
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int t = 0; t < kernel.Count; t++)
+			{
+				const uint8* channels = (const uint8*)(taps + t);
+				for (int c = 0; c < 4; c++)
+					sum[c] += float(channels[c]) * weights[t];
+			}
+			uint8* out = (uint8*)(dstRow + x);
+			for (int c = 0; c < 4; c++)
+				out[c] = uint8(tClamp(int(sum[c] + 0.5f), 0, 255));
+			#endif
+		}
+	}
+}
+
+
+void Viewer::ResampleColumns(tPixel* dst, int width, const tPixel* src, const ResampleKernels& kernels, int rowStart, int rowEnd)
+{
+	// Whole source rows are accumulated at a time so every read is sequential.
+	float* sums = PixelBuffers.Acquire<float>(width*4);
+	for (int y = rowStart; y < rowEnd; y++)
+	{
+		const ResampleKernel& kernel = kernels.Kernels[y];
+		const float* weights = kernels.Weights.data() + kernel.WeightIndex;
+		tStd::tMemset(sums, 0, width*4*sizeof(float));
+		tPixel* dstRow = dst + y*width;
+
+		for (int t = 0; t < kernel.Count; t++)
+		{
+			const tPixel* srcRow = src + (kernel.First + t)*width;
+			#ifdef ARCHITECTURE_X64
+			__m128 weight = _mm_set1_ps(weights[t]);
+			for (int x = 0; x < width; x++)
+			{
+				__m128 sum = _mm_loadu_ps(sums + x*4);
+				_mm_storeu_ps(sums + x*4, _mm_add_ps(sum, _mm_mul_ps(LoadPixelPS(srcRow + x), weight)));
+			}
+
+			#else
+			const uint8* channels = (const uint8*)srcRow;
+			for (int i = 0; i < width*4; i++)
+				sums[i] += float(channels[i]) * weights[t];
+			#endif
+		}
+
+		#ifdef ARCHITECTURE_X64
+		for (int x = 0; x < width; x++)
+			dstRow[x] = StorePixelPS(_mm_loadu_ps(sums + x*4));
+
+		#else
+		uint8* out = (uint8*)dstRow;
+		for (int i = 0; i < width*4; i++)
+			out[i] = uint8(tClamp(int(sums[i] + 0.5f), 0, 255));
+		#endif
+	}
+	PixelBuffers.Release(sums);
+}
+
+
+void Viewer::HalvePixels(tPixel* dst, const tPixel* src, int srcWidth, int srcHeight, int rowStart, int rowEnd)
+{
+	// Odd sizes repeat the last row or column so the result is (size+1)/2.
+	int dstWidth = (srcWidth + 1) / 2;
+	for (int y = rowStart; y < rowEnd; y++)
+	{
+		const tPixel* row0 = src + (2*y)*srcWidth;
+		const tPixel* row1 = src + tMin(2*y + 1, srcHeight - 1)*srcWidth;
+		tPixel* dstRow = dst + y*dstWidth;
+		int x = 0;
+
+		#ifdef ARCHITECTURE_X64
+		// Two output pixels from four source pixels in each row. Channels are widened to 16 bits for an exact average.
+		__m128i zero = _mm_setzero_si128();
+		__m128i two = _mm_set1_epi16(2);
+		for (; 2*x + 4 <= srcWidth; x += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(row0 + 2*x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(row1 + 2*x));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+			_mm_storel_epi64((__m128i*)(dstRow + x), _mm_packus_epi16(sum, sum));
+		}
+		#endif
+
+		for (; x < dstWidth; x++)
+		{
+			int x0 = 2*x;
+			int x1 = tMin(2*x + 1, srcWidth - 1);
+			const uint8* p[4] = { (const uint8*)(row0 + x0), (const uint8*)(row0 + x1), (const uint8*)(row1 + x0), (const uint8*)(row1 + x1) };
+			uint8* out = (uint8*)(dstRow + x);
+			for (int c = 0; c < 4; c++)
+				out[c] = uint8((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) >> 2);
+		}
+	}
+}
+
+
+bool Viewer::ResamplePicture(tPicture& picture, int width, int height, tPicture::tFilter filter)
+{
+	if (!picture.IsValid() || (width <= 0) || (height <= 0) || (filter == tPicture::tFilter::Invalid))
+		return false;
+
+	int srcW = picture.GetWidth();
+	int srcH = picture.GetHeight();
+	if ((srcW == width) && (srcH == height))
+		return true;
+
+	// Halving is much cheaper than running a wide kernel, and the filter that follows still sees at least a 2x
+	// reduction so the result stays close to filtering the whole way. Intermediate buffers come from the pool. Only the
+	// final one is handed to the picture, so it must be a plain allocation.
+	const tPixel* src = picture.GetPixelPointer();
+	tPixel* halved = nullptr;
+	while ((filter != tPicture::tFilter::NearestNeighbour) && (srcW >= 4*width) && (srcH >= 4*height))
+	{
+		int halfW = (srcW + 1) / 2;
+		int halfH = (srcH + 1) / 2;
+		tPixel* half = PixelBuffers.Acquire<tPixel>(halfW*halfH);
+		ParallelBands(halfH, halfW, [&](int start, int end) { HalvePixels(half, src, srcW, srcH, start, end); });
+		PixelBuffers.Release(halved);
+		halved = half;
+		src = half;
+		srcW = halfW;
+		srcH = halfH;
+	}
+
+	// Horizontal then vertical. Either pass is skipped if that dimension doesn't change.
+	tPixel* rows = nullptr;
+	if (srcW != width)
+	{
+		ResampleKernels kernels;
+		ComputeResampleKernels(kernels, filter, srcW, width);
+		rows = (srcH != height) ? PixelBuffers.Acquire<tPixel>(width*srcH) : new tPixel[width*srcH];
+		ParallelBands(srcH, width, [&](int start, int end) { ResampleRows(rows, width, src, srcW, kernels, start, end); });
+	}
+
+	tPixel* result = rows;
+	if (srcH != height)
+	{
+		ResampleKernels kernels;
+		ComputeResampleKernels(kernels, filter, srcH, height);
+		result = new tPixel[width*height];
+		const tPixel* columns = rows ? rows : src;
+		ParallelBands(height, width, [&](int start, int end) { ResampleColumns(result, width, columns, kernels, start, end); });
+		PixelBuffers.Release(rows);
+	}
+	PixelBuffers.Release(halved);
+
+	tAssert(result);
+	PixelReplace(picture, result, width, height);
+	return true;
+}
@@ -0,0 +1,28 @@
+// Resample.h
+//
+// A separable, multithreaded picture resampler. Filter weights are computed once per output row and column, the
+// horizontal and vertical passes are split into bands that run on a thread pool, and the inner loops use SSE2 on x64.
+// Large reductions first halve the picture with an integer 2x2 box filter until the remaining ratio is small.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Image/tPicture.h>
+
+
+namespace Viewer
+{
+	// A drop-in replacement for tPicture::Resample. The picture's filename, duration, and source format are kept. Safe
+	// to call from any thread, including from tasks running on another thread pool, as the calling thread always works
+	// through the bands itself rather than waiting on the pool. Returns false if the picture is invalid or the size is
+	// not positive.
+	bool ResamplePicture(tImage::tPicture&, int width, int height, tImage::tPicture::tFilter = tImage::tPicture::tFilter::Bilinear);
+}
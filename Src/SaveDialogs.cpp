@@ -12,8 +12,11 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <vector>
+#include <System/tMachine.h>
 #include "imgui.h"
 #include "SaveDialogs.h"
+#include "Batch.h"
 #include "Image.h"
 #include "TacentView.h"
 using namespace tStd;
@@ -24,12 +27,17 @@ using namespace tImage;
 
 namespace Viewer
 {
-	void SaveAllImages(const tString& destDir, const tString& extension, float percent, int width, int height);
+	// Save All runs in the background. The progress modal calls Update every frame and applies the results to the image
+	// list once the saver is finished.
+	BatchSaver* SaveAllSaver = nullptr;
+	tString SaveAllCurrFile;
+	const int SaveAllMaxInFlightMB = 512;
+
+	void StartSaveAllImages(const tString& destDir, const tString& extension, float percent, int width, int height);
+	void FinishSaveAllImages();
+	void DoSaveAllProgressModal(bool& finished);
 	void GetFilesNeedingOverwrite(const tString& destDir, tListZ<tStringItem>& overwriteFiles, const tString& extension);
 	void AddSavedImageIfNecessary(const tString& savedFile);
-
-	// This function saves the picture to the filename specified.
-	bool SaveImageAs(Image&, const tString& outFile, int width, int height, float scale = 1.0f, Settings::SizeMode = Settings::SizeMode::SetWidthAndHeight);
 }
 
 
@@ -64,16 +72,7 @@ tString Viewer::DoSaveFiletype()
 	ImGui::SameLine();
 	ShowHelpMark("Output image format. TGA, PNG, and BMP support an alpha channel.");
 
-	tString extension = ".tga";
-	switch (Config.SaveFileType)
-	{
-		case 0: extension = ".tga"; break;
-		case 1: extension = ".png"; break;
-		case 2: extension = ".bmp"; break;
-		case 3: extension = ".jpg"; break;
-		case 4: extension = ".gif"; break;
-	}
-
+	tString extension = GetSaveFileTypeExtension(Config.SaveFileType);
 	if (Config.SaveFileType == 0)
 		ImGui::Checkbox("RLE Compression", &Config.SaveFileTargaRLE);
 	else if (Config.SaveFileType == 3)
@@ -83,75 +82,6 @@ tString Viewer::DoSaveFiletype()
 }
 
 
-bool Viewer::SaveImageAs(Image& img, const tString& outFile, int width, int height, float scale, Settings::SizeMode sizeMode)
-{
-	// We make sure to maintain the loaded/unloaded state. This function may be called many times in succession
-	// so we don't want them all in memory at once by indiscriminantly loading them all.
-	bool imageLoaded = img.IsLoaded();
-	if (!imageLoaded)
-		img.Load();
-
-	tPicture* currPic = img.GetCurrentPic();
-	if (!currPic)
-		return false;
-
-	// Make a temp copy we can safely resize.
-	tImage::tPicture outPic;
-	outPic.Set(*currPic);
-
-	// Restore loadedness.
-	if (!imageLoaded)
-		img.Unload();
-
-	int outW = outPic.GetWidth();
-	int outH = outPic.GetHeight();
-	float aspect = float(outW) / float(outH);
-
-	switch (sizeMode)
-	{
-		case Settings::SizeMode::Percent:
-			if (tMath::tApproxEqual(scale, 1.0f, 0.01f))
-				break;
-			outW = int( tRound(float(outW)*scale) );
-			outH = int( tRound(float(outH)*scale) );
-			break;
-
-		case Settings::SizeMode::SetWidthAndHeight:
-			outW = width;
-			outH = height;
-			break;
-
-		case Settings::SizeMode::SetWidthRetainAspect:
-			outW = width;
-			outH = int( tRound(float(width) / aspect) );
-			break;
-
-		case Settings::SizeMode::SetHeightRetainAspect:
-			outH = height;
-			outW = int( tRound(float(height) * aspect) );
-			break;
-	};
-	tMath::tiClampMin(outW, 4);
-	tMath::tiClampMin(outH, 4);
-
-	if ((outPic.GetWidth() != outW) || (outPic.GetHeight() != outH))
-		outPic.Resample(outW, outH, tImage::tPicture::tFilter(Config.ResampleFilter));
-
-	bool success = false;
-	tImage::tPicture::tColourFormat colourFmt = outPic.IsOpaque() ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
-	if (Config.SaveFileType == 0)
-		success = outPic.SaveTGA(outFile, tImage::tImageTGA::tFormat::Auto, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
-	else
-		success = outPic.Save(outFile, colourFmt, Config.SaveFileJpegQuality);
-
-	if (success)
-		tPrintf("Saved image as %s\n", outFile.Chars());
-	else
-		tPrintf("Failed to save image %s\n", outFile.Chars());
-
-	return success;
-}
-
 
 void Viewer::DoSaveAsModalDialog(bool justOpened)
 {
@@ -400,7 +330,8 @@ void Viewer::DoSaveAllModalDialog(bool justOpened)
 	ImGui::SetCursorPosX(ImGui::GetWindowContentRegionMax().x - 100.0f);
 	static tListZ<tStringItem> overwriteFiles;
 	bool closeThisModal = false;
-	if (ImGui::Button("Save All", tVector2(100, 0)))
+	bool openProgress = false;
+	if (ImGui::Button("Save All", tVector2(100, 0)) && !SaveAllSaver)
 	{
 		bool dirExists = tDirExists(destDir);
 		if (!dirExists)
@@ -419,8 +350,8 @@ void Viewer::DoSaveAllModalDialog(bool justOpened)
 			}
 			else
 			{
-				SaveAllImages(destDir, extension, percent, width, height);
-				closeThisModal = true;
+				StartSaveAllImages(destDir, extension, percent, width, height);
+				openProgress = true;
 			}
 		}
 	}
@@ -432,9 +363,23 @@ void Viewer::DoSaveAllModalDialog(bool justOpened)
 		bool pressedOK = false, pressedCancel = false;
 		DoOverwriteMultipleFilesModal(overwriteFiles, pressedOK, pressedCancel);
 		if (pressedOK)
-			SaveAllImages(destDir, extension, percent, width, height);
+		{
+			StartSaveAllImages(destDir, extension, percent, width, height);
+			openProgress = true;
+		}
+		else if (pressedCancel)
+			closeThisModal = true;
+	}
 
-		if (pressedOK || pressedCancel)
+	if (openProgress)
+		ImGui::OpenPopup("Saving All");
+
+	// No close button. The user must cancel so in-flight images are finished before the modal goes away.
+	if (ImGui::BeginPopupModal("Saving All", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+	{
+		bool finished = false;
+		DoSaveAllProgressModal(finished);
+		if (finished)
 			closeThisModal = true;
 	}
 
@@ -507,39 +452,107 @@ void Viewer::DoOverwriteMultipleFilesModal(const tListZ<tStringItem>& overwriteF
 }
 
 
-void Viewer::SaveAllImages(const tString& destDir, const tString& extension, float percent, int width, int height)
+void Viewer::StartSaveAllImages(const tString& destDir, const tString& extension, float percent, int width, int height)
 {
+	tAssert(!SaveAllSaver);
 	float scale = percent/100.0f;
-	tString currFile = CurrImage ? CurrImage->Filename : tString();
+	SaveAllCurrFile = CurrImage ? CurrImage->Filename : tString();
 
-	bool anySaved = false;
+	std::vector<BatchSaver::Job> jobs;
+	jobs.reserve(Images.GetNumItems());
 	for (Image* image = Images.First(); image; image = image->Next())
 	{
-		tString baseName = tSystem::tGetFileBaseName(image->Filename);
-		tString outFile = destDir + tString(baseName) + extension;
+		BatchSaver::Job job;
+		job.SrcFile = image->Filename;
+		job.OutFile = destDir + tSystem::tGetFileBaseName(image->Filename) + extension;
+		job.PartNum = image->PartNum;
+
+		// Edits only exist in memory so dirty images are copied now rather than loaded from disk. A dirty image may
+		// have been unloaded, in which case loading it replays its edits. Other images may still have edits, saved to
+		// another file, so the saver loads them with this image's edits and load params.
+		if (image->IsDirty())
+		{
+			bool imageLoaded = image->IsLoaded();
+			image->Load();
+			image->UpdateEdits(true);
+			tPicture* currPic = image->GetCurrentPic();
+			if (currPic)
+				job.Picture = new tPicture(*currPic);
+			job.Opaque = image->IsOpaque();
+			if (!imageLoaded)
+				image->Unload();
+		}
+		else
+		{
+			job.Loader = new Image(image->Filename);
+			job.Loader->CopyEdits(*image);
+		}
+		jobs.push_back(job);
+	}
 
-		bool ok = SaveImageAs(*image, outFile, width, height, scale, Settings::SizeMode(Config.SaveAllSizeMode));
-		if (ok)
+	// Leave a core for the UI.
+	int numThreads = tMath::tMax(tSystem::tGetNumCores() - 1, 1);
+	SaveAllSaver = new BatchSaver(numThreads, SaveAllMaxInFlightMB);
+	SaveAllSaver->Start(jobs, width, height, scale, Settings::SizeMode(Config.SaveAllSizeMode));
+}
+
+
+void Viewer::FinishSaveAllImages()
+{
+	tAssert(SaveAllSaver);
+	const std::vector<tString>& savedFiles = SaveAllSaver->GetSavedFiles();
+	for (const tString& outFile : savedFiles)
+	{
+		Image* foundImage = FindImage(outFile);
+		if (foundImage)
 		{
-			Image* foundImage = FindImage(outFile);
-			if (foundImage)
-			{
-				foundImage->Unload(true);
-				foundImage->ClearDirty();
-				foundImage->RequestInvalidateThumbnail();
-			}
-			else
-				AddSavedImageIfNecessary(outFile);
-			anySaved = true;
+			foundImage->Unload(true);
+			foundImage->ClearDirty();
+			foundImage->RequestInvalidateThumbnail();
 		}
+		else
+			AddSavedImageIfNecessary(outFile);
 	}
 
 	// If we saved to the same dir we are currently viewing we need to reload and set the current image again.
-	if (anySaved)
+	if (!savedFiles.empty())
 	{
 		SortImages(Settings::SortKeyEnum(Config.SortKey), Config.SortAscending);
-		SetCurrentImage(currFile);
+		SetCurrentImage(SaveAllCurrFile);
+	}
+
+	delete SaveAllSaver;
+	SaveAllSaver = nullptr;
+}
+
+
+void Viewer::DoSaveAllProgressModal(bool& finished)
+{
+	tAssert(SaveAllSaver);
+	bool working = SaveAllSaver->Update();
+
+	int numJobs = SaveAllSaver->GetNumJobs();
+	int numDone = SaveAllSaver->GetNumDone();
+	tString progressText;
+	tsPrintf(progressText, "%d/%d", numDone, numJobs);
+	ImGui::Text("Saving %d images.", numJobs);
+	ImGui::ProgressBar((numJobs > 0) ? float(numDone)/float(numJobs) : 1.0f, tVector2(300.0f, 0.0f), progressText.Chars());
+	if (SaveAllSaver->GetNumFailed() > 0)
+		ImGui::Text("%d failed. See the log for details.", SaveAllSaver->GetNumFailed());
+
+	ImGui::NewLine();
+	if (SaveAllSaver->IsCancelled())
+		ImGui::Text("Cancelling...");
+	else if (ImGui::Button("Cancel", tVector2(100, 0)))
+		SaveAllSaver->Cancel();
+
+	if (!working)
+	{
+		FinishSaveAllImages();
+		finished = true;
+		ImGui::CloseCurrentPopup();
 	}
+	ImGui::EndPopup();
 }
 
 
@@ -555,6 +568,7 @@ void Viewer::AddSavedImageIfNecessary(const tString& savedFile)
 		Image* newImg = new Image(savedFile);
 		Images.Append(newImg);
 		ImagesLoadTimeSorted.Append(newImg);
+		ImagesVersion++;
 	}
 }
 
@@ -0,0 +1,429 @@
+// Sequence.cpp
+//
+// Playback of numbered image sequences like explosion-frame000.png, explosion-frame001.png, etc. Frames are decoded
+// ahead of the playhead on worker threads into a cache with a fixed memory limit, and shown at a fixed frame rate.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <System/tFile.h>
+#include <Math/tFundamentals.h>
+#include "Sequence.h"
+using namespace tStd;
+using namespace tSystem;
+using namespace tMath;
+
+
+namespace Viewer
+{
+	// Decodes in flight are limited to this many per worker so frames far ahead don't hold up the ones due next.
+	const int SequenceDecodesPerThread = 2;
+
+	// Gets the path without the frame number, and the number. Returns false if the base name doesn't end in digits.
+	bool SplitSequenceName(const tString& filename, tString& prefix, int& number);
+}
+
+
+bool Viewer::SplitSequenceName(const tString& filename, tString& prefix, int& number)
+{
+	tString name = tGetDir(filename) + tGetFileBaseName(filename);
+	const char* chars = name.Chars();
+	int end = name.Length();
+	int start = end;
+	while ((start > 0) && isdigit(chars[start-1]))
+		start--;
+
+	// More than 9 digits would not fit in an int.
+	if ((start == end) || ((end - start) > 9))
+		return false;
+
+	prefix = name.Left(start);
+	number = atoi(chars + start);
+	return true;
+}
+
+
+int Viewer::FindImageSequence(std::vector<Image*>& frames, tList<Image>& images, Image* image)
+{
+	frames.clear();
+	tString prefix;
+	int number = 0;
+	if (!image || !SplitSequenceName(image->Filename, prefix, number))
+		return -1;
+
+	std::vector<std::pair<int, Image*>> numbered;
+	for (Image* img = images.First(); img; img = img->Next())
+	{
+		tString imgPrefix;
+		int imgNumber = 0;
+		if ((img->Filetype == image->Filetype) && SplitSequenceName(img->Filename, imgPrefix, imgNumber) && imgPrefix.IsEqualCI(prefix))
+			numbered.push_back(std::make_pair(imgNumber, img));
+	}
+	if (numbered.size() < 2)
+		return -1;
+
+	// Stable so frame007 and frame7 keep the order of the image list.
+	std::stable_sort
+	(
+		numbered.begin(), numbered.end(),
+		[](const std::pair<int, Image*>& a, const std::pair<int, Image*>& b) { return a.first < b.first; }
+	);
+
+	int index = -1;
+	for (const std::pair<int, Image*>& frame : numbered)
+	{
+		if (frame.second == image)
+			index = int(frames.size());
+		frames.push_back(frame.second);
+	}
+	return index;
+}
+
+
+void Viewer::SequencePlayer::Start(const std::vector<Image*>& frames, int startFrame, float fps, bool dropFrames, bool looping, int cacheMB)
+{
+	Stop();
+	if (frames.empty())
+		return;
+
+	std::vector<Frame>(frames.size()).swap(Frames);
+	for (int f = 0; f < int(frames.size()); f++)
+	{
+		Frames[f].Source = frames[f];
+		if (frames[f]->IsLoaded())
+			Frames[f].State = FrameState::Resident;
+	}
+
+	FPS = tMax(fps, 1.0f);
+	DropFrames = dropFrames;
+	Looping = looping;
+	MaxCacheBytes = int64(tMax(cacheMB, 1)) * 1024 * 1024;
+	FrameBytesEstimate = 0;
+	NumDecoding = 0;
+	Cancelled = false;
+
+	Shown = -1;
+	Displayed = -1;
+	Due = tClamp(startFrame, 0, int(frames.size())-1);
+	Clock = 0.0;
+
+	AchievedFPS = 0.0f;
+	RateTime = 0.0;
+	RateFrames = 0;
+	NumDropped = 0;
+	NumCached = 0;
+	CacheBytes = 0;
+
+	Playing = true;
+	FillAhead();
+}
+
+
+void Viewer::SequencePlayer::Stop()
+{
+	if (Frames.empty())
+		return;
+
+	Cancelled = true;
+	Pool.WaitIdle();
+
+	// The displayed frame's pictures are in its image, which from now on is managed by the viewer like any other.
+	for (int f = 0; f < int(Frames.size()); f++)
+		FreeFrame(f);
+
+	Frames.clear();
+	Playing = false;
+	Shown = -1;
+	Displayed = -1;
+	NumDecoding = 0;
+	NumCached = 0;
+	CacheBytes = 0;
+}
+
+
+Image* Viewer::SequencePlayer::Update(double dt)
+{
+	if (!Playing)
+		return nullptr;
+
+	UpdateCacheBytes();
+	double frameDuration = 1.0 / double(FPS);
+	bool ended = false;
+	if (Shown < 0)
+	{
+		// The clock doesn't start until the first frame is up.
+		if (IsShowable(Due))
+			ShowFrame(Due);
+	}
+	else if (DropFrames)
+	{
+		// The due frame follows the clock whether or not frames are ready. Frames passed over are dropped.
+		Clock += dt;
+		while (Clock >= frameDuration)
+		{
+			int next = GetNextFrame(Due);
+			if (next < 0)
+			{
+				ended = (Shown == Due);
+				break;
+			}
+			Clock -= frameDuration;
+			Due = next;
+		}
+
+		if ((Due != Shown) && IsShowable(Due))
+			ShowFrame(Due);
+	}
+	else
+	{
+		// The next frame is shown once it's due and ready. Time spent waiting is not caught up on afterwards.
+		Clock += dt;
+		if (Clock >= frameDuration)
+		{
+			int next = GetNextFrame(Shown);
+			if (next < 0)
+			{
+				ended = true;
+			}
+			else if (IsShowable(next))
+			{
+				Due = next;
+				ShowFrame(next);
+				Clock = tMin(Clock - frameDuration, frameDuration);
+			}
+			else
+			{
+				Due = next;
+				Clock = frameDuration;
+			}
+		}
+	}
+
+	if (Shown >= 0)
+	{
+		RateTime += dt;
+		if (RateTime >= 1.0)
+		{
+			AchievedFPS = float(double(RateFrames) / RateTime);
+			RateTime = 0.0;
+			RateFrames = 0;
+		}
+	}
+
+	Image* image = (Displayed >= 0) ? Frames[Displayed].Source : nullptr;
+	if (ended)
+		Stop();
+	else
+		FillAhead();
+
+	return image;
+}
+
+
+int Viewer::SequencePlayer::GetNextFrame(int frame) const
+{
+	int numFrames = GetNumFrames();
+	if (frame+1 < numFrames)
+		return frame+1;
+
+	return Looping ? 0 : -1;
+}
+
+
+int Viewer::SequencePlayer::GetDistanceAhead(int frame) const
+{
+	// When not looping, frames behind the due one are never needed again so they are the furthest away.
+	int numFrames = GetNumFrames();
+	if (Looping)
+		return (frame - Due + numFrames) % numFrames;
+
+	return (frame >= Due) ? (frame - Due) : (numFrames + Due - frame);
+}
+
+
+bool Viewer::SequencePlayer::IsShowable(int frame) const
+{
+	FrameState state = Frames[frame].State;
+	return (state == FrameState::Ready) || (state == FrameState::Lent) || (state == FrameState::Resident) || (state == FrameState::Failed);
+}
+
+
+void Viewer::SequencePlayer::ShowFrame(int frame)
+{
+	if (Shown >= 0)
+	{
+		int numFrames = GetNumFrames();
+		int distance = (frame - Shown + numFrames) % numFrames;
+		NumDropped += tMax(distance-1, 0);
+	}
+	Shown = frame;
+	RateFrames++;
+
+	// A frame that failed to load is counted as shown but the previous one stays up.
+	Frame& f = Frames[frame];
+	if ((f.State == FrameState::Failed) || (frame == Displayed))
+		return;
+
+	if ((f.State == FrameState::Ready) && f.Source->IsLoaded())
+	{
+		FreeFrame(frame);
+		f.State = FrameState::Resident;
+	}
+	else if (f.State == FrameState::Ready)
+	{
+		f.Source->TakePictures(*f.Loader);
+		f.State = FrameState::Lent;
+	}
+
+	if (Displayed >= 0)
+		ReturnFrame(Displayed);
+	Displayed = frame;
+}
+
+
+void Viewer::SequencePlayer::ReturnFrame(int frame)
+{
+	Frame& f = Frames[frame];
+	if (f.State != FrameState::Lent)
+		return;
+
+	// The image's edits were applied to the pictures when it took them. Those aren't kept as the loader would apply
+	// them again.
+	if (f.Source->CanUndo() || !f.Source->IsLoaded())
+	{
+		f.Source->Unload();
+		FreeFrame(frame);
+		return;
+	}
+
+	f.Loader->TakePictures(*f.Source);
+	f.State = FrameState::Ready;
+}
+
+
+void Viewer::SequencePlayer::FreeFrame(int frame)
+{
+	Frame& f = Frames[frame];
+	tAssert(f.State != FrameState::Decoding);
+	delete f.Loader;
+	f.Loader = nullptr;
+	f.Bytes = 0;
+	if (f.State != FrameState::Resident)
+		f.State = FrameState::Empty;
+}
+
+
+void Viewer::SequencePlayer::Decode(Frame* frame)
+{
+	// The loader was made on the main thread and nothing else touches it until the state changes.
+	if (!Cancelled)
+		frame->Loader->Load();
+
+	frame->Bytes = frame->Loader->Info.MemSizeBytes;
+	frame->State = frame->Loader->IsLoaded() ? FrameState::Ready : FrameState::Failed;
+}
+
+
+void Viewer::SequencePlayer::FillAhead()
+{
+	int numFrames = GetNumFrames();
+	int maxDecoding = (FrameBytesEstimate > 0) ? SequenceDecodesPerThread*Pool.GetNumThreads() : 1;
+	int frame = Due;
+	for (int ahead = 0; (ahead < numFrames) && (frame >= 0) && (NumDecoding < maxDecoding); ahead++, frame = GetNextFrame(frame))
+	{
+		Frame& f = Frames[frame];
+		if (f.State != FrameState::Empty)
+			continue;
+
+		// Frames further behind are evicted to make room. The due frame is always decoded if nothing else is in
+		// flight, so playback can't stall on a frame bigger than the whole cache.
+		bool mustDecode = (ahead == 0) && (NumDecoding == 0);
+		while (CacheBytes + FrameBytesEstimate > MaxCacheBytes)
+		{
+			if (!EvictBehind(ahead))
+				break;
+		}
+		if ((CacheBytes + FrameBytesEstimate > MaxCacheBytes) && !mustDecode)
+			return;
+
+		f.Loader = new Image(f.Source->Filename);
+		f.Loader->LoadParams = f.Source->LoadParams;
+		f.State = FrameState::Decoding;
+		CacheBytes += FrameBytesEstimate;
+		NumDecoding++;
+
+		// Dds files need GL to decode so they are done right here.
+		Frame* framePtr = &f;
+		if (f.Source->Filetype == tFileType::DDS)
+			Decode(framePtr);
+		else
+			Pool.Submit([this, framePtr]() { Decode(framePtr); });
+	}
+}
+
+
+bool Viewer::SequencePlayer::EvictBehind(int distanceAhead)
+{
+	int victim = -1;
+	int victimDistance = distanceAhead;
+	for (int f = 0; f < GetNumFrames(); f++)
+	{
+		if (Frames[f].State != FrameState::Ready)
+			continue;
+
+		int distance = GetDistanceAhead(f);
+		if (distance > victimDistance)
+		{
+			victim = f;
+			victimDistance = distance;
+		}
+	}
+
+	if (victim < 0)
+		return false;
+
+	CacheBytes -= Frames[victim].Bytes;
+	NumCached--;
+	FreeFrame(victim);
+	return true;
+}
+
+
+void Viewer::SequencePlayer::UpdateCacheBytes()
+{
+	// Frames still decoding are counted at the estimated size as their real size isn't known yet. The estimate is the
+	// biggest frame seen so the limit holds as long as the frames are all about the same size.
+	NumDecoding = 0;
+	NumCached = 0;
+	CacheBytes = 0;
+	for (Frame& f : Frames)
+	{
+		switch (f.State)
+		{
+			case FrameState::Decoding:
+				NumDecoding++;
+				break;
+
+			case FrameState::Ready:
+			case FrameState::Lent:
+				NumCached++;
+				CacheBytes += f.Bytes;
+				FrameBytesEstimate = tMax(FrameBytesEstimate, f.Bytes);
+				break;
+
+			default:
+				break;
+		}
+	}
+	CacheBytes += int64(NumDecoding) * FrameBytesEstimate;
+}
@@ -0,0 +1,118 @@
+// Sequence.h
+//
+// Playback of numbered image sequences like explosion-frame000.png, explosion-frame001.png, etc. Frames are decoded
+// ahead of the playhead on worker threads into a cache with a fixed memory limit, and shown at a fixed frame rate.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <Foundation/tList.h>
+#include "Image.h"
+#include "ThreadPool.h"
+
+
+namespace Viewer
+{
+	// Finds the images in the same folder and of the same type whose names differ from the given image's only in the
+	// run of digits at the end of the base name. They are returned in frame number order. Returns the index of the
+	// image in frames, or -1 if it is not part of a sequence of at least two frames.
+	int FindImageSequence(std::vector<Image*>& frames, tList<Image>& images, Image* image);
+
+	// Plays a sequence of images from the viewer's image list. While a frame is shown the decoded pictures are given to
+	// its Image so it can be drawn like any other. When the playhead moves on they are taken back into the cache. Images
+	// the viewer already had loaded are shown as they are. Nothing may add or remove images while playing.
+	class SequencePlayer
+	{
+	public:
+		SequencePlayer(int numThreads)																					: Pool(numThreads) { }
+
+		// Waits for in-flight decodes.
+		~SequencePlayer()																								{ Stop(); }
+
+		// When dropFrames is false every frame is shown even if that means playing slower than the frame rate. When
+		// true the playhead follows the clock and frames that aren't decoded in time are skipped. The cache, including
+		// frames being decoded, is kept under cacheMB. Must be called from the main thread, as are all other functions.
+		void Start(const std::vector<Image*>& frames, int startFrame, float fps, bool dropFrames, bool looping, int cacheMB);
+
+		// The frame being shown, if any, stays loaded. All cached frames are freed.
+		void Stop();
+		bool IsPlaying() const																							{ return Playing; }
+
+		// Call once per frame. Advances the playhead and keeps the decode-ahead ring full. Returns the image to show,
+		// which may be the same one as last time. Returns null until the first frame is ready. Playback stops by itself
+		// after the last frame when not looping.
+		Image* Update(double dt);
+
+		int GetFrame() const																							{ return Shown; }
+		int GetNumFrames() const																						{ return int(Frames.size()); }
+		float GetFPS() const																							{ return FPS; }
+		float GetAchievedFPS() const																					{ return AchievedFPS; }
+		int GetNumDropped() const																						{ return NumDropped; }
+		int GetNumCached() const																						{ return NumCached; }
+		int64 GetCacheBytes() const																						{ return CacheBytes; }
+
+	private:
+		enum class FrameState
+		{
+			Empty,
+			Decoding,
+			Ready,			// The Loader has the decoded pictures.
+			Lent,			// Being shown. The pictures are in the Source image.
+			Resident,		// Was already loaded by the viewer.
+			Failed
+		};
+
+		struct Frame
+		{
+			Image* Source						= nullptr;
+			Image* Loader						= nullptr;
+			int64 Bytes							= 0;
+			std::atomic<FrameState> State		{ FrameState::Empty };
+		};
+
+		int GetNextFrame(int frame) const;					// Returns -1 past the end when not looping.
+		int GetDistanceAhead(int frame) const;				// Frames from the due frame in play order.
+		bool IsShowable(int frame) const;
+		void ShowFrame(int frame);
+		void ReturnFrame(int frame);
+		void FreeFrame(int frame);
+		void Decode(Frame*);
+		void FillAhead();
+		bool EvictBehind(int distanceAhead);				// Returns false if there was nothing to evict.
+		void UpdateCacheBytes();
+
+		ThreadPool Pool;
+		std::vector<Frame> Frames;
+		bool Playing						= false;
+		float FPS							= 24.0f;
+		bool DropFrames						= true;
+		bool Looping						= true;
+		int64 MaxCacheBytes					= 0;
+		int64 FrameBytesEstimate			= 0;		// Biggest decoded frame so far. Zero until one is.
+		int NumDecoding						= 0;
+		std::atomic<bool> Cancelled			{ false };
+
+		int Shown							= -1;		// The playhead.
+		int Displayed						= -1;		// Differs from Shown if that frame failed to load.
+		int Due								= 0;
+		double Clock						= 0.0;
+
+		// Stats. The achieved rate is measured over roughly a second.
+		float AchievedFPS					= 0.0f;
+		double RateTime						= 0.0;
+		int RateFrames						= 0;
+		int NumDropped						= 0;
+		int NumCached						= 0;
+		int64 CacheBytes					= 0;
+	};
+}
@@ -45,13 +45,21 @@ void Viewer::Settings::ResetBehaviourSettings()
 	SlideshowLooping			= false;
 	SlideshowProgressArc		= true;
 	SlidehowFrameDuration		= 8.0;			// Values as small as 1.0/30.0 also work.
+	SequenceFPS					= 24.0f;
+	SequenceDropFrames			= true;
+	SequenceCacheMB				= 1024;
 	SaveSubFolder				.Clear();
 	SaveFileType				= 0;
 	SaveFileTargaRLE			= false;
 	SaveFileJpegQuality			= 95;
 	SaveAllSizeMode				= 0;
 	MaxImageMemMB				= 1024;
+	AdaptiveImageMem			= true;
+	MaxAdaptiveMemMB			= 16384;
+	MaxCompressedMemMB			= 512;
 	MaxCacheFiles				= 7000;
+	MaxPixelCacheMB				= 0;
+	CompressThumbnails			= true;
 	AutoPropertyWindow			= true;
 	AutoPlayAnimatedImages		= true;
 	MonitorGamma				= tMath::DefaultGamma;
@@ -111,13 +119,21 @@ void Viewer::Settings::Load(const tString& filename, int screenW, int screenH)
 				ReadItem(SlideshowLooping);
 				ReadItem(SlideshowProgressArc);
 				ReadItem(SlidehowFrameDuration);
+				ReadItem(SequenceFPS);
+				ReadItem(SequenceDropFrames);
+				ReadItem(SequenceCacheMB);
 				ReadItem(SaveSubFolder);
 				ReadItem(SaveFileType);
 				ReadItem(SaveFileTargaRLE);
 				ReadItem(SaveFileJpegQuality);
 				ReadItem(SaveAllSizeMode);
 				ReadItem(MaxImageMemMB);
+				ReadItem(AdaptiveImageMem);
+				ReadItem(MaxAdaptiveMemMB);
+				ReadItem(MaxCompressedMemMB);
 				ReadItem(MaxCacheFiles);
+				ReadItem(MaxPixelCacheMB);
+				ReadItem(CompressThumbnails);
 				ReadItem(AutoPropertyWindow);
 				ReadItem(AutoPlayAnimatedImages);
 				ReadItem(MonitorGamma);
@@ -136,7 +152,12 @@ void Viewer::Settings::Load(const tString& filename, int screenW, int screenH)
 	tiClamp(ThumbnailWidth, float(Image::ThumbMinDispWidth), float(Image::ThumbWidth));
 	tiClamp(SortKey, 0, 3);
 	tiClampMin(MaxImageMemMB, 256);
+	tiClampMin(MaxAdaptiveMemMB, 256);
+	tiClampMin(MaxCompressedMemMB, 0);
 	tiClampMin(MaxCacheFiles, 200);
+	tiClampMin(MaxPixelCacheMB, 0);
+	tiClamp(SequenceFPS, 1.0f, 240.0f);
+	tiClampMin(SequenceCacheMB, 64);
 	tiClamp(SaveAllSizeMode, 0, 3);
 	tiClamp(SaveFileJpegQuality, 1, 100);
 }
@@ -169,13 +190,21 @@ bool Viewer::Settings::Save(const tString& filename)
 	WriteItem(SlideshowLooping);
 	WriteItem(SlideshowProgressArc);
 	WriteItem(SlidehowFrameDuration);
+	WriteItem(SequenceFPS);
+	WriteItem(SequenceDropFrames);
+	WriteItem(SequenceCacheMB);
 	WriteItem(SaveSubFolder);
 	WriteItem(SaveFileType);
 	WriteItem(SaveFileTargaRLE);
 	WriteItem(SaveFileJpegQuality);
 	WriteItem(SaveAllSizeMode);
 	WriteItem(MaxImageMemMB);
+	WriteItem(AdaptiveImageMem);
+	WriteItem(MaxAdaptiveMemMB);
+	WriteItem(MaxCompressedMemMB);
 	WriteItem(MaxCacheFiles);
+	WriteItem(MaxPixelCacheMB);
+	WriteItem(CompressThumbnails);
 	WriteItem(AutoPropertyWindow);
 	WriteItem(AutoPlayAnimatedImages);
 	WriteItem(MonitorGamma);
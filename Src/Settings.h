@@ -59,6 +59,9 @@ namespace Viewer
 		bool SlideshowLooping;
 		bool SlideshowProgressArc;
 		double SlidehowFrameDuration;
+		float SequenceFPS;					// Numbered image sequence playback rate.
+		bool SequenceDropFrames;			// Skip frames that aren't decoded in time rather than slowing down.
+		int SequenceCacheMB;				// Max memory for decoded sequence frames, including those being decoded.
 
 		tString SaveSubFolder;
 		int SaveFileType;
@@ -72,8 +75,13 @@ namespace Viewer
 			SetHeightRetainAspect
 		};
 		int SaveAllSizeMode;
-		int MaxImageMemMB;					// Max image mem before unloading images.
+		int MaxImageMemMB;					// Max image mem before unloading images. Used when not adaptive.
+		bool AdaptiveImageMem;				// Image mem limit follows free system memory and pressure, up to MaxAdaptiveMemMB.
+		int MaxAdaptiveMemMB;				// The adaptive limit never goes above this.
+		int MaxCompressedMemMB;				// Unloaded images are kept compressed up to this. Zero disables.
 		int MaxCacheFiles;					// Max number of cache files before removing oldest.
+		int MaxPixelCacheMB;				// Disk used to cache the decoded pixels of slow files. Zero disables.
+		bool CompressThumbnails;			// Thumbnails are kept BC compressed in memory, on the GPU and in the cache.
 		bool AutoPropertyWindow;			// Auto display property editor window for supported file types.
 		bool AutoPlayAnimatedImages;		// Automatically play animated gifs and WebPs.
 		float MonitorGamma;					// Used when displaying HDR formats to do gamma correction.
@@ -34,6 +34,7 @@
 #include <System/tMachine.h>
 #include <Math/tHash.h>
 #include <Math/tVector2.h>
+#include <Math/tVector3.h>
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl2.h"
@@ -45,7 +46,14 @@
 #include "ContentView.h"
 #include "Crop.h"
 #include "SaveDialogs.h"
+#include "Batch.h"
+#include "Sequence.h"
+#include "CommandLine.h"
 #include "Settings.h"
+#include "Profile.h"
+#include "MemoryBudget.h"
+#include "BufferPool.h"
+#include "ContentKey.h"
 #include "Version.cmake.h"
 using namespace tStd;
 using namespace tSystem;
@@ -61,6 +69,7 @@ namespace Viewer
 	tList<Image> Images;
 	tItList<Image> ImagesLoadTimeSorted	(false);
 	tuint256 ImagesHash							= 0;
+	int ImagesVersion							= 0;
 	Image* CurrImage							= nullptr;
 	
 	void LoadAppImages(const tString& dataDir);
@@ -100,6 +109,34 @@ namespace Viewer
 	double DisappearCountdown					= DisappearDuration;
 	double SlideshowCountdown					= 0.0;
 	bool SlideshowPlaying						= false;
+
+	// Plays the numbered image sequence the current image is part of. Leaves a core for the UI.
+	SequencePlayer Sequence(tMax(int(std::thread::hardware_concurrency()) - 1, 1));
+	void ToggleSequence();
+	void UpdateSequence(double dt);
+
+	// Holding an arrow key makes each image current without decoding it, and its thumbnail is drawn instead. The full
+	// decode starts on a worker once the key is released or the repeats stop. Moving on cancels a decode that has not
+	// started yet and throws away the result of one that has.
+	struct NavDecode
+	{
+		Image* Loader							= nullptr;
+		bool Loaded								= false;
+		std::atomic<bool> Cancelled				{ false };
+		std::atomic<bool> Done					{ false };
+	};
+	ThreadPool NavPool(2);
+	std::vector<NavDecode*> NavDecodes;
+	NavDecode* NavCurrDecode					= nullptr;		// The one for the current image, if any.
+	bool NavPending								= false;		// The current image is waiting for its decode.
+	double NavSettleCountdown					= 0.0;
+	const double NavSettleDuration				= 0.25;
+	void Navigate(Image*);
+	void CancelNavigation();
+	void UpdateNavigation(double dt);
+	void DrawNavThumbnail(float width, float height);
+	void ShowCurrImage(bool imgJustLoaded);
+	void EvictImages();
 	bool FullscreenMode							= false;
 	bool WindowIconified						= false;
 	bool ShowCheatSheet							= false;
@@ -110,6 +147,7 @@ namespace Viewer
 	bool Request_DeleteFileModal				= false;
 	bool Request_DeleteFileNoRecycleModal		= false;
 	bool PrefsWindow							= false;
+	bool ProfilerWindow							= false;
 	bool PropEditorWindow						= false;
 	bool CropMode								= false;
 	bool LMBDown								= false;
@@ -119,6 +157,24 @@ namespace Viewer
 	int DragAnchorX								= 0;
 	int DragAnchorY								= 0;
 
+	// A rectangle of the current image selected by shift-dragging with the left mouse button. The start is in screen
+	// coordinates until the next frame converts it. Its statistics are shown in the image details overlay.
+	Image* RegionImage							= nullptr;
+	bool RegionDragging							= false;
+	bool RegionStartPending						= false;
+	tVector2 RegionStartScr;
+	int RegionStartX							= 0;
+	int RegionStartY							= 0;
+	int RegionEndX								= 0;
+	int RegionEndY								= 0;
+
+	// Where PixelColour was last read. It is only read again when the position or the pixels have changed.
+	Image* PixelColourImage						= nullptr;
+	int PixelColourX							= -1;
+	int PixelColourY							= -1;
+	int PixelColourPart							= -1;
+	uint32 PixelColourVersion					= 0;
+
 	enum class ZoomMode
 	{
 		User,
@@ -150,7 +206,22 @@ namespace Viewer
 	const float ZoomMax							= 2500.0f;
 	uint64 FrameNumber							= 0;
 
+	// The skybox view looks out from the centre of a cubemap. Dragging with the right mouse button turns the view, using
+	// the pan offsets to hold the angles. The mouse wheel changes the field of view.
+	bool SkyboxMode								= false;
+	float SkyboxFOV								= 90.0f;		// Vertical, in degrees.
+	const float SkyboxFOVMin					= 20.0f;
+	const float SkyboxFOVMax					= 140.0f;
+	const float SkyboxDegreesPerPixel			= 0.2f;
+	bool IsSkyboxActive()																								{ return SkyboxMode && CurrImage && CurrImage->IsAltCubemapPictureAvail() && !CropMode; }
+	void DrawSkybox(GLFWwindow*, float width, float height);
+
+	// Draws the alt layout one part at a time. The layout's uv range [u0, u1] x [v0, v1] maps onto the screen rectangle
+	// and may extend past [0, 1] when tiling.
+	void DrawAltQuads(float l, float r, float b, float t, float u0, float v0, float u1, float v1);
+
 	void DrawBackground(float bgX, float bgY, float bgW, float bgH);
+	void TexCoord(float u, float v)																						{ tVector2 uv = CurrImage->GetTextureUV(u, v); glTexCoord2f(uv.x, uv.y); }
 	void DrawNavBar(float x, float y, float w, float h);
 	int GetNavBarHeight();
 	void PrintRedirectCallback(const char* text, int numChars);
@@ -165,6 +236,7 @@ namespace Viewer
 		return ia.CreationTime < ib.CreationTime;
 	}
 	bool Compare_ImageLoadTimeAscending(const Image& a, const Image& b)													{ return a.GetLoadedTime() < b.GetLoadedTime(); }
+	bool Compare_ImageCompressedTimeAscending(const Image& a, const Image& b)											{ return a.GetCompressedTime() < b.GetCompressedTime(); }
 	bool Compare_ImageFileNameAscending(const Image& a, const Image& b)													{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) < 0; }
 	bool Compare_ImageFileNameDescending(const Image& a, const Image& b)												{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) > 0; }
 	bool Compare_ImageFileTypeAscending(const Image& a, const Image& b)													{ return int(a.Filetype) < int(b.Filetype); }
@@ -175,8 +247,8 @@ namespace Viewer
 	bool Compare_ImageFileSizeDescending(const Image& a, const Image& b)												{ return a.FileSizeB > b.FileSizeB; }
 	typedef bool ImageCompareFn(const Image&, const Image&);
 
-	bool OnPrevious();
-	bool OnNext();
+	bool OnPrevious(bool held = false);						// Held is true for key repeats.
+	bool OnNext(bool held = false);
 	void OnPreviousPart();
 	void OnNextPart();
 	bool OnSkipBegin();
@@ -253,19 +325,7 @@ tString Viewer::FindImageFilesInCurrentFolder(tList<tStringItem>& foundFiles)
 		imagesDir = tSystem::tGetDir(ImageFileParam.Get());
 
 	tPrintf("Finding image files in %s\n", imagesDir.Chars());
-	tSystem::tFindFiles(foundFiles, imagesDir, "jpg");
-	tSystem::tFindFiles(foundFiles, imagesDir, "gif");
-	tSystem::tFindFiles(foundFiles, imagesDir, "webp");
-	tSystem::tFindFiles(foundFiles, imagesDir, "tga");
-	tSystem::tFindFiles(foundFiles, imagesDir, "png");
-	tSystem::tFindFiles(foundFiles, imagesDir, "tif");
-	tSystem::tFindFiles(foundFiles, imagesDir, "tiff");
-	tSystem::tFindFiles(foundFiles, imagesDir, "bmp");
-	tSystem::tFindFiles(foundFiles, imagesDir, "dds");
-	tSystem::tFindFiles(foundFiles, imagesDir, "hdr");
-	tSystem::tFindFiles(foundFiles, imagesDir, "rgbe");
-	tSystem::tFindFiles(foundFiles, imagesDir, "exr");
-	tSystem::tFindFiles(foundFiles, imagesDir, "ico");
+	FindImageFiles(foundFiles, imagesDir);
 
 	return imagesDir;
 }
@@ -301,6 +361,12 @@ void Viewer::PopulateImagesSubDirs()
 
 void Viewer::PopulateImages()
 {
+	// The sequence player holds on to images from the list, and so may a navigation decode. The region and the picked
+	// colour point at images about to be deleted.
+	Sequence.Stop();
+	CancelNavigation();
+	RegionImage = nullptr;
+	PixelColourImage = nullptr;
 	Images.Clear();
 	ImagesLoadTimeSorted.Clear();
 
@@ -320,6 +386,7 @@ void Viewer::PopulateImages()
 		ImagesLoadTimeSorted.Append(newImg);
 	}
 
+	ImagesVersion++;
 	SortImages(Settings::SortKeyEnum(Config.SortKey), Config.SortAscending);
 	CurrImage = nullptr;
 }
@@ -348,6 +415,7 @@ void Viewer::SortImages(Settings::SortKeyEnum key, bool ascending)
 	}
 
 	Images.Sort(sortFn);
+	ImagesVersion++;
 }
 
 
@@ -401,10 +469,20 @@ void Viewer::SetCurrentImage(const tString& currFilename)
 void Viewer::LoadCurrImage()
 {
 	tAssert(CurrImage);
+
+	// Going to another image stops any sequence. The frame that was showing stays loaded.
+	Sequence.Stop();
+	CancelNavigation();
 	bool imgJustLoaded = false;
 	if (!CurrImage->IsLoaded())
-		imgJustLoaded = CurrImage->Load();
+		imgJustLoaded = CurrImage->LoadAndCache();
+
+	ShowCurrImage(imgJustLoaded);
+}
+
 
+void Viewer::ShowCurrImage(bool imgJustLoaded)
+{
 	if (Config.AutoPropertyWindow)
 		PropEditorWindow = (CurrImage->TypeSupportsProperties() || (CurrImage->GetNumParts() > 1));
 
@@ -426,38 +504,253 @@ void Viewer::LoadCurrImage()
 	// We currently do not allow unloading when in slideshow and the frame duration is small.
 	bool slideshowSmallDuration = SlideshowPlaying && (Config.SlidehowFrameDuration < 0.5f);
 	if (imgJustLoaded && !slideshowSmallDuration)
-	{
-		ImagesLoadTimeSorted.Sort(Compare_ImageLoadTimeAscending);
+		EvictImages();
+}
 
-		int64 usedMem = 0;
-		for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
-			usedMem += int64((*iter).Info.MemSizeBytes);
 
-		int64 allowedMem = int64(Config.MaxImageMemMB) * 1024 * 1024;
-		if (usedMem > allowedMem)
+void Viewer::EvictImages()
+{
+	ProfileScope profile(ProfileZone::Eviction);
+	ImagesLoadTimeSorted.Sort(Compare_ImageLoadTimeAscending);
+
+	int64 usedMem = 0;
+	for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
+		usedMem += int64((*iter).Info.MemSizeBytes);
+
+	// With adaptive memory the limit follows what the system can spare, up to its own cap. The fixed max is used if
+	// the system's memory can't be read, as on platforms the monitor doesn't support.
+	int64 allowedMem = int64(Config.MaxImageMemMB) * 1024 * 1024;
+	if (Config.AdaptiveImageMem && GetMemoryStatus().Valid)
+		allowedMem = GetImageMemBudget(usedMem, int64(256) * 1024 * 1024, int64(Config.MaxAdaptiveMemMB) * 1024 * 1024);
+
+	if (usedMem > allowedMem)
+	{
+		tPrintf("Used image mem (%|64d) bigger than max (%|64d). Unloading.\n", usedMem, allowedMem);
+		for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
 		{
-			tPrintf("Used image mem (%|64d) bigger than max (%|64d). Unloading.\n", usedMem, allowedMem);
-			for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
-			{
-				Image* i = iter.GetObject();
+			Image* i = iter.GetObject();
 
-				// Never unload the current image.
-				if (i->IsLoaded() && (i != CurrImage))
-				{
-					tPrintf("Unloading %s freeing %d Bytes\n", tSystem::tGetFileName(i->Filename).Chars(), i->Info.MemSizeBytes);
-					usedMem -= i->Info.MemSizeBytes;
+			// Never unload the current image.
+			if (i->IsLoaded() && (i != CurrImage))
+			{
+				tPrintf("Unloading %s freeing %d Bytes\n", tSystem::tGetFileName(i->Filename).Chars(), i->Info.MemSizeBytes);
+				usedMem -= i->Info.MemSizeBytes;
+				if (Config.MaxCompressedMemMB <= 0)
 					i->Unload();
-					if (usedMem < allowedMem)
-						break;
-				}
+				else if (i->UnloadCompressed())
+					tPrintf("Kept %s compressed in %|64d Bytes\n", tSystem::tGetFileName(i->Filename).Chars(), i->GetCompressedSize());
+				if (usedMem < allowedMem)
+					break;
 			}
-			tPrintf("Used mem %|64dB out of max %|64dB.\n", usedMem, allowedMem);
 		}
+		tPrintf("Used mem %|64dB out of max %|64dB.\n", usedMem, allowedMem);
+	}
+
+	// The compressed copies have their own limit. The oldest go first. Under pressure half of them are let go.
+	int64 compressedMem = Image::GetCompressedSizeTotal();
+	int64 allowedCompressedMem = int64(Config.MaxCompressedMemMB) * 1024 * 1024;
+	if (Config.AdaptiveImageMem && GetMemoryStatus().UnderPressure)
+		allowedCompressedMem = tMath::tMin(allowedCompressedMem, compressedMem/2);
+	if (compressedMem > allowedCompressedMem)
+	{
+		ImagesLoadTimeSorted.Sort(Compare_ImageCompressedTimeAscending);
+		for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter && (compressedMem > allowedCompressedMem); iter++)
+		{
+			Image* i = iter.GetObject();
+			if (!i->IsCompressed())
+				continue;
+
+			compressedMem -= i->GetCompressedSize();
+			i->Unload();
+		}
+		tPrintf("Used compressed mem %|64dB out of max %|64dB.\n", compressedMem, allowedCompressedMem);
 	}
 }
 
 
-bool Viewer::OnPrevious()
+void Viewer::ToggleSequence()
+{
+	if (Sequence.IsPlaying())
+	{
+		tPrintf
+		(
+			"Stopped sequence at frame %d. Achieved %.1f of %.1f fps with %d frames dropped.\n",
+			Sequence.GetFrame(), Sequence.GetAchievedFPS(), Sequence.GetFPS(), Sequence.GetNumDropped()
+		);
+		Sequence.Stop();
+		return;
+	}
+
+	std::vector<Image*> frames;
+	int startFrame = FindImageSequence(frames, Images, CurrImage);
+	if (startFrame < 0)
+	{
+		if (CurrImage)
+			tPrintf("%s is not part of a numbered image sequence.\n", tGetFileName(CurrImage->Filename).Chars());
+		return;
+	}
+
+	// Play from the start if we're on the last frame of a sequence that doesn't loop.
+	if ((startFrame == int(frames.size())-1) && !Config.SlideshowLooping)
+		startFrame = 0;
+
+	SlideshowPlaying = false;
+	CancelNavigation();
+	tPrintf("Playing %d frame sequence at %.2f fps.\n", int(frames.size()), Config.SequenceFPS);
+	Sequence.Start(frames, startFrame, Config.SequenceFPS, Config.SequenceDropFrames, Config.SlideshowLooping, Config.SequenceCacheMB);
+}
+
+
+void Viewer::UpdateSequence(double dt)
+{
+	// The frames are shown by making them the current image. LoadCurrImage isn't called as that would stop playback,
+	// and the player manages the memory of the frames itself.
+	Image* frame = Sequence.Update(dt);
+	if (frame && (frame != CurrImage))
+	{
+		CurrImage = frame;
+		SetWindowTitle();
+	}
+
+	if (!Sequence.IsPlaying())
+		tPrintf("Sequence finished. Achieved %.1f fps with %d frames dropped.\n", Sequence.GetAchievedFPS(), Sequence.GetNumDropped());
+}
+
+
+void Viewer::Navigate(Image* image)
+{
+	// There's nothing to wait for if the image is already loaded.
+	CurrImage = image;
+	if (CurrImage->IsLoaded())
+	{
+		LoadCurrImage();
+		return;
+	}
+
+	Sequence.Stop();
+	CancelNavigation();
+	NavPending = true;
+	NavSettleCountdown = NavSettleDuration;
+	CurrImage->RequestThumbnail();
+	SetWindowTitle();
+}
+
+
+void Viewer::CancelNavigation()
+{
+	NavPending = false;
+	if (NavCurrDecode)
+	{
+		NavCurrDecode->Cancelled = true;
+		NavCurrDecode = nullptr;
+	}
+}
+
+
+void Viewer::UpdateNavigation(double dt)
+{
+	// Cancelled decodes are only deleted here, once the worker is done with them.
+	for (int d = 0; d < int(NavDecodes.size()); )
+	{
+		NavDecode* decode = NavDecodes[d];
+		if (!decode->Done)
+		{
+			d++;
+			continue;
+		}
+
+		NavDecodes.erase(NavDecodes.begin() + d);
+		bool current = (decode == NavCurrDecode);
+		bool loaded = current && decode->Loaded && !CurrImage->IsLoaded();
+		if (loaded)
+			CurrImage->TakePictures(*decode->Loader);
+
+		delete decode->Loader;
+		delete decode;
+
+		// If the decode failed the image is left unloaded, as it would be had LoadCurrImage failed to load it.
+		if (current)
+		{
+			NavCurrDecode = nullptr;
+			NavPending = false;
+			ShowCurrImage(loaded);
+		}
+	}
+
+	if (!NavPending || NavCurrDecode)
+		return;
+
+	NavSettleCountdown -= dt;
+	if (NavSettleCountdown > 0.0)
+		return;
+
+	// Dds files need the GL context to load so they are done here. So are images kept compressed, as getting their
+	// pixels back is quick and doesn't read the file.
+	if ((CurrImage->Filetype == tFileType::DDS) || CurrImage->IsCompressed())
+	{
+		LoadCurrImage();
+		return;
+	}
+
+	NavDecode* decode = new NavDecode;
+	decode->Loader = new Image(CurrImage->Filename);
+	decode->Loader->LoadParams = CurrImage->LoadParams;
+	NavDecodes.push_back(decode);
+	NavCurrDecode = decode;
+	NavPool.Submit
+	(
+		[decode]
+		{
+			if (!decode->Cancelled)
+				decode->Loaded = decode->Loader->Load();
+			decode->Done = true;
+		}
+	);
+}
+
+
+void Viewer::DrawNavThumbnail(float width, float height)
+{
+	// Normally the content view does this, and it reaps the workers. Thumbnails keep the aspect of the image inside
+	// the thumbnail's own, so fitting that to the work area is enough.
+	if (!Config.ContentViewShow)
+		Image::ThumbAtlas.NewFrame();
+	Image::ReapThumbnailWorkers();
+	CurrImage->RequestThumbnail();
+
+	tVector2 uv0, uv1;
+	uint64 texID = CurrImage->BindThumbnail(uv0, uv1);
+	if (!texID)
+	{
+		texID = DefaultThumbnailImage.Bind();
+		uv0.Set(0.0f, 1.0f);
+		uv1.Set(1.0f, 0.0f);
+	}
+
+	float aspect = float(Image::ThumbWidth) / float(Image::ThumbHeight);
+	float w = width;
+	float h = width / aspect;
+	if (h > height)
+	{
+		h = height;
+		w = height * aspect;
+	}
+	float l = tMath::tRound((width - w) * 0.5f);		float r = l + tMath::tRound(w);
+	float b = tMath::tRound((height - h) * 0.5f);		float t = b + tMath::tRound(h);
+
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, GLuint(texID));
+	glBegin(GL_QUADS);
+	glTexCoord2f(uv0.x, uv1.y); glVertex2f(l, b);
+	glTexCoord2f(uv0.x, uv0.y); glVertex2f(l, t);
+	glTexCoord2f(uv1.x, uv0.y); glVertex2f(r, t);
+	glTexCoord2f(uv1.x, uv1.y); glVertex2f(r, b);
+	glEnd();
+}
+
+
+bool Viewer::OnPrevious(bool held)
 {
 	bool circ = SlideshowPlaying && Config.SlideshowLooping;
 	if (!CurrImage || (!circ && !CurrImage->Prev()))
@@ -466,13 +759,20 @@ bool Viewer::OnPrevious()
 	if (SlideshowPlaying)
 		SlideshowCountdown = Config.SlidehowFrameDuration;
 
-	CurrImage = circ ? Images.PrevCirc(CurrImage) : CurrImage->Prev();
+	Image* image = circ ? Images.PrevCirc(CurrImage) : CurrImage->Prev();
+	if (held)
+	{
+		Navigate(image);
+		return true;
+	}
+
+	CurrImage = image;
 	LoadCurrImage();
 	return true;
 }
 
 
-bool Viewer::OnNext()
+bool Viewer::OnNext(bool held)
 {
 	bool circ = SlideshowPlaying && Config.SlideshowLooping;
 	if (!CurrImage || (!circ && !CurrImage->Next()))
@@ -481,7 +781,14 @@ bool Viewer::OnNext()
 	if (SlideshowPlaying)
 		SlideshowCountdown = Config.SlidehowFrameDuration;
 
-	CurrImage = circ ? Images.NextCirc(CurrImage) : CurrImage->Next();
+	Image* image = circ ? Images.NextCirc(CurrImage) : CurrImage->Next();
+	if (held)
+	{
+		Navigate(image);
+		return true;
+	}
+
+	CurrImage = image;
 	LoadCurrImage();
 	return true;
 }
@@ -573,6 +880,19 @@ void Viewer::SetWindowTitle()
 }
 
 
+bool Viewer::GetSelectedRegion(int& x, int& y, int& w, int& h)
+{
+	if (!CurrImage || (RegionImage != CurrImage) || RegionStartPending)
+		return false;
+
+	x = tMin(RegionStartX, RegionEndX);
+	y = tMin(RegionStartY, RegionEndY);
+	w = tAbs(RegionEndX - RegionStartX) + 1;
+	h = tAbs(RegionEndY - RegionStartY) + 1;
+	return true;
+}
+
+
 void Viewer::ResetPan(bool resetX, bool resetY)
 {
 	if (resetX)
@@ -589,6 +909,104 @@ void Viewer::ResetPan(bool resetX, bool resetY)
 }
 
 
+void Viewer::DrawSkybox(GLFWwindow* window, float width, float height)
+{
+	double mouseXd, mouseYd;
+	glfwGetCursorPos(window, &mouseXd, &mouseYd);
+	float workH = float(Disph - GetNavBarHeight());
+	if (RMBDown)
+	{
+		PanDragDownOffsetX = int(mouseXd) - DragAnchorX;
+		PanDragDownOffsetY = int(workH - float(mouseYd)) - DragAnchorY;
+	}
+
+	// Dragging moves the scene with the mouse, so the camera turns the other way. Pitch stops short of straight up or
+	// down so the view never flips.
+	const float degToRad = 3.14159265f / 180.0f;
+	float yaw = -float(PanOffsetX + PanDragDownOffsetX) * SkyboxDegreesPerPixel * degToRad;
+	float pitch = tClamp(-float(PanOffsetY + PanDragDownOffsetY) * SkyboxDegreesPerPixel, -89.0f, 89.0f) * degToRad;
+	float sy = tSin(yaw);		float cy = tCos(yaw);
+	float sp = tSin(pitch);		float cp = tCos(pitch);
+
+	// Left-handed like dds cubemaps. Looking down +Z with +X to the right and +Y up when yaw and pitch are zero.
+	tVector3 forward(cp*sy, sp, cp*cy);
+	tVector3 right(cy, 0.0f, -sy);
+	tVector3 up(-sp*sy, cp, -sp*cy);
+	float tanY = tTan(0.5f * SkyboxFOV * degToRad);
+	float tanX = tanY * width / height;
+
+	// Directions through the corners interpolate linearly across the screen, so one quad gives an exact perspective
+	// projection with no distortion at the cube edges.
+	auto corner = [&](float x, float y)
+	{
+		glTexCoord3f
+		(
+			forward.x + right.x*x*tanX + up.x*y*tanY,
+			forward.y + right.y*x*tanX + up.y*y*tanY,
+			forward.z + right.z*x*tanX + up.z*y*tanY
+		);
+	};
+
+	if (!CurrImage->BindCubemap())
+		return;
+
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	glDisable(GL_TEXTURE_2D);
+	glEnable(GL_TEXTURE_CUBE_MAP);
+	glBegin(GL_QUADS);
+	corner(-1.0f, -1.0f);	glVertex2f(0.0f,	0.0f);
+	corner(-1.0f,  1.0f);	glVertex2f(0.0f,	height);
+	corner( 1.0f,  1.0f);	glVertex2f(width,	height);
+	corner( 1.0f, -1.0f);	glVertex2f(width,	0.0f);
+	glEnd();
+	glDisable(GL_TEXTURE_CUBE_MAP);
+}
+
+
+void Viewer::DrawAltQuads(float l, float r, float b, float t, float u0, float v0, float u1, float v1)
+{
+	float layoutW = float(CurrImage->GetWidth());
+	float layoutH = float(CurrImage->GetHeight());
+	if ((layoutW <= 0.0f) || (layoutH <= 0.0f) || (u1 <= u0) || (v1 <= v0))
+		return;
+
+	// Each part is clipped to the visible range, once for every repeat of the layout that range touches.
+	int numQuads = CurrImage->GetNumAltQuads();
+	for (int repV = int(tFloor(v0)); repV < int(tCeiling(v1)); repV++)
+	{
+		for (int repU = int(tFloor(u0)); repU < int(tCeiling(u1)); repU++)
+		{
+			for (int q = 0; q < numQuads; q++)
+			{
+				int qx, qy, qw, qh;
+				if (!CurrImage->GetAltQuad(q, qx, qy, qw, qh))
+					continue;
+
+				float qu0 = float(repU) + float(qx)/layoutW;		float qu1 = float(repU) + float(qx+qw)/layoutW;
+				float qv0 = float(repV) + float(qy)/layoutH;		float qv1 = float(repV) + float(qy+qh)/layoutH;
+				float cu0 = tMax(qu0, u0);							float cu1 = tMin(qu1, u1);
+				float cv0 = tMax(qv0, v0);							float cv1 = tMin(qv1, v1);
+				if ((cu1 <= cu0) || (cv1 <= cv0))
+					continue;
+
+				float x0 = l + (cu0-u0)/(u1-u0)*(r-l);				float x1 = l + (cu1-u0)/(u1-u0)*(r-l);
+				float y0 = b + (cv0-v0)/(v1-v0)*(t-b);				float y1 = b + (cv1-v0)/(v1-v0)*(t-b);
+				float tu0 = (cu0-qu0)/(qu1-qu0);					float tu1 = (cu1-qu0)/(qu1-qu0);
+				float tv0 = (cv0-qv0)/(qv1-qv0);					float tv1 = (cv1-qv0)/(qv1-qv0);
+
+				CurrImage->BindAltQuad(q);
+				glBegin(GL_QUADS);
+				glTexCoord2f(tu0, tv0); glVertex2f(x0, y0);
+				glTexCoord2f(tu0, tv1); glVertex2f(x0, y1);
+				glTexCoord2f(tu1, tv1); glVertex2f(x1, y1);
+				glTexCoord2f(tu1, tv0); glVertex2f(x1, y0);
+				glEnd();
+			}
+		}
+	}
+}
+
+
 void Viewer::DrawBackground(float bgX, float bgY, float bgW, float bgH)
 {
 	switch (Config.BackgroundStyle)
@@ -778,6 +1196,8 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	//
 	// Generally you may always pass all inputs to dear imgui, and hide them from your application based on those
 	// two flags.
+	ProfileEnable(ProfilerWindow);
+	ProfileNewFrame();
 	if (dopoll)
 		glfwPollEvents();
 
@@ -821,9 +1241,37 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	float uvUMarg = 0.0f;
 	float uvVMarg = 0.0f;
 
-	if (CurrImage)
+	if (Sequence.IsPlaying())
+		UpdateSequence(dt);
+
+	if (NavPending || !NavDecodes.empty())
+		UpdateNavigation(dt);
+
+	// When the system runs short of memory the caches are trimmed straight away rather than at the next load.
+	if (TakeMemoryPressureEvent() && Config.AdaptiveImageMem)
+	{
+		tPrintf("System memory under pressure. Trimming caches.\n");
+		PixelBuffers.Clear();
+		EvictImages();
+	}
+
+	if (CurrImage && NavPending)
 	{
+		ProfileScope profile(ProfileZone::ImageDraw);
+		DrawNavThumbnail(float(workAreaW), float(workAreaH));
+	}
+	else if (CurrImage && IsSkyboxActive())
+	{
+		ProfileScope profile(ProfileZone::ImageDraw);
+		CurrImage->UpdatePlaying(float(dt));
+		CurrImage->UpdateEdits();
+		DrawSkybox(window, float(workAreaW), float(workAreaH));
+	}
+	else if (CurrImage)
+	{
+		ProfileScope profile(ProfileZone::ImageDraw);
 		CurrImage->UpdatePlaying(float(dt));
+		CurrImage->UpdateEdits();
 
 		iw = float(CurrImage->GetWidth());
 		ih = float(CurrImage->GetHeight());
@@ -930,27 +1378,48 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			DrawBackground(l, b, r-l, t-b);
 
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-		CurrImage->Bind();
 		glEnable(GL_TEXTURE_2D);
-
-		glBegin(GL_QUADS);
-		if (!Config.Tile)
+		if (CurrImage->IsAltPictureEnabled())
 		{
-			glTexCoord2f(0.0f + uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(l, b);
-			glTexCoord2f(0.0f + uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(l, t);
-			glTexCoord2f(1.0f - uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(r, t);
-			glTexCoord2f(1.0f - uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(r, b);
+			if (!Config.Tile)
+			{
+				DrawAltQuads(l, r, b, t, uvUMarg + uvUOff, uvVMarg + uvVOff, 1.0f - uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff);
+			}
+			else
+			{
+				float repU = draww/(r-l);	float offU = (1.0f-repU)/2.0f;
+				float repV = drawh/(t-b);	float offV = (1.0f-repV)/2.0f;
+				DrawAltQuads
+				(
+					hmargin, hmargin+draww, vmargin, vmargin+drawh,
+					offU + uvUMarg + uvUOff, offV + uvVMarg + uvVOff, offU + repU - uvUMarg + uvUOff, offV + repV - uvVMarg + uvVOff
+				);
+			}
 		}
 		else
 		{
-			float repU = draww/(r-l);	float offU = (1.0f-repU)/2.0f;
-			float repV = drawh/(t-b);	float offV = (1.0f-repV)/2.0f;
-			glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin);
-			glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin+drawh);
-			glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin+drawh);
-			glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin);
+			CurrImage->Bind();
+
+			// The uvs go through the image so a pending flip or rotation shows before its pixels are ready.
+			glBegin(GL_QUADS);
+			if (!Config.Tile)
+			{
+				TexCoord(0.0f + uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(l, b);
+				TexCoord(0.0f + uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(l, t);
+				TexCoord(1.0f - uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(r, t);
+				TexCoord(1.0f - uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(r, b);
+			}
+			else
+			{
+				float repU = draww/(r-l);	float offU = (1.0f-repU)/2.0f;
+				float repV = drawh/(t-b);	float offV = (1.0f-repV)/2.0f;
+				TexCoord(offU + 0.0f + uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin);
+				TexCoord(offU + 0.0f + uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin+drawh);
+				TexCoord(offU + repU - uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin+drawh);
+				TexCoord(offU + repU - uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin);
+			}
+			glEnd();
 		}
-		glEnd();
 
 		// Get the colour under the reticle.
 		tVector2 scrCursorPos(ReticleX, ReticleY);
@@ -960,7 +1429,49 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			tVector2(uvUMarg, uvVMarg), tVector2(uvUOff, uvVOff)
 		);
 
-		PixelColour = CurrImage->GetPixel(imgx, imgy);
+		if
+		(
+			(PixelColourImage != CurrImage) || (PixelColourX != imgx) || (PixelColourY != imgy) ||
+			(PixelColourPart != CurrImage->PartNum) || (PixelColourVersion != CurrImage->GetPixelsVersion())
+		)
+		{
+			PixelColour = CurrImage->GetPixel(imgx, imgy);
+			PixelColourImage = CurrImage;
+			PixelColourX = imgx;
+			PixelColourY = imgy;
+			PixelColourPart = CurrImage->PartNum;
+			PixelColourVersion = CurrImage->GetPixelsVersion();
+		}
+
+		// Track the region being dragged out. It belongs to the image it was started on.
+		if (RegionImage != CurrImage)
+			RegionImage = nullptr;
+		if (RegionStartPending || RegionDragging)
+		{
+			int mouseImgX, mouseImgY;
+			ConvertScreenPosToImagePos
+			(
+				mouseImgX, mouseImgY, tVector2(mouseX, mouseY), tVector4(l, r, t, b),
+				tVector2(uvUMarg, uvVMarg), tVector2(uvUOff, uvVOff)
+			);
+			if (RegionStartPending)
+			{
+				ConvertScreenPosToImagePos
+				(
+					RegionStartX, RegionStartY, RegionStartScr, tVector4(l, r, t, b),
+					tVector2(uvUMarg, uvVMarg), tVector2(uvUOff, uvVOff)
+				);
+				RegionImage = CurrImage;
+				RegionStartPending = false;
+			}
+			RegionEndX = mouseImgX;
+			RegionEndY = mouseImgY;
+		}
+
+		int regionX, regionY, regionW, regionH;
+		bool regionValid = GetSelectedRegion(regionX, regionY, regionW, regionH) && !CropMode;
+		if (regionValid && Config.ShowImageDetails)
+			CurrImage->RequestRegionStats(regionX, regionY, regionW, regionH);
 
 		// Show the reticle.
 		glDisable(GL_TEXTURE_2D);
@@ -1023,6 +1534,27 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 		glDisable(GL_TEXTURE_2D);
 		glColor4fv(tColour::white.E);
+		if (regionValid)
+		{
+			tVector2 scrRegionBL, scrRegionTR;
+			ConvertImagePosToScreenPos
+			(
+				scrRegionBL, regionX, regionY, tVector4(l, r, t, b),
+				tVector2(uvUMarg, uvVMarg), tVector2(uvUOff, uvVOff)
+			);
+			ConvertImagePosToScreenPos
+			(
+				scrRegionTR, regionX+regionW, regionY+regionH, tVector4(l, r, t, b),
+				tVector2(uvUMarg, uvVMarg), tVector2(uvUOff, uvVOff)
+			);
+			glBegin(GL_LINE_LOOP);
+			glVertex2f(scrRegionBL.x,	scrRegionBL.y);
+			glVertex2f(scrRegionBL.x,	scrRegionTR.y);
+			glVertex2f(scrRegionTR.x,	scrRegionTR.y);
+			glVertex2f(scrRegionTR.x,	scrRegionBL.y);
+			glEnd();
+		}
+
 		static bool lastCropMode = false;
 		if (CropMode)
 		{
@@ -1038,6 +1570,8 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		lastCropMode = CropMode;
 	}
 
+	// The ImGui build ends at Render so we time it explicitly rather than with a scope.
+	double imguiBuildStart = IsProfileEnabled() ? ProfileGetTime() : -1.0;
 	ImGui::NewFrame();
 	
 	// Show the big demo window. You can browse its code to learn more about Dear ImGui.
@@ -1238,35 +1772,41 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		{
 			ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, tVector2(4,3));
 
+			if (ImGui::MenuItem("Undo", "Ctrl-Z", false, CurrImage && CurrImage->CanUndo() && !CurrImage->IsAltPictureEnabled()))
+			{
+				CurrImage->Undo();
+				SetWindowTitle();
+			}
+
+			if (ImGui::MenuItem("Redo", "Ctrl-Y", false, CurrImage && CurrImage->CanRedo() && !CurrImage->IsAltPictureEnabled()))
+			{
+				CurrImage->Redo();
+				SetWindowTitle();
+			}
+
+			ImGui::Separator();
+
 			if (ImGui::MenuItem("Flip Vertically", "Ctrl <", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Flip(false);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 
 			if (ImGui::MenuItem("Flip Horizontally", "Ctrl >", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Flip(true);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 
 			if (ImGui::MenuItem("Rotate Anti-Clockwise", "<", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Rotate90(true);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 
 			if (ImGui::MenuItem("Rotate Clockwise", ">", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Rotate90(false);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 
@@ -1300,6 +1840,12 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			}
 			ImGui::MenuItem("Image Details", "I", &Config.ShowImageDetails);
 			ImGui::MenuItem("Content View", "V", &Config.ContentViewShow);
+			ImGui::MenuItem("Profiler", "", &ProfilerWindow);
+			if (ImGui::MenuItem("Cubemap Skybox", "K", &SkyboxMode, CurrImage && CurrImage->IsAltCubemapPictureAvail() && !CropMode))
+				ResetPan();
+			bool sequencePlaying = Sequence.IsPlaying();
+			if (ImGui::MenuItem("Play Image Sequence", "Q", &sequencePlaying, CurrImage && !CropMode))
+				ToggleSequence();
 
 			ImGui::Separator();
 
@@ -1382,9 +1928,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Flip(false);
-			CurrImage->Bind();
 			SetWindowTitle();
 		}
 		ShowToolTip("Flip Vertically");
@@ -1395,9 +1939,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Flip(true);
-			CurrImage->Bind();
 			SetWindowTitle();
 		}
 		ShowToolTip("Flip Horizontally");
@@ -1408,9 +1950,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Rotate90(true);
-			CurrImage->Bind();
 			SetWindowTitle();
 		}
 		ShowToolTip("Rotate 90 Anticlockwise");
@@ -1421,9 +1961,7 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Rotate90(false);
-			CurrImage->Bind();
 			SetWindowTitle();
 		}
 		ShowToolTip("Rotate 90 Clockwise");
@@ -1534,14 +2072,23 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	ImGui::PopStyleVar();
 
 	if (!FullscreenMode && Config.ShowNavBar)
+	{
+		ProfileScope profile(ProfileZone::NavBar);
 		DrawNavBar(0.0f, float(disph - bottomUIHeight), float(dispw), float(bottomUIHeight));
+	}
 
 	// We allow the overlay and cheatsheet in fullscreen.
 	if (Config.ShowImageDetails)
 		ShowImageDetailsOverlay(&Config.ShowImageDetails, 0.0f, float(topUIHeight), float(dispw), float(disph - bottomUIHeight - topUIHeight), imgx, imgy, ZoomPercent);
 
 	if (Config.ContentViewShow)
+	{
+		ProfileScope profile(ProfileZone::ContentView);
 		ShowContentViewDialog(&Config.ContentViewShow);
+	}
+
+	if (ProfilerWindow)
+		ShowProfilerWindow(&ProfilerWindow);
 
 	if (ShowCheatSheet)
 		ShowCheatSheetPopup(&ShowCheatSheet);
@@ -1576,6 +2123,9 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	if (ImGui::BeginPopupModal("Delete File Permanently", &isOpenPerm, ImGuiWindowFlags_AlwaysAutoResize))
 		DoDeleteFileNoRecycleModal();
 
+	if (imguiBuildStart >= 0.0)
+		ProfileRecord(ProfileZone::ImGuiBuild, imguiBuildStart, ProfileGetTime());
+
 	ImGui::Render();
 	glViewport(0, 0, dispw, disph);
 	ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
@@ -1707,6 +2257,10 @@ bool Viewer::IsBasicViewAndBehaviour()
 
 void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int modifiers)
 {
+	// Letting go of the key that was flicking through the images starts the decode of the one it stopped on.
+	if ((action == GLFW_RELEASE) && ((key == GLFW_KEY_LEFT) || (key == GLFW_KEY_RIGHT)))
+		NavSettleCountdown = 0.0;
+
 	if ((action != GLFW_PRESS) && (action != GLFW_REPEAT))
 		return;
 
@@ -1732,7 +2286,7 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 			else if (modifiers == GLFW_MOD_ALT)
 				OnPreviousPart();
 			else
-				OnPrevious();
+				OnPrevious(action == GLFW_REPEAT);
 			break;
 
 		case GLFW_KEY_RIGHT:
@@ -1741,7 +2295,7 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 			else if (modifiers == GLFW_MOD_ALT)
 				OnNextPart();
 			else
-				OnNext();
+				OnNext(action == GLFW_REPEAT);
 			break;
 
 		case GLFW_KEY_SPACE:
@@ -1790,12 +2344,10 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_COMMA:
 			if (CurrImage && !CurrImage->IsAltPictureEnabled())
 			{
-				CurrImage->Unbind();
 				if (modifiers == GLFW_MOD_CONTROL)
 					CurrImage->Flip(false);
 				else
 					CurrImage->Rotate90(true);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 			break;
@@ -1803,12 +2355,10 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_PERIOD:
 			if (CurrImage && !CurrImage->IsAltPictureEnabled())
 			{
-				CurrImage->Unbind();
 				if (modifiers == GLFW_MOD_CONTROL)
 					CurrImage->Flip(true);
 				else
 					CurrImage->Rotate90(false);
-				CurrImage->Bind();
 				SetWindowTitle();
 			}
 			break;
@@ -1837,6 +2387,18 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 			}
 			break;
 
+		case GLFW_KEY_K:
+			if (!CurrImage || !CurrImage->IsAltCubemapPictureAvail() || CropMode)
+				break;
+			SkyboxMode = !SkyboxMode;
+			ResetPan();
+			break;
+
+		case GLFW_KEY_Q:
+			if (!CropMode)
+				ToggleSequence();
+			break;
+
 		case GLFW_KEY_T:
 			Config.Tile = !Config.Tile;
 			if (!Config.Tile)
@@ -1887,11 +2449,28 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 			break;
 
 		case GLFW_KEY_Z:
+			if (modifiers == GLFW_MOD_CONTROL)
+			{
+				if (CurrImage && !CurrImage->IsAltPictureEnabled())
+				{
+					CurrImage->Undo();
+					SetWindowTitle();
+				}
+				break;
+			}
 			ZoomPercent = 100.0f;
 			ResetPan();
 			CurrZoomMode = ZoomMode::OneToOne;
 			break;
 
+		case GLFW_KEY_Y:
+			if ((modifiers == GLFW_MOD_CONTROL) && CurrImage && !CurrImage->IsAltPictureEnabled())
+			{
+				CurrImage->Redo();
+				SetWindowTitle();
+			}
+			break;
+
 		case GLFW_KEY_S:
 			if (!modifiers)
 			{
@@ -1948,10 +2527,22 @@ void Viewer::MouseButtonCallback(GLFWwindow* window, int mouseButton, int press,
 			{
 				CropGizmo.MouseButton(LMBDown, tVector2(mouseX, mouseY));
 			}
+			else if (LMBDown && (mods & GLFW_MOD_SHIFT))
+			{
+				RegionDragging = true;
+				RegionStartPending = true;
+				RegionStartScr = tVector2(mouseX, mouseY);
+			}
 			else if (LMBDown)
 			{
+				// A plain click moves the reticle and clears any region.
 				ReticleX = mouseX;
 				ReticleY = mouseY;
+				RegionImage = nullptr;
+			}
+			else
+			{
+				RegionDragging = false;
 			}
 			break;
 		}
@@ -1991,6 +2582,12 @@ void Viewer::ScrollWheelCallback(GLFWwindow* window, double x, double y)
 
 	DisappearCountdown = DisappearDuration;
 
+	if (IsSkyboxActive())
+	{
+		SkyboxFOV = tClamp(SkyboxFOV - 5.0f*float(y), SkyboxFOVMin, SkyboxFOVMax);
+		return;
+	}
+
 	CurrZoomMode = ZoomMode::User;
 	float percentChange = (y > 0.0) ? 0.1f : 1.0f-0.909090909f;
 	float zoomDelta = ZoomPercent * percentChange * float(y);
@@ -2171,6 +2768,10 @@ int main(int argc, char** argv)
 	tPrintf("LD_LIBRARY_PATH  : %s\n", ldLibraryPath.Chars());
 	#endif
 
+	// Command line conversions never open a window.
+	if (Viewer::IsCommandLineConvert())
+		return Viewer::DoCommandLineConvert();
+
 	// Setup window
 	glfwSetErrorCallback(Viewer::GlfwErrorCallback);
 	if (!glfwInit())
@@ -2216,8 +2817,17 @@ int main(int argc, char** argv)
 
 	if (!tSystem::tDirExists(Image::ThumbCacheDir))
 		tSystem::tCreateDir(Image::ThumbCacheDir);
+
+	Image::PixelCacheDir = Image::ThumbCacheDir + "Pixels/";
+	if (!tSystem::tDirExists(Image::PixelCacheDir))
+		tSystem::tCreateDir(Image::PixelCacheDir);
+	Viewer::LoadContentKeyIndex(Image::ThumbCacheDir + "ContentKeys.idx");
 	
 	Viewer::Config.Load(cfgFile, mode->width, mode->height);
+	Viewer::MemoryMonitorStart();
+
+	// Trimming finds out how big the pixel cache is and catches up if the last run didn't get to trim on exit.
+	Image::TrimPixelCache(int64(Viewer::Config.MaxPixelCacheMB) * 1024 * 1024);
 
 	// We start with window invisible. For windows DwmSetWindowAttribute won't redraw properly otherwise.
 	// For all plats, we want to position the window before displaying it.
@@ -2290,6 +2900,7 @@ int main(int argc, char** argv)
 		return 10;
     }
 	tPrintf("GLAD V %s\n", glGetString(GL_VERSION));
+	Image::ThumbCompressionSupported = GLAD_GL_EXT_texture_compression_s3tc ? true : false;
 
 	glfwSwapInterval(1); // Enable vsync
 	glfwSetWindowRefreshCallback(Viewer::Window, Viewer::WindowRefreshFun);
@@ -2368,9 +2979,15 @@ int main(int argc, char** argv)
 
 	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while shutting
 	// down worker threads. We could show a 'shutting down' popup here if we wanted -- if Image::ThumbnailNumThreadsRunning is > 0.
+	Viewer::MemoryMonitorStop();
+	Viewer::Sequence.Stop();
+	Viewer::CancelNavigation();
+	Viewer::NavPool.WaitIdle();
+	Viewer::UpdateNavigation(0.0);
 	Viewer::Images.Clear();
 	
 	Viewer::UnloadAppImages();
+	Image::ThumbAtlas.Clear();
 
 	// Get current window geometry and set in config file if we're not in fullscreen mode and not iconified.
 	if (!Viewer::FullscreenMode && !Viewer::WindowIconified)
@@ -2392,6 +3009,10 @@ int main(int argc, char** argv)
 	if (Viewer::DeleteAllCacheFilesOnExit)
 		tSystem::tDeleteDir(Image::ThumbCacheDir);
 	else
+	{
+		Viewer::SaveContentKeyIndex(Image::ThumbCacheDir + "ContentKeys.idx", Viewer::Config.MaxCacheFiles);
 		Viewer::RemoveOldCacheFiles(Image::ThumbCacheDir);
+		Image::TrimPixelCache(int64(Viewer::Config.MaxPixelCacheMB) * 1024 * 1024);
+	}
 	return 0;
 }
@@ -19,6 +19,7 @@
 #include "Settings.h"
 class Image;
 class tColouri;
+namespace Viewer { class SequencePlayer; }
 
 
 namespace Viewer
@@ -29,6 +30,7 @@ namespace Viewer
 	extern tList<tStringItem> ImagesSubDirs;
 	extern tList<Image> Images;
 	extern tItList<Image> ImagesLoadTimeSorted;
+	extern int ImagesVersion;				// Incremented whenever the Images list is repopulated, added to, or reordered.
 	extern tCommand::tParam ImageFileParam;
 	extern tColouri PixelColour;
 	extern Image DefaultThumbnailImage;
@@ -43,6 +45,7 @@ namespace Viewer
 	extern Image NextImage;
 	extern Image SkipBeginImage;
 	extern Image SkipEndImage;
+	extern SequencePlayer Sequence;
 	extern bool CropMode;
 	extern bool DeleteAllCacheFilesOnExit;
 
@@ -71,6 +74,9 @@ namespace Viewer
 	void SetWindowTitle();
 	tMath::tVector2 GetDialogOrigin(float index);
 
+	// Gets the region selected on the current image by shift-dragging. Returns false if there isn't one.
+	bool GetSelectedRegion(int& x, int& y, int& w, int& h);
+
 	void ConvertScreenPosToImagePos
 	(
 		int& imgX, int& imgY,
@@ -0,0 +1,80 @@
+// ThreadPool.cpp
+//
+// A fixed set of worker threads that run submitted tasks in first-in first-out order.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include "ThreadPool.h"
+
+
+ThreadPool::~ThreadPool()
+{
+	WaitIdle();
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Stopping = true;
+	}
+	TaskAvailable.notify_all();
+	for (std::thread& thread : Threads)
+		thread.join();
+}
+
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (Threads.empty())
+		{
+			for (int t = 0; t < ((NumThreads > 0) ? NumThreads : 1); t++)
+				Threads.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+		}
+		Tasks.push_back(std::move(task));
+	}
+	TaskAvailable.notify_one();
+}
+
+
+void ThreadPool::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	Idle.wait(lock, [this]() { return Tasks.empty() && (NumRunning == 0); });
+}
+
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			TaskAvailable.wait(lock, [this]() { return Stopping || !Tasks.empty(); });
+			if (Stopping && Tasks.empty())
+				return;
+
+			task = std::move(Tasks.front());
+			Tasks.pop_front();
+			NumRunning++;
+		}
+
+		task();
+
+		bool idle = false;
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			NumRunning--;
+			idle = Tasks.empty() && (NumRunning == 0);
+		}
+		if (idle)
+			Idle.notify_all();
+	}
+}
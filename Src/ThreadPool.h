@@ -0,0 +1,52 @@
+// ThreadPool.h
+//
+// A fixed set of worker threads that run submitted tasks in first-in first-out order.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+	// The threads are started lazily by the first Submit.
+	ThreadPool(int numThreads)																							: NumThreads(numThreads) { }
+
+	// Waits for every queued task to finish before joining the threads.
+	~ThreadPool();
+
+	// Tasks may submit further tasks. Because the queue is FIFO a task submitted by another task runs after everything
+	// already queued, which is what lets a chain of dependent tasks form a pipeline.
+	void Submit(std::function<void()> task);
+
+	// Blocks until the queue is empty and no task is running.
+	void WaitIdle();
+	int GetNumThreads() const																							{ return NumThreads; }
+
+private:
+	void WorkerLoop();
+
+	int NumThreads;
+	std::vector<std::thread> Threads;
+	std::deque<std::function<void()>> Tasks;
+	std::mutex Mutex;
+	std::condition_variable TaskAvailable;
+	std::condition_variable Idle;
+	int NumRunning					= 0;
+	bool Stopping					= false;
+};
@@ -0,0 +1,278 @@
+// ThumbnailAtlas.cpp
+//
+// Packs Content View thumbnails into a small number of large texture pages so that many thumbnails share a single
+// texture and ImGui can merge their draw calls.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <glad/glad.h>
+#include <Math/tFundamentals.h>
+#include "ThumbnailAtlas.h"
+using namespace tImage;
+using namespace tMath;
+
+
+const int ThumbnailAtlas::PageSize		= 2048;
+const int ThumbnailAtlas::MaxPages		= 16;
+const int ThumbnailAtlas::SlotBorder	= 2;
+
+
+void ThumbnailAtlas::Clear()
+{
+	for (Page& page : Pages)
+	{
+		if (page.TexID != 0)
+			glDeleteTextures(1, &page.TexID);
+	}
+
+	Pages.clear();
+	NumSlotsUsed = 0;
+}
+
+
+int ThumbnailAtlas::ReleaseEmptyPages()
+{
+	// Only trailing pages are deleted so the slot indices of every other page stay the same.
+	int numDeleted = 0;
+	while (!Pages.empty())
+	{
+		Page& page = Pages.back();
+		for (const Slot& slot : page.Slots)
+		{
+			if (slot.Owner)
+				return numDeleted;
+		}
+
+		if (page.TexID != 0)
+			glDeleteTextures(1, &page.TexID);
+		Pages.pop_back();
+		numDeleted++;
+	}
+
+	return numDeleted;
+}
+
+
+bool ThumbnailAtlas::AddPage(bool compressed)
+{
+	if (GetNumPages() >= MaxPages)
+		return false;
+
+	int pitchW = SlotWidth  + 2*SlotBorder;
+	int pitchH = SlotHeight + 2*SlotBorder;
+	SlotsPerRow = PageSize / pitchW;
+	SlotsPerCol = PageSize / pitchH;
+	if ((SlotsPerRow <= 0) || (SlotsPerCol <= 0))
+		return false;
+
+	Page page;
+	glGenTextures(1, &page.TexID);
+	if (page.TexID == 0)
+		return false;
+
+	// Passing null data allocates the storage without an upload. The contents are undefined until slots are uploaded.
+	page.Compressed = compressed;
+	glBindTexture(GL_TEXTURE_2D, page.TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	GLenum format = compressed ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_RGBA8;
+	glTexImage2D(GL_TEXTURE_2D, 0, format, PageSize, PageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	page.Slots.resize(SlotsPerRow*SlotsPerCol);
+	Pages.push_back(page);
+	return true;
+}
+
+
+void ThumbnailAtlas::GetSlotOrigin(int slot, int& x, int& y) const
+{
+	int slotsPerPage = GetNumSlotsPerPage();
+	int local = slot % slotsPerPage;
+	x = (local % SlotsPerRow) * (SlotWidth  + 2*SlotBorder) + SlotBorder;
+	y = (local / SlotsPerRow) * (SlotHeight + 2*SlotBorder) + SlotBorder;
+}
+
+
+int ThumbnailAtlas::Allocate(const void* owner, bool compressed)
+{
+	// First look for a free slot on an existing page of the right format. While we're at it, remember the least
+	// recently used slot that wasn't drawn this frame in case we need to reclaim one.
+	int lruSlot = -1;
+	uint64 lruFrame = FrameNumber;
+	for (int p = 0; p < GetNumPages(); p++)
+	{
+		Page& page = Pages[p];
+		if (page.Compressed != compressed)
+			continue;
+
+		for (int s = 0; s < int(page.Slots.size()); s++)
+		{
+			Slot& slot = page.Slots[s];
+			if (!slot.Owner)
+			{
+				slot.Owner = owner;
+				slot.LastUsedFrame = FrameNumber;
+				NumSlotsUsed++;
+				return p*GetNumSlotsPerPage() + s;
+			}
+
+			if (slot.LastUsedFrame < lruFrame)
+			{
+				lruFrame = slot.LastUsedFrame;
+				lruSlot = p*GetNumSlotsPerPage() + s;
+			}
+		}
+	}
+
+	// No free slots. Grow if we can. The first slot of a new page is always free.
+	if (AddPage(compressed))
+	{
+		Page& page = Pages.back();
+		page.Slots[0].Owner = owner;
+		page.Slots[0].LastUsedFrame = FrameNumber;
+		NumSlotsUsed++;
+		return (GetNumPages()-1)*GetNumSlotsPerPage();
+	}
+
+	// Reclaim the least recently used slot. The previous owner will notice it no longer owns it.
+	if (lruSlot < 0)
+		return -1;
+
+	Slot& slot = Pages[lruSlot / GetNumSlotsPerPage()].Slots[lruSlot % GetNumSlotsPerPage()];
+	slot.Owner = owner;
+	slot.LastUsedFrame = FrameNumber;
+	return lruSlot;
+}
+
+
+void ThumbnailAtlas::Free(int slot, const void* owner)
+{
+	if (!IsOwner(slot, owner))
+		return;
+
+	Slot& s = Pages[slot / GetNumSlotsPerPage()].Slots[slot % GetNumSlotsPerPage()];
+	s.Owner = nullptr;
+	s.LastUsedFrame = 0;
+	NumSlotsUsed--;
+}
+
+
+bool ThumbnailAtlas::IsOwner(int slot, const void* owner) const
+{
+	if ((slot < 0) || Pages.empty())
+		return false;
+
+	int page = slot / GetNumSlotsPerPage();
+	if (page >= GetNumPages())
+		return false;
+
+	return Pages[page].Slots[slot % GetNumSlotsPerPage()].Owner == owner;
+}
+
+
+void ThumbnailAtlas::AddBorder(tPixel* dst, const tPixel* pixels, int width, int height) const
+{
+	// The border replicates the edge pixels by clamping source coordinates.
+	int bw = GetBorderedWidth();
+	int bh = GetBorderedHeight();
+	for (int y = 0; y < bh; y++)
+	{
+		int sy = tClamp(y - SlotBorder, 0, height-1);
+		const tPixel* srcRow = pixels + sy*width;
+		tPixel* dstRow = dst + y*bw;
+		for (int x = 0; x < SlotBorder; x++)
+			dstRow[x] = srcRow[0];
+		tStd::tMemcpy(dstRow + SlotBorder, srcRow, width*sizeof(tPixel));
+		for (int x = SlotBorder+width; x < bw; x++)
+			dstRow[x] = srcRow[width-1];
+	}
+}
+
+
+bool ThumbnailAtlas::Upload(int slot, const tPixel* pixels, int width, int height)
+{
+	if (!pixels || (width != SlotWidth) || (height != SlotHeight) || (slot < 0) || Pages.empty())
+		return false;
+	if ((slot / GetNumSlotsPerPage() >= GetNumPages()) || Pages[slot / GetNumSlotsPerPage()].Compressed)
+		return false;
+
+	int bw = GetBorderedWidth();
+	int bh = GetBorderedHeight();
+	UploadBuffer.resize(bw*bh);
+	AddBorder(UploadBuffer.data(), pixels, width, height);
+
+	int originX, originY;
+	GetSlotOrigin(slot, originX, originY);
+	glBindTexture(GL_TEXTURE_2D, Pages[slot / GetNumSlotsPerPage()].TexID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D
+	(
+		GL_TEXTURE_2D, 0, originX-SlotBorder, originY-SlotBorder, bw, bh,
+		GL_RGBA, GL_UNSIGNED_BYTE, UploadBuffer.data()
+	);
+	return true;
+}
+
+
+bool ThumbnailAtlas::UploadCompressed(int slot, const uint8* blocks, int numBytes)
+{
+	int bw = GetBorderedWidth();
+	int bh = GetBorderedHeight();
+	if (!blocks || (numBytes != (bw/4)*(bh/4)*16) || (bw % 4) || (bh % 4) || (slot < 0) || Pages.empty())
+		return false;
+	if ((slot / GetNumSlotsPerPage() >= GetNumPages()) || !Pages[slot / GetNumSlotsPerPage()].Compressed)
+		return false;
+
+	// The bordered slot starts on a block boundary because the slot pitch is a multiple of 4.
+	int originX, originY;
+	GetSlotOrigin(slot, originX, originY);
+	glBindTexture(GL_TEXTURE_2D, Pages[slot / GetNumSlotsPerPage()].TexID);
+	glCompressedTexSubImage2D
+	(
+		GL_TEXTURE_2D, 0, originX-SlotBorder, originY-SlotBorder, bw, bh,
+		GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, numBytes, blocks
+	);
+	return true;
+}
+
+
+int64 ThumbnailAtlas::GetNumBytes() const
+{
+	// BC3 is a byte per texel.
+	int64 numBytes = 0;
+	for (const Page& page : Pages)
+		numBytes += int64(PageSize)*PageSize*(page.Compressed ? 1 : 4);
+	return numBytes;
+}
+
+
+uint ThumbnailAtlas::Touch(int slot, tVector2& uv0, tVector2& uv1)
+{
+	if ((slot < 0) || Pages.empty())
+		return 0;
+
+	int page = slot / GetNumSlotsPerPage();
+	if (page >= GetNumPages())
+		return 0;
+
+	Pages[page].Slots[slot % GetNumSlotsPerPage()].LastUsedFrame = FrameNumber;
+
+	int originX, originY;
+	GetSlotOrigin(slot, originX, originY);
+	float invSize = 1.0f / float(PageSize);
+
+	// Row 0 of the thumbnail is at the bottom so v is flipped for ImGui, which expects the top-left first.
+	uv0.Set(float(originX)*invSize,				float(originY+SlotHeight)*invSize);
+	uv1.Set(float(originX+SlotWidth)*invSize,	float(originY)*invSize);
+	return Pages[page].TexID;
+}
@@ -0,0 +1,109 @@
+// ThumbnailAtlas.h
+//
+// Packs Content View thumbnails into a small number of large texture pages so that many thumbnails share a single
+// texture and ImGui can merge their draw calls.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tStandard.h>
+#include <Math/tVector2.h>
+#include <Image/tPicture.h>
+
+
+// All thumbnails have the same dimensions so slot allocation is trivial: each page is divided into a fixed grid of
+// equally sized slots. Slots carry a small border that is filled by extruding the edge pixels so bilinear filtering
+// never picks up texels from a neighbour. When every slot is taken the least-recently-drawn one is handed out again.
+// The previous owner finds out the next time it calls IsOwner and must upload again if it still wants to be drawn.
+// Pages are either RGBA or BC3 compressed. Slot and border sizes are multiples of 4 so compressed slots are made of
+// whole blocks.
+class ThumbnailAtlas
+{
+public:
+	ThumbnailAtlas(int slotWidth, int slotHeight)																		: SlotWidth(slotWidth), SlotHeight(slotHeight) { }
+
+	// The destructor does not make any GL calls because there may be no context by the time static objects are
+	// destroyed. Call Clear while the context is still current.
+	~ThumbnailAtlas()																									{ }
+
+	// Deletes all page textures and frees every slot. Requires a current GL context.
+	void Clear();
+
+	// Call once per frame before drawing thumbnails. Slots drawn in the current frame are never reclaimed.
+	void NewFrame()																										{ FrameNumber++; }
+
+	// Returns the index of a slot now owned by owner, or -1 if all pages are full and every slot was drawn this frame.
+	// The slot contents are undefined until Upload is called. Slots on compressed pages take UploadCompressed.
+	int Allocate(const void* owner, bool compressed = false);
+
+	// Releases the slot if owner still owns it. It is safe to call with an invalid slot index.
+	void Free(int slot, const void* owner);
+	bool IsOwner(int slot, const void* owner) const;
+
+	// Copies the supplied pixels into the slot. Width and height must match the slot dimensions. Row 0 of the pixel
+	// data is the bottom row, just like tPicture.
+	bool Upload(int slot, const tImage::tPixel* pixels, int width, int height);
+
+	// Copies BC3 blocks of the whole bordered slot, as made from the output of AddBorder, into a compressed slot.
+	bool UploadCompressed(int slot, const uint8* blocks, int numBytes);
+
+	// Fills dst, which must hold GetBorderedWidth() * GetBorderedHeight() pixels, with the slot sized pixels surrounded
+	// by their extruded edges. Safe to call from any thread.
+	void AddBorder(tImage::tPixel* dst, const tImage::tPixel* pixels, int width, int height) const;
+	int GetBorderedWidth() const																						{ return SlotWidth + 2*SlotBorder; }
+	int GetBorderedHeight() const																						{ return SlotHeight + 2*SlotBorder; }
+
+	// Returns the page texture for the slot and marks the slot as drawn this frame. The returned uvs are ready to be
+	// passed to ImGui, so uv0 is the top-left and uv1 the bottom-right of the thumbnail.
+	uint Touch(int slot, tMath::tVector2& uv0, tMath::tVector2& uv1);
+
+	// Deletes pages at the end that have no slots in use, giving their VRAM back. Pages are filled from the first so
+	// these are the ones that empty out as thumbnails are freed. Requires a current GL context. Returns num deleted.
+	int ReleaseEmptyPages();
+
+	int GetNumPages() const																								{ return int(Pages.size()); }
+	int64 GetNumBytes() const;
+	int GetNumSlotsPerPage() const																						{ return SlotsPerRow*SlotsPerCol; }
+	int GetNumSlotsUsed() const																							{ return NumSlotsUsed; }
+
+	const static int PageSize;			// = 2048;
+	const static int MaxPages;			// = 16;
+	const static int SlotBorder;		// = 2;
+
+private:
+	struct Slot
+	{
+		const void* Owner				= nullptr;
+		uint64 LastUsedFrame			= 0;
+	};
+
+	struct Page
+	{
+		uint TexID						= 0;
+		bool Compressed					= false;
+		std::vector<Slot> Slots;
+	};
+
+	bool AddPage(bool compressed);
+	void GetSlotOrigin(int slot, int& x, int& y) const;
+
+	int SlotWidth;
+	int SlotHeight;
+	int SlotsPerRow						= 0;
+	int SlotsPerCol						= 0;
+	int NumSlotsUsed					= 0;
+	uint64 FrameNumber					= 1;
+	std::vector<Page> Pages;
+
+	// Scratch space used to build the bordered slot image before it is sent to the GPU.
+	std::vector<tImage::tPixel> UploadBuffer;
+};